@@ -0,0 +1,371 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <limits>
+#include <type_traits>
+#include <stdexcept>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "qdtsne/qdtsne.hpp"
+
+/*
+ * Command-line tool for running t-SNE on a dataset stored on disk.
+ *
+ * The input is either:
+ *
+ * - a dense matrix (--data), stored as a raw array of doubles in column-major
+ *   format with --ndim rows and one column per observation.
+ * - precomputed neighbors (--knn-indices and --knn-distances), stored as raw
+ *   arrays of int32 indices and double distances respectively. Each array is
+ *   a column-major matrix with --k rows and one column per observation.
+ * - precomputed neighbors in a neighbor file (--knn), see neighbor_file.hpp.
+ *
+ * The --data, --knn-indices and --knn-distances files are memory-mapped so
+ * that large datasets are not copied into memory before they are needed.
+ * Neighbor files (--knn) are instead read into memory by read_neighbors().
+ * The embedding is written to --output as a raw array of doubles in
+ * column-major format with one row per dimension. Timings for each phase
+ * (neighbor search, initialization, the early exaggeration and the remaining
+ * iterations) are printed to stderr.
+ */
+
+class MappedFile {
+public:
+    MappedFile(const std::string& path) {
+        my_fd = open(path.c_str(), O_RDONLY);
+        if (my_fd < 0) {
+            throw std::runtime_error("failed to open '" + path + "'");
+        }
+
+        struct stat info;
+        if (fstat(my_fd, &info) != 0) {
+            close(my_fd);
+            throw std::runtime_error("failed to determine the size of '" + path + "'");
+        }
+
+        my_size = info.st_size;
+        if (my_size) {
+            my_data = mmap(NULL, my_size, PROT_READ, MAP_PRIVATE, my_fd, 0);
+            if (my_data == MAP_FAILED) {
+                close(my_fd);
+                throw std::runtime_error("failed to memory-map '" + path + "'");
+            }
+        }
+    }
+
+    ~MappedFile() {
+        if (my_size) {
+            munmap(my_data, my_size);
+        }
+        close(my_fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    template<typename Type_>
+    const Type_* data() const {
+        return static_cast<const Type_*>(my_data);
+    }
+
+    size_t size() const {
+        return my_size;
+    }
+
+private:
+    int my_fd = -1;
+    void* my_data = NULL;
+    size_t my_size = 0;
+};
+
+class Arguments {
+public:
+    Arguments(int argc, char** argv, const std::unordered_set<std::string>& known) {
+        for (int i = 1; i < argc; ++i) {
+            std::string flag = argv[i];
+            if (flag.rfind("--", 0) != 0 || flag.size() == 2) {
+                throw std::runtime_error("expected a flag instead of '" + flag + "'");
+            }
+            if (flag == "--help") {
+                my_values["help"] = "1";
+                continue;
+            }
+
+            auto name = flag.substr(2);
+            if (known.find(name) == known.end()) {
+                throw std::runtime_error("unknown flag '" + flag + "', see '--help'");
+            }
+            if (i + 1 == argc) {
+                throw std::runtime_error("no value supplied for '" + flag + "'");
+            }
+            my_values[name] = argv[++i];
+        }
+    }
+
+    bool has(const std::string& name) const {
+        return my_values.find(name) != my_values.end();
+    }
+
+    std::string get_string(const std::string& name) const {
+        auto it = my_values.find(name);
+        if (it == my_values.end()) {
+            throw std::runtime_error("missing required flag '--" + name + "'");
+        }
+        return it->second;
+    }
+
+    template<typename Type_>
+    void get(const std::string& name, Type_& value) const {
+        auto it = my_values.find(name);
+        if (it == my_values.end()) {
+            return;
+        }
+
+        const auto& str = it->second;
+        size_t used = 0;
+        try {
+            if constexpr(std::is_same<Type_, bool>::value) {
+                if (str == "true" || str == "1") {
+                    value = true;
+                } else if (str == "false" || str == "0") {
+                    value = false;
+                } else {
+                    throw std::invalid_argument(str);
+                }
+                used = str.size();
+            } else if constexpr(std::is_floating_point<Type_>::value) {
+                value = std::stod(str, &used);
+            } else if constexpr(std::is_signed<Type_>::value) {
+                auto parsed = std::stoll(str, &used);
+                if (parsed < std::numeric_limits<Type_>::min() || parsed > std::numeric_limits<Type_>::max()) {
+                    throw std::out_of_range(str);
+                }
+                value = parsed;
+            } else {
+                // stoull() silently wraps negative values.
+                if (str.find('-') != std::string::npos) {
+                    throw std::out_of_range(str);
+                }
+                auto parsed = std::stoull(str, &used);
+                if (parsed > std::numeric_limits<Type_>::max()) {
+                    throw std::out_of_range(str);
+                }
+                value = parsed;
+            }
+        } catch (std::exception&) {
+            used = 0;
+        }
+
+        if (used != str.size() || str.empty()) {
+            throw std::runtime_error("invalid value '" + str + "' for '--" + name + "'");
+        }
+    }
+
+private:
+    std::unordered_map<std::string, std::string> my_values;
+};
+
+static void print_usage() {
+    std::cerr <<
+        "Usage: qdtsne (--data FILE --ndim D | --knn FILE | --knn-indices FILE --knn-distances FILE --k K) --output FILE [OPTIONS]\n"
+        "\n"
+        "Input and output:\n"
+        "  --data FILE              Dense column-major matrix of doubles with D rows.\n"
+        "  --ndim D                 Number of rows in --data.\n"
+        "  --knn FILE               Neighbor file created by qdtsne::write_neighbors().\n"
+        "  --knn-indices FILE       Column-major matrix of int32 neighbor indices with K rows.\n"
+        "  --knn-distances FILE     Column-major matrix of double neighbor distances with K rows.\n"
+        "  --k K                    Number of neighbors in --knn-indices and --knn-distances.\n"
+        "  --output FILE            Output file for the column-major embedding of doubles.\n"
+        "  --dims N                 Number of embedding dimensions, 1 to 3 (default: 2).\n"
+        "  --init-seed SEED         Seed for the random initial coordinates (default: 42).\n"
+        "\n"
+        "Algorithm options, see qdtsne::Options for details:\n"
+        "  --perplexity, --infer-perplexity, --prune-threshold, --theta, --early-theta,\n"
+        "  --max-iterations, --stop-lying-iter, --mom-switch-iter, --start-momentum,\n"
+        "  --final-momentum, --eta, --exaggeration-factor, --max-depth,\n"
+        "  --target-leaf-occupancy, --bucket-size, --kd-tree, --leaf-approximation,\n"
+        "  --negative-samples, --edge-samples, --seed, --low-memory,\n"
+        "  --numa-aware, --pin-threads, --num-threads\n";
+}
+
+static const std::unordered_set<std::string> known_flags {
+    "data", "ndim", "knn", "knn-indices", "knn-distances", "k", "output", "dims", "init-seed",
+    "perplexity", "infer-perplexity", "prune-threshold", "theta", "early-theta",
+    "max-iterations", "stop-lying-iter", "mom-switch-iter", "start-momentum",
+    "final-momentum", "eta", "exaggeration-factor", "max-depth",
+    "target-leaf-occupancy", "bucket-size", "kd-tree", "leaf-approximation",
+    "negative-samples", "edge-samples", "seed", "low-memory",
+    "numa-aware", "pin-threads", "num-threads"
+};
+
+static qdtsne::Options parse_options(const Arguments& args) {
+    qdtsne::Options opt;
+    args.get("perplexity", opt.perplexity);
+    args.get("infer-perplexity", opt.infer_perplexity);
+    args.get("prune-threshold", opt.prune_threshold);
+    args.get("theta", opt.theta);
+    args.get("early-theta", opt.early_theta);
+    args.get("max-iterations", opt.max_iterations);
+    args.get("stop-lying-iter", opt.stop_lying_iter);
+    args.get("mom-switch-iter", opt.mom_switch_iter);
+    args.get("start-momentum", opt.start_momentum);
+    args.get("final-momentum", opt.final_momentum);
+    args.get("eta", opt.eta);
+    args.get("exaggeration-factor", opt.exaggeration_factor);
+    args.get("max-depth", opt.max_depth);
+    args.get("target-leaf-occupancy", opt.target_leaf_occupancy);
+    args.get("bucket-size", opt.bucket_size);
+    args.get("kd-tree", opt.kd_tree);
+    args.get("leaf-approximation", opt.leaf_approximation);
+    args.get("negative-samples", opt.negative_samples);
+    args.get("edge-samples", opt.edge_samples);
+    args.get("seed", opt.seed);
+    args.get("low-memory", opt.low_memory);
+    args.get("numa-aware", opt.numa_aware);
+    args.get("pin-threads", opt.pin_threads);
+    args.get("num-threads", opt.num_threads);
+    return opt;
+}
+
+class Timer {
+public:
+    void report(const char* phase) {
+        auto now = std::chrono::steady_clock::now();
+        std::cerr << phase << "\t" << std::chrono::duration<double>(now - my_last).count() << "s" << std::endl;
+        my_last = now;
+    }
+
+private:
+    std::chrono::steady_clock::time_point my_last = std::chrono::steady_clock::now();
+};
+
+template<int num_dim_>
+void run(const Arguments& args, const qdtsne::Options& opt) {
+    Timer timer;
+
+    auto status = [&]() {
+        if (args.has("data")) {
+            int ndim = 0;
+            args.get("ndim", ndim);
+            if (ndim <= 0) {
+                throw std::runtime_error("'--ndim' should be positive for '--data'");
+            }
+
+            MappedFile data(args.get_string("data"));
+            size_t column_size = static_cast<size_t>(ndim) * sizeof(double);
+            if (data.size() % column_size) {
+                throw std::runtime_error("size of '--data' is not consistent with '--ndim'");
+            }
+            size_t nobs = data.size() / column_size;
+            if (nobs > static_cast<size_t>(std::numeric_limits<int>::max())) {
+                throw std::runtime_error("number of observations in '--data' does not fit in a 32-bit index");
+            }
+
+            auto index = knncolle::VptreeBuilder().build_unique(knncolle::SimpleMatrix<int, int, double>(ndim, nobs, data.data<double>()));
+            timer.report("index");
+
+            int K = qdtsne::perplexity_to_k(opt.perplexity);
+            if (static_cast<size_t>(K) >= nobs) {
+                throw std::runtime_error("number of observations should be greater than 3 * perplexity");
+            }
+            auto neighbors = knncolle::find_nearest_neighbors(*index, K, opt.num_threads);
+            timer.report("neighbors");
+
+            // Same as initializing from the index, which always uses the supplied perplexity.
+            auto copy = opt;
+            copy.infer_perplexity = false;
+            return qdtsne::initialize<num_dim_>(std::move(neighbors), copy);
+
+        } else if (args.has("knn")) {
+            auto nn = qdtsne::read_neighbors<int, double>(args.get_string("knn"));
+            timer.report("read");
+            return qdtsne::initialize<num_dim_>(nn.num_points, nn.num_neighbors, nn.indices.data(), nn.distances.data(), opt);
+
+        } else {
+            int K = 0;
+            args.get("k", K);
+            if (K <= 0) {
+                throw std::runtime_error("'--k' should be positive for precomputed neighbors");
+            }
+
+            MappedFile indices(args.get_string("knn-indices"));
+            MappedFile distances(args.get_string("knn-distances"));
+            size_t nobs = indices.size() / (static_cast<size_t>(K) * sizeof(int32_t));
+            if (indices.size() != nobs * K * sizeof(int32_t) || distances.size() != nobs * K * sizeof(double)) {
+                throw std::runtime_error("sizes of '--knn-indices' and '--knn-distances' are not consistent with '--k'");
+            }
+            if (nobs > static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+                throw std::runtime_error("number of observations in '--knn-indices' does not fit in a 32-bit index");
+            }
+
+            // Indices are range-checked by initialize() as it computes the probabilities.
+            return qdtsne::initialize<num_dim_>(nobs, K, indices.data<int32_t>(), distances.data<double>(), opt);
+        }
+    }();
+    timer.report("initialize");
+    std::cerr << "edges\t" << status.num_edges() << " (" << status.num_pruned_edges() << " pruned)" << std::endl;
+
+    int init_seed = 42;
+    args.get("init-seed", init_seed);
+    auto Y = qdtsne::initialize_random<num_dim_>(status.num_observations(), init_seed);
+    status.run(Y.data(), std::min(opt.stop_lying_iter, opt.max_iterations));
+    timer.report("exaggeration");
+    status.run(Y.data());
+    timer.report("iterations");
+
+    auto path = args.get_string("output");
+    std::ofstream output(path, std::ios::binary);
+    if (!output) {
+        throw std::runtime_error("failed to open '" + path + "' for writing");
+    }
+    output.write(reinterpret_cast<const char*>(Y.data()), Y.size() * sizeof(double));
+    if (!output) {
+        throw std::runtime_error("failed to write the embedding to '" + path + "'");
+    }
+    timer.report("write");
+}
+
+int main(int argc, char** argv) {
+    try {
+        Arguments args(argc, argv, known_flags);
+        if (args.has("help") || argc == 1) {
+            print_usage();
+            return args.has("help") ? 0 : 1;
+        }
+
+        auto opt = parse_options(args);
+        int dims = 2;
+        args.get("dims", dims);
+        switch (dims) {
+            case 1:
+                run<1>(args, opt);
+                break;
+            case 2:
+                run<2>(args, opt);
+                break;
+            case 3:
+                run<3>(args, opt);
+                break;
+            default:
+                throw std::runtime_error("'--dims' should be 1, 2 or 3");
+        }
+
+    } catch (std::exception& e) {
+        std::cerr << "qdtsne: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
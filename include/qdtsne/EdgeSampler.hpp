@@ -0,0 +1,153 @@
+#ifndef QDTSNE_EDGE_SAMPLER_HPP
+#define QDTSNE_EDGE_SAMPLER_HPP
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "utils.hpp"
+
+namespace qdtsne {
+
+namespace internal {
+
+/**
+ * This class estimates the attractive forces by sampling a fixed number of
+ * edges for each point in each iteration. Edges are sampled with replacement
+ * with probability proportional to their P-values, so scaling the sampled
+ * contributions (without their P-values) by the sum of the point's P-values
+ * divided by the number of samples gives an unbiased estimate of the force.
+ *
+ * Sampling uses an alias table for each point, built once at construction
+ * with Vose's method; each sample then costs two random draws regardless of
+ * the number of edges. Points with no more edges than the number of samples
+ * don't get a table as it is cheaper to compute their forces exactly.
+ *
+ * As in the NegativeSampler, each point's random stream is derived from the
+ * seed, the iteration and the point index, so the results do not depend on
+ * the number of threads or the order in which points are processed.
+ */
+template<typename Index_, typename Float_>
+class EdgeSampler {
+public:
+    EdgeSampler(const NeighborList<Index_, Float_>& neighbors, int nsamples, uint64_t seed, int num_threads) : my_nsamples(nsamples), my_seed(seed) {
+        if (my_nsamples <= 0) {
+            return;
+        }
+
+        size_t num_points = neighbors.size();
+        my_offsets.resize(num_points + 1);
+        for (size_t i = 0; i < num_points; ++i) {
+            size_t num_edges = neighbors[i].size();
+            my_offsets[i + 1] = my_offsets[i] + (num_edges > static_cast<size_t>(my_nsamples) ? num_edges : 0);
+        }
+
+        my_thresholds.resize(my_offsets.back());
+        my_aliases.resize(my_offsets.back());
+        my_scales.resize(num_points);
+
+        parallelize(num_threads, num_points, [&](int, size_t start, size_t length) -> void {
+            std::vector<Float_> scaled;
+            std::vector<size_t> small, large;
+
+            for (size_t i = start, end = start + length; i < end; ++i) {
+                size_t offset = my_offsets[i], num_edges = my_offsets[i + 1] - offset;
+                if (num_edges == 0) {
+                    continue;
+                }
+
+                const auto& current = neighbors[i];
+                Float_ total = 0;
+                for (const auto& x : current) {
+                    total += x.second;
+                }
+                my_scales[i] = total / static_cast<Float_>(my_nsamples);
+
+                // Scaling the probabilities so that they average to 1, then
+                // pairing each under-full slot with an over-full one.
+                scaled.resize(num_edges);
+                small.clear();
+                large.clear();
+                for (size_t j = 0; j < num_edges; ++j) {
+                    scaled[j] = current[j].second / total * static_cast<Float_>(num_edges);
+                    (scaled[j] < 1 ? small : large).push_back(j);
+                }
+
+                auto thresholds = my_thresholds.data() + offset;
+                auto aliases = my_aliases.data() + offset;
+                while (!small.empty() && !large.empty()) {
+                    size_t s = small.back(), l = large.back();
+                    small.pop_back();
+                    thresholds[s] = scaled[s];
+                    aliases[s] = l;
+                    scaled[l] -= (1 - scaled[s]);
+                    if (scaled[l] < 1) {
+                        large.pop_back();
+                        small.push_back(l);
+                    }
+                }
+
+                // Any leftovers are full, up to numerical error.
+                for (auto s : small) {
+                    thresholds[s] = 1;
+                    aliases[s] = s;
+                }
+                for (auto l : large) {
+                    thresholds[l] = 1;
+                    aliases[l] = l;
+                }
+            }
+        });
+    }
+
+private:
+    int my_nsamples;
+    uint64_t my_seed;
+
+    std::vector<size_t> my_offsets;
+    std::vector<Float_> my_thresholds;
+    std::vector<Index_> my_aliases;
+    std::vector<Float_> my_scales;
+
+public:
+    bool is_sampled(size_t index) const {
+        return !my_offsets.empty() && my_offsets[index + 1] > my_offsets[index];
+    }
+
+    // Weight to apply to each sampled edge's contribution, in place of its P-value.
+    Float_ scale(size_t index) const {
+        return my_scales[index];
+    }
+
+    // Calls 'fun' with the position of each sampled edge in the point's neighbor list.
+    template<class Function_>
+    void sample(size_t index, uint64_t iteration, Function_ fun) const {
+        uint64_t state = ~my_seed; // different from the NegativeSampler's stream for the same seed.
+        state = splitmix64(state) ^ iteration;
+        state = splitmix64(state) ^ static_cast<uint64_t>(index);
+
+        size_t offset = my_offsets[index];
+        uint64_t num_edges = my_offsets[index + 1] - offset;
+        auto thresholds = my_thresholds.data() + offset;
+        auto aliases = my_aliases.data() + offset;
+
+        for (int s = 0; s < my_nsamples; ++s) {
+            size_t slot = splitmix64(state) % num_edges;
+            double coin = static_cast<double>(splitmix64(state) >> 11) * 0x1.0p-53; // uniform in [0, 1).
+            fun(coin < thresholds[slot] ? slot : static_cast<size_t>(aliases[slot]));
+        }
+    }
+
+    size_t memory_usage() const {
+        return my_offsets.capacity() * sizeof(size_t) +
+            my_thresholds.capacity() * sizeof(Float_) +
+            my_aliases.capacity() * sizeof(Index_) +
+            my_scales.capacity() * sizeof(Float_);
+    }
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,402 @@
+#ifndef QDTSNE_KD_TREE_HPP
+#define QDTSNE_KD_TREE_HPP
+
+#include <cmath>
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <limits>
+
+#include "utils.hpp"
+
+namespace qdtsne {
+
+namespace internal {
+
+/**
+ * This class computes the repulsive forces with a Barnes-Hut approximation
+ * on a balanced kd-tree, as an alternative to the SPTree. Each node is split
+ * at the median along the dimension with the largest spread, so the depth of
+ * the tree is always logarithmic in the number of points. This avoids the
+ * deep and unbalanced quadtrees that arise when the embedding consists of a
+ * few very dense clusters separated by lots of empty space, e.g., after the
+ * early exaggeration phase.
+ *
+ * Each node records the tight bounding box of its points, and the width of
+ * the box's longest side is used in the Barnes-Hut criterion. Each node also
+ * covers a contiguous range of the reordered points, and each leaf holds up
+ * to 'bucket_size' points whose coordinates are stored contiguously. As in
+ * the bucketed SPTree, a leaf that contains the point or is too close for the
+ * approximation is handled by computing the exact interactions with each of
+ * its points. Nodes containing the point itself are never approximated.
+ *
+ * The force calculation methods have the same interface as the SPTree, so
+ * the two can be used interchangeably in Status.
+ */
+template<int num_dim_, typename Float_>
+class KdTree {
+public:
+    KdTree(size_t npts, int bucket_size) : my_npts(npts), my_bucket_size(std::max(bucket_size, 1)), my_locations(my_npts) {}
+
+public:
+    struct Node {
+        std::array<Float_, num_dim_> center_of_mass;
+        Float_ max_width = 0;
+
+        // Range of the reordered points covered by this node.
+        size_t start = 0;
+        size_t number = 0;
+
+        // Both children are present for non-leaf nodes. Zero refers to the
+        // root, which cannot be anyone's child, so it indicates a leaf node.
+        size_t left = 0, right = 0;
+
+        bool is_leaf() const {
+            return left == 0;
+        }
+    };
+
+    // Upper bound on the number of nodes, so that we can reserve the store
+    // in advance. A node is only split if it has more than 'bucket_size'
+    // points, so each child of a median split (and thus each leaf, except
+    // for a lone root) has at least ceil(bucket_size / 2) points. A full
+    // binary tree with L leaves has 2L - 1 nodes.
+    static size_t max_nodes(size_t npts, size_t bucket_size) {
+        size_t min_leaf_size = (std::max(bucket_size, static_cast<size_t>(1)) + 1) / 2;
+        size_t max_leaves = std::max(npts / min_leaf_size, static_cast<size_t>(1));
+        return max_leaves * 2 - 1;
+    }
+
+private:
+    const Float_ * my_data = NULL;
+    size_t my_npts;
+    size_t my_bucket_size;
+    std::vector<Node> my_store;
+
+    // Leaf node containing each point.
+    std::vector<size_t> my_locations;
+
+    // Indices and coordinates of the points, reordered so that each node's
+    // points are stored contiguously.
+    std::vector<size_t> my_order;
+    std::vector<Float_> my_coords;
+
+    /****************************
+     *** Construction methods ***
+     ****************************/
+public:
+    void set(const Float_* Y) {
+        my_data = Y;
+        my_locations.resize(my_npts);
+        my_order.resize(my_npts);
+        for (size_t i = 0; i < my_npts; ++i) {
+            my_order[i] = i;
+        }
+
+        my_store.clear();
+        my_store.reserve(max_nodes(my_npts, my_bucket_size));
+        my_store.emplace_back();
+        if (my_npts) {
+            build_node(0, 0, my_npts);
+        }
+
+        my_coords.resize(my_npts * static_cast<size_t>(num_dim_)); // cast to avoid overflow.
+        auto coords = my_coords.data();
+        for (size_t i = 0; i < my_npts; ++i, coords += num_dim_) {
+            std::copy_n(my_data + my_order[i] * static_cast<size_t>(num_dim_), num_dim_, coords); // cast to avoid overflow.
+        }
+    }
+
+private:
+    void build_node(size_t position, size_t start, size_t count) {
+        auto order = my_order.data() + start;
+
+        std::array<Float_, num_dim_> min_Y, max_Y, center{};
+        std::fill_n(min_Y.begin(), num_dim_, std::numeric_limits<Float_>::max());
+        std::fill_n(max_Y.begin(), num_dim_, std::numeric_limits<Float_>::lowest());
+        for (size_t i = 0; i < count; ++i) {
+            auto point = my_data + order[i] * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+            for (int d = 0; d < num_dim_; ++d) {
+                center[d] += point[d];
+                min_Y[d] = std::min(min_Y[d], point[d]);
+                max_Y[d] = std::max(max_Y[d], point[d]);
+            }
+        }
+
+        int split_dim = 0;
+        Float_ max_width = 0;
+        for (int d = 0; d < num_dim_; ++d) {
+            center[d] /= count;
+            Float_ width = max_Y[d] - min_Y[d];
+            if (width > max_width) {
+                max_width = width;
+                split_dim = d;
+            }
+        }
+
+        {
+            // Be careful with persistent references to my_store's contents,
+            // as the vector may be reallocated when a push_back() occurs.
+            auto& node = my_store[position];
+            node.center_of_mass = center;
+            node.max_width = max_width;
+            node.start = start;
+            node.number = count;
+        }
+
+        // Points are only kept together past the bucket size if they are all duplicates.
+        if (count <= my_bucket_size || max_width == 0) {
+            for (size_t i = 0; i < count; ++i) {
+                my_locations[order[i]] = position;
+            }
+            return;
+        }
+
+        size_t half = count / 2;
+        std::nth_element(order, order + half, order + count, [&](size_t left, size_t right) -> bool {
+            return my_data[left * static_cast<size_t>(num_dim_) + split_dim] < my_data[right * static_cast<size_t>(num_dim_) + split_dim]; // cast to avoid overflow.
+        });
+
+        size_t left = my_store.size();
+        my_store.emplace_back();
+        size_t right = my_store.size();
+        my_store.emplace_back();
+        my_store[position].left = left;
+        my_store[position].right = right;
+
+        build_node(left, start, half);
+        build_node(right, start + half, count - half);
+    }
+
+    /***********************************
+     *** Non-edge force calculations ***
+     ***********************************/
+private:
+    static Float_ compute_sqdist(const Float_* point, const std::array<Float_, num_dim_>& center) {
+        Float_ sqdist = 0;
+        for (int d = 0; d < num_dim_; ++d) {
+            Float_ delta = point[d] - center[d];
+            sqdist += delta * delta;
+        }
+        return sqdist;
+    }
+
+    static void add_non_edge_forces(const Float_* point, const std::array<Float_, num_dim_>& center, Float_ sqdist, size_t count, Float_& result_sum, Float_* neg_f) {
+        const Float_ div = static_cast<Float_>(1) / (static_cast<Float_>(1) + sqdist);
+        Float_ mult = count * div;
+        result_sum += mult;
+        mult *= div;
+        for (int d = 0; d < num_dim_; ++d) {
+            neg_f[d] += mult * (point[d] - center[d]);
+        }
+    }
+
+    // Exact interactions with each point in a leaf. The point itself is
+    // included if it is in the leaf, contributing a value of 1 to the sum and
+    // nothing to the force.
+    Float_ add_leaf_forces(const Float_* point, const Node& node, Float_* neg_f) const {
+        std::array<Float_, num_dim_> force{};
+        Float_ result_sum = 0;
+        auto coords = my_coords.data() + node.start * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+
+        for (size_t j = 0, end = node.number; j < end; ++j, coords += num_dim_) {
+            std::array<Float_, num_dim_> delta;
+            Float_ sqdist = 0;
+            for (int d = 0; d < num_dim_; ++d) {
+                delta[d] = point[d] - coords[d];
+                sqdist += delta[d] * delta[d];
+            }
+
+            const Float_ div = static_cast<Float_>(1) / (static_cast<Float_>(1) + sqdist);
+            result_sum += div;
+            const Float_ mult = div * div;
+            for (int d = 0; d < num_dim_; ++d) {
+                force[d] += mult * delta[d];
+            }
+        }
+
+        for (int d = 0; d < num_dim_; ++d) {
+            neg_f[d] += force[d];
+        }
+        return result_sum;
+    }
+
+    static bool contains(const Node& node, size_t offset) {
+        return node.start <= offset && offset < node.start + node.number;
+    }
+
+public:
+    Float_ compute_non_edge_forces(size_t index, Float_ theta, Float_* neg_f) const {
+        std::fill_n(neg_f, num_dim_, 0);
+        const Float_ * point = my_data + index * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+        size_t self_offset = my_store[my_locations[index]].start;
+        return compute_non_edge_forces(point, self_offset, theta, neg_f, 0);
+    }
+
+private:
+    QDTSNE_TARGET_CLONES
+    Float_ compute_non_edge_forces(const Float_* point, size_t self_offset, Float_ theta, Float_* neg_f, size_t position) const;
+
+    /*************************************************************
+     *** Non-edge force calculations, using leaf approximation ***
+     *************************************************************/
+public:
+    struct LeafApproxWorkspace {
+        std::vector<size_t> leaf_indices;
+        std::vector<std::array<Float_, num_dim_> > leaf_neg_f;
+        std::vector<Float_> leaf_sums;
+    };
+
+    void compute_non_edge_forces_for_leaves(Float_ theta, LeafApproxWorkspace& workspace, [[maybe_unused]] int num_threads) const {
+        size_t nnodes = my_store.size();
+        workspace.leaf_neg_f.resize(nnodes);
+        workspace.leaf_sums.resize(nnodes);
+
+        auto process_leaf_node = [&](size_t leaf) {
+            auto neg_f = workspace.leaf_neg_f[leaf].data();
+            std::fill_n(neg_f, num_dim_, 0);
+            workspace.leaf_sums[leaf] = compute_non_edge_forces_for_leaves(leaf, theta, neg_f, 0);
+        };
+
+        if (num_threads == 1) {
+            QDTSNE_TRACE_SCOPE("leaf pass");
+            for (size_t n = 0; n < nnodes; ++n) {
+                if (my_store[n].is_leaf()) {
+                    process_leaf_node(n);
+                }
+            }
+
+        } else {
+            // Identifying the leaf nodes so that the processing is balanced between threads.
+            workspace.leaf_indices.clear();
+            workspace.leaf_indices.reserve(nnodes);
+            for (size_t n = 0; n < nnodes; ++n) {
+                if (my_store[n].is_leaf()) {
+                    workspace.leaf_indices.push_back(n);
+                }
+            }
+
+            size_t nleaves = workspace.leaf_indices.size();
+            parallelize(num_threads, nleaves, [&](int, size_t start, size_t length) -> void {
+                QDTSNE_TRACE_SCOPE("leaf pass");
+                for (size_t n = start, end = start + length; n < end; ++n) {
+                    process_leaf_node(workspace.leaf_indices[n]);
+                }
+            });
+        }
+    }
+
+    Float_ compute_non_edge_forces_from_leaves(size_t index, Float_* neg_f, const LeafApproxWorkspace& workspace) const {
+        auto node_loc = my_locations[index];
+        Float_ result_sum = workspace.leaf_sums[node_loc];
+        const auto& leaf_neg_f = workspace.leaf_neg_f[node_loc];
+        std::copy(leaf_neg_f.begin(), leaf_neg_f.end(), neg_f);
+
+        // Using exact interactions within the leaf, minus the self-interaction.
+        const Float_ * point = my_data + index * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+        result_sum += add_leaf_forces(point, my_store[node_loc], neg_f) - static_cast<Float_>(1);
+        return result_sum;
+    }
+
+private:
+    QDTSNE_TARGET_CLONES
+    Float_ compute_non_edge_forces_for_leaves(size_t self_position, Float_ theta, Float_* neg_f, size_t position) const;
+
+public:
+    void release() {
+        my_data = NULL;
+        my_store.clear();
+        my_store.shrink_to_fit();
+        my_locations.clear();
+        my_locations.shrink_to_fit();
+        my_order.clear();
+        my_order.shrink_to_fit();
+        my_coords.clear();
+        my_coords.shrink_to_fit();
+    }
+
+    static void release(LeafApproxWorkspace& workspace) {
+        workspace.leaf_indices.clear();
+        workspace.leaf_indices.shrink_to_fit();
+        workspace.leaf_neg_f.clear();
+        workspace.leaf_neg_f.shrink_to_fit();
+        workspace.leaf_sums.clear();
+        workspace.leaf_sums.shrink_to_fit();
+    }
+
+    size_t memory_usage() const {
+        return my_store.capacity() * sizeof(Node) + (my_locations.capacity() + my_order.capacity()) * sizeof(size_t) + my_coords.capacity() * sizeof(Float_);
+    }
+
+    static size_t memory_usage(const LeafApproxWorkspace& workspace) {
+        return workspace.leaf_indices.capacity() * sizeof(size_t) +
+            workspace.leaf_neg_f.capacity() * sizeof(std::array<Float_, num_dim_>) +
+            workspace.leaf_sums.capacity() * sizeof(Float_);
+    }
+
+#ifndef NDEBUG
+    // For testing purposes only.
+    const auto& get_store() const {
+        return my_store;
+    }
+
+    const auto& get_locations() const {
+        return my_locations;
+    }
+#endif
+};
+
+// As in the SPTree, the recursive traversals are defined outside of the class
+// so that they are not implicitly inline; see QDTSNE_PRECOMPILED in Status.hpp.
+template<int num_dim_, typename Float_>
+Float_ KdTree<num_dim_, Float_>::compute_non_edge_forces(const Float_* point, size_t self_offset, Float_ theta, Float_* neg_f, size_t position) const {
+    const auto& node = my_store[position];
+    Float_ result_sum = 0;
+
+    if (!contains(node, self_offset)) {
+        Float_ sqdist = compute_sqdist(point, node.center_of_mass);
+        if (node.max_width < theta * std::sqrt(sqdist)) {
+            add_non_edge_forces(point, node.center_of_mass, sqdist, node.number, result_sum, neg_f);
+            return result_sum;
+        }
+        if (node.is_leaf()) {
+            return add_leaf_forces(point, node, neg_f);
+        }
+    } else if (node.is_leaf()) {
+        return add_leaf_forces(point, node, neg_f) - static_cast<Float_>(1);
+    }
+
+    result_sum += compute_non_edge_forces(point, self_offset, theta, neg_f, node.left);
+    result_sum += compute_non_edge_forces(point, self_offset, theta, neg_f, node.right);
+    return result_sum;
+}
+
+template<int num_dim_, typename Float_>
+Float_ KdTree<num_dim_, Float_>::compute_non_edge_forces_for_leaves(size_t self_position, Float_ theta, Float_* neg_f, size_t position) const {
+    if (position == self_position) {
+        return 0;
+    }
+
+    const auto& self_node = my_store[self_position];
+    auto point = self_node.center_of_mass.data();
+    const auto& node = my_store[position];
+    Float_ result_sum = 0;
+
+    if (!contains(node, self_node.start)) {
+        Float_ sqdist = compute_sqdist(point, node.center_of_mass);
+        if (node.is_leaf() || node.max_width < theta * std::sqrt(sqdist)) {
+            add_non_edge_forces(point, node.center_of_mass, sqdist, node.number, result_sum, neg_f);
+            return result_sum;
+        }
+    }
+
+    result_sum += compute_non_edge_forces_for_leaves(self_position, theta, neg_f, node.left);
+    result_sum += compute_non_edge_forces_for_leaves(self_position, theta, neg_f, node.right);
+    return result_sum;
+}
+
+}
+
+}
+
+#endif
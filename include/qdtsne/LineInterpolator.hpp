@@ -0,0 +1,349 @@
+#ifndef QDTSNE_LINE_INTERPOLATOR_HPP
+#define QDTSNE_LINE_INTERPOLATOR_HPP
+
+#include <cmath>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+#include <complex>
+#include <optional>
+
+#include "utils.hpp"
+#include "KdTree.hpp"
+
+namespace qdtsne {
+
+namespace internal {
+
+/**
+ * This class computes the repulsive forces for 1-dimensional embeddings.
+ * In one dimension, the Barnes-Hut tree is rather wasteful as the points are
+ * already ordered along a line. Instead, we use the polynomial interpolation
+ * scheme from FIt-SNE (Linderman et al., 2019), which replaces the kernel
+ * sums with a small number of interactions between equispaced nodes:
+ *
+ * 1. Divide the range of the embedding into equal-width intervals, each of
+ *    which contains 'num_per_interval' equispaced interpolation nodes.
+ * 2. For each point, compute its Lagrange interpolation weights for the nodes
+ *    of its interval. The "charge" of each node is the weighted sum over all
+ *    points in that interval.
+ * 3. Compute the kernel sums between all pairs of nodes. As the nodes are
+ *    equispaced, the kernel matrix is Toeplitz, so the sums are a convolution
+ *    that we compute with the FFT after embedding the kernel in a circulant
+ *    matrix of twice the size.
+ * 4. Interpolate the node potentials back to each point.
+ *
+ * The cost of each iteration is O(N + M log M) for M nodes, where M depends
+ * only on the range of the embedding. The interpolation error is controlled
+ * by the interval width, which we fix at (at most) half a unit of embedding
+ * distance. This gives relative errors below 1e-3 in our tests, which is
+ * already much smaller than the error from a Barnes-Hut approximation with
+ * typical values of theta, so there is no need for a tuning parameter.
+ * (FIt-SNE uses wider intervals with fewer nodes, at the cost of accuracy.)
+ *
+ * The number of intervals is capped at 'max_intervals' so that a single
+ * outlier cannot blow up the size of the FFT. The default cap covers
+ * embeddings spanning up to 10000 units, which is well beyond the typical
+ * range of a 1-dimensional t-SNE. Above the cap, wider intervals would
+ * degrade the accuracy without any bound, so we fall back to a Barnes-Hut
+ * approximation on a kd-tree instead. Its error is controlled by theta as in
+ * higher dimensions, and its median splits are not affected by the outliers
+ * that stretch the range in the first place. The tree is only allocated if
+ * the cap is ever reached.
+ * The FFT is a small radix-2 implementation in double precision, to keep the
+ * library free of an FFT dependency; double precision also ensures that the
+ * round-off from the transform does not swamp the potentials of nodes in
+ * sparsely populated regions of the embedding.
+ */
+template<typename Float_>
+class LineInterpolator {
+public:
+    static constexpr size_t min_intervals = 50;
+    static constexpr size_t default_max_intervals = 20000;
+
+    LineInterpolator(size_t npts, size_t max_intervals = default_max_intervals) : 
+        my_npts(npts), 
+        my_max_intervals(std::max(max_intervals, min_intervals)) 
+    {}
+
+private:
+    static constexpr int num_per_interval = 5;
+
+    const Float_* my_data = NULL;
+    size_t my_npts;
+    size_t my_max_intervals;
+
+    // Fallback for embeddings that need more than 'max_intervals'.
+    std::optional<KdTree<1, Float_> > my_fallback;
+    bool my_use_fallback = false;
+
+    Float_ my_min = 0, my_width = 1, my_center = 0;
+    size_t my_nintervals = 0;
+
+    std::vector<Float_> my_charge_count, my_charge_position;
+    std::vector<Float_> my_potential, my_potential_count, my_potential_position;
+
+    // The kernel is real and symmetric, so its transform is purely real.
+    size_t my_fft_size = 0;
+    std::vector<double> my_kernel_fft, my_kernel_squared_fft;
+    std::vector<std::complex<double> > my_twiddles, my_buffer_kernel, my_buffer_kernel_squared;
+
+private:
+    size_t find_weights(Float_ y, std::array<Float_, num_per_interval>& weights) const {
+        Float_ scaled = (y - my_min) / my_width;
+        size_t interval = std::min(static_cast<size_t>(scaled), my_nintervals - 1);
+
+        // Position relative to the first node of the interval, in units of the node spacing.
+        Float_ pos = (scaled - static_cast<Float_>(interval)) * num_per_interval - static_cast<Float_>(0.5);
+        for (int l = 0; l < num_per_interval; ++l) {
+            Float_ w = 1;
+            for (int m = 0; m < num_per_interval; ++m) {
+                if (m != l) {
+                    w *= (pos - m) / static_cast<Float_>(l - m);
+                }
+            }
+            weights[l] = w;
+        }
+
+        return interval;
+    }
+
+    void prepare_fft(size_t nnodes) {
+        size_t fft_size = 1;
+        while (fft_size < 2 * nnodes) {
+            fft_size *= 2;
+        }
+
+        if (fft_size != my_fft_size) {
+            my_fft_size = fft_size;
+            my_twiddles.resize(fft_size / 2);
+            const double base = -2 * 3.14159265358979323846 / static_cast<double>(fft_size);
+            for (size_t k = 0, end = my_twiddles.size(); k < end; ++k) {
+                double angle = base * static_cast<double>(k);
+                my_twiddles[k] = std::complex<double>(std::cos(angle), std::sin(angle));
+            }
+            my_buffer_kernel.resize(fft_size);
+            my_buffer_kernel_squared.resize(fft_size);
+            my_kernel_fft.resize(fft_size);
+            my_kernel_squared_fft.resize(fft_size);
+        }
+    }
+
+    // In-place iterative radix-2 transform. The inverse is not scaled by 1/size.
+    void fft(std::vector<std::complex<double> >& x, bool inverse) const {
+        const size_t n = x.size();
+        for (size_t i = 1, j = 0; i < n; ++i) {
+            size_t bit = n >> 1;
+            for (; j & bit; bit >>= 1) {
+                j ^= bit;
+            }
+            j ^= bit;
+            if (i < j) {
+                std::swap(x[i], x[j]);
+            }
+        }
+
+        for (size_t len = 2; len <= n; len <<= 1) {
+            const size_t half = len / 2, stride = n / len;
+            for (size_t i = 0; i < n; i += len) {
+                for (size_t k = 0; k < half; ++k) {
+                    auto w = my_twiddles[k * stride];
+                    if (inverse) {
+                        w = std::conj(w);
+                    }
+                    auto u = x[i + k];
+                    auto v = x[i + k + half] * w;
+                    x[i + k] = u + v;
+                    x[i + k + half] = u - v;
+                }
+            }
+        }
+    }
+
+    // Transform of the circulant embedding of a kernel of length 'nnodes'.
+    void transform_kernel(size_t nnodes, bool squared, std::vector<std::complex<double> >& buffer, std::vector<double>& output) const {
+        std::fill(buffer.begin(), buffer.end(), std::complex<double>(0, 0));
+        const double spacing = static_cast<double>(my_width) / num_per_interval;
+        for (size_t k = 0; k < nnodes; ++k) {
+            double delta = spacing * static_cast<double>(k);
+            double q = 1 / (1 + delta * delta);
+            if (squared) {
+                q *= q;
+            }
+            buffer[k] = q;
+            if (k) {
+                buffer[my_fft_size - k] = q;
+            }
+        }
+
+        fft(buffer, false);
+        for (size_t k = 0; k < my_fft_size; ++k) {
+            output[k] = buffer[k].real();
+        }
+    }
+
+public:
+    void set(const Float_* Y) {
+        my_data = Y;
+        if (my_npts == 0) {
+            return;
+        }
+
+        auto range = std::minmax_element(Y, Y + my_npts);
+        my_min = *(range.first);
+        Float_ span = *(range.second) - my_min + static_cast<Float_>(1e-5); // padding to protect against identical points.
+        my_center = my_min + span / static_cast<Float_>(2);
+
+        Float_ wanted = std::ceil(span * 2);
+        my_use_fallback = std::isfinite(wanted) && wanted > static_cast<Float_>(my_max_intervals);
+        if (my_use_fallback) {
+            if (!my_fallback.has_value()) {
+                my_fallback.emplace(my_npts, 1);
+            }
+            my_fallback->set(Y);
+            return;
+        }
+
+        // Non-finite spans can't be handled by the kd-tree either, as its median
+        // splits need well-ordered coordinates. We just cap the intervals in
+        // floating-point before the cast so that we stay within bounds.
+        if (!(wanted <= static_cast<Float_>(my_max_intervals))) {
+            my_nintervals = my_max_intervals;
+        } else {
+            my_nintervals = std::max(min_intervals, static_cast<size_t>(wanted));
+        }
+        my_width = span / static_cast<Float_>(my_nintervals);
+
+        size_t nnodes = my_nintervals * num_per_interval;
+        prepare_fft(nnodes);
+        transform_kernel(nnodes, false, my_buffer_kernel, my_kernel_fft);
+        transform_kernel(nnodes, true, my_buffer_kernel_squared, my_kernel_squared_fft);
+
+        my_charge_count.clear();
+        my_charge_count.resize(nnodes);
+        my_charge_position.clear();
+        my_charge_position.resize(nnodes);
+
+        std::array<Float_, num_per_interval> weights;
+        for (size_t i = 0; i < my_npts; ++i) {
+            Float_ y = Y[i];
+            size_t offset = find_weights(y, weights) * num_per_interval;
+
+            // Positions are centered to reduce cancellation when computing the forces.
+            Float_ centered = y - my_center;
+            for (int l = 0; l < num_per_interval; ++l) {
+                my_charge_count[offset + l] += weights[l];
+                my_charge_position[offset + l] += weights[l] * centered;
+            }
+        }
+    }
+
+    void compute_node_potentials(int num_threads) {
+        if (my_use_fallback) {
+            return;
+        }
+
+        size_t nnodes = my_charge_count.size();
+        my_potential.resize(nnodes);
+        my_potential_count.resize(nnodes);
+        my_potential_position.resize(nnodes);
+
+        // Two independent convolutions: the counts with the kernel, and the
+        // counts and positions with the squared kernel. As the transformed
+        // kernels are real, the latter can be packed into the real and
+        // imaginary parts of a single complex transform.
+        parallelize(std::min(num_threads, 2), 2, [&](int, int start, int length) -> void {
+            QDTSNE_TRACE_SCOPE("node potentials");
+            for (int task = start, end = start + length; task < end; ++task) {
+                bool squared = (task == 1);
+                auto& buffer = (squared ? my_buffer_kernel_squared : my_buffer_kernel);
+                const auto& kernel = (squared ? my_kernel_squared_fft : my_kernel_fft);
+
+                std::fill(buffer.begin() + nnodes, buffer.end(), std::complex<double>(0, 0));
+                for (size_t m = 0; m < nnodes; ++m) {
+                    buffer[m] = std::complex<double>(my_charge_count[m], squared ? my_charge_position[m] : 0);
+                }
+
+                fft(buffer, false);
+                for (size_t k = 0; k < my_fft_size; ++k) {
+                    buffer[k] *= kernel[k];
+                }
+                fft(buffer, true);
+
+                const double scale = 1 / static_cast<double>(my_fft_size);
+                if (squared) {
+                    for (size_t k = 0; k < nnodes; ++k) {
+                        my_potential_count[k] = buffer[k].real() * scale;
+                        my_potential_position[k] = buffer[k].imag() * scale;
+                    }
+                } else {
+                    for (size_t k = 0; k < nnodes; ++k) {
+                        my_potential[k] = buffer[k].real() * scale;
+                    }
+                }
+            }
+        });
+    }
+
+    Float_ compute_non_edge_forces(size_t index, Float_ theta, Float_* neg_f) const {
+        if (my_use_fallback) {
+            return my_fallback->compute_non_edge_forces(index, theta, neg_f);
+        }
+
+        Float_ y = my_data[index];
+        std::array<Float_, num_per_interval> weights;
+        size_t offset = find_weights(y, weights) * num_per_interval;
+
+        Float_ pot = 0, pot_count = 0, pot_pos = 0;
+        for (int l = 0; l < num_per_interval; ++l) {
+            pot += weights[l] * my_potential[offset + l];
+            pot_count += weights[l] * my_potential_count[offset + l];
+            pot_pos += weights[l] * my_potential_position[offset + l];
+        }
+
+        neg_f[0] = (y - my_center) * pot_count - pot_pos;
+        return pot - 1; // removing the contribution of the point to itself.
+    }
+
+    void release() {
+        my_data = NULL;
+        for (auto ptr : { &my_charge_count, &my_charge_position, &my_potential, &my_potential_count, &my_potential_position }) {
+            ptr->clear();
+            ptr->shrink_to_fit();
+        }
+        for (auto ptr : { &my_kernel_fft, &my_kernel_squared_fft }) {
+            ptr->clear();
+            ptr->shrink_to_fit();
+        }
+        for (auto ptr : { &my_twiddles, &my_buffer_kernel, &my_buffer_kernel_squared }) {
+            ptr->clear();
+            ptr->shrink_to_fit();
+        }
+        my_fft_size = 0;
+        my_fallback.reset();
+    }
+
+    size_t num_intervals() const {
+        return my_nintervals;
+    }
+
+    bool use_fallback() const {
+        return my_use_fallback;
+    }
+
+    size_t memory_usage() const {
+        size_t total = my_charge_count.capacity() + my_charge_position.capacity() +
+            my_potential.capacity() + my_potential_count.capacity() + my_potential_position.capacity();
+        return total * sizeof(Float_) +
+            (my_kernel_fft.capacity() + my_kernel_squared_fft.capacity()) * sizeof(double) +
+            (my_twiddles.capacity() + my_buffer_kernel.capacity() + my_buffer_kernel_squared.capacity()) * sizeof(std::complex<double>) +
+            (my_fallback.has_value() ? my_fallback->memory_usage() : 0);
+    }
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef QDTSNE_NEGATIVE_SAMPLER_HPP
+#define QDTSNE_NEGATIVE_SAMPLER_HPP
+
+#include <cstdint>
+#include <algorithm>
+
+#include "utils.hpp"
+
+namespace qdtsne {
+
+namespace internal {
+
+/**
+ * This class estimates the repulsive forces by sampling a fixed number of
+ * other points for each point in each iteration. Each sample is drawn
+ * uniformly from all other points, so scaling the sampled contributions by
+ * (N - 1) / num_samples gives an unbiased estimate of both the repulsive
+ * force and the point's contribution to the normalizing constant.
+ *
+ * We don't bother excluding the neighbors of each point from sampling; they
+ * still contribute to the repulsive forces in the exact gradient, and
+ * excluding them would bias the estimate.
+ *
+ * Each point's random stream is derived from the seed, the iteration and
+ * the point index, so the results do not depend on the number of threads or
+ * the order in which points are processed.
+ */
+template<int num_dim_, typename Float_>
+class NegativeSampler {
+public:
+    NegativeSampler(size_t npts, int nsamples, uint64_t seed) : my_npts(npts), my_nsamples(nsamples), my_seed(seed) {}
+
+private:
+    const Float_* my_data = NULL;
+    size_t my_npts;
+    int my_nsamples;
+    uint64_t my_seed;
+    uint64_t my_iteration = 0;
+
+public:
+    void set(const Float_* Y, int iteration) {
+        my_data = Y;
+        my_iteration = iteration;
+    }
+
+    Float_ compute_non_edge_forces(size_t index, Float_* neg_f) const {
+        std::fill_n(neg_f, num_dim_, 0);
+        if (my_npts < 2) {
+            return 0;
+        }
+
+        uint64_t state = my_seed;
+        state = splitmix64(state) ^ my_iteration;
+        state = splitmix64(state) ^ static_cast<uint64_t>(index);
+
+        const Float_* point = my_data + index * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+        const uint64_t num_others = my_npts - 1;
+        Float_ result_sum = 0;
+
+        for (int s = 0; s < my_nsamples; ++s) {
+            size_t chosen = splitmix64(state) % num_others;
+            chosen += (chosen >= index); // skipping self.
+
+            const Float_* other = my_data + chosen * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+            Float_ sqdist = 0;
+            for (int d = 0; d < num_dim_; ++d) {
+                Float_ delta = point[d] - other[d];
+                sqdist += delta * delta;
+            }
+
+            const Float_ div = static_cast<Float_>(1) / (static_cast<Float_>(1) + sqdist);
+            result_sum += div;
+            const Float_ mult = div * div;
+            for (int d = 0; d < num_dim_; ++d) {
+                neg_f[d] += mult * (point[d] - other[d]);
+            }
+        }
+
+        const Float_ scale = static_cast<Float_>(num_others) / static_cast<Float_>(my_nsamples);
+        for (int d = 0; d < num_dim_; ++d) {
+            neg_f[d] *= scale;
+        }
+        return result_sum * scale;
+    }
+};
+
+}
+
+}
+
+#endif
@@ -6,6 +6,8 @@
  * @brief Options for the t-SNE algorithm.
  */
 
+#include <cstdint>
+
 namespace qdtsne {
 
 /**
@@ -28,15 +30,43 @@ struct Options {
      */
     bool infer_perplexity = true;
 
+    /**
+     * Relative threshold for pruning each observation's neighbors after computing their probabilities, prior to symmetrization.
+     * For each observation, neighbors with probabilities below `prune_threshold` times the largest probability are removed,
+     * and the remaining probabilities are renormalized to sum to unity.
+     * This reduces the number of edges in the attractive force calculations (and their memory usage) at the cost of some approximation,
+     * as many of the more distant neighbors carry negligible probability at typical perplexities.
+     * The number of removed edges is reported by `Status::num_pruned_edges()`.
+     *
+     * This should be non-negative and less than 1, otherwise `initialize()` throws an error before doing any work.
+     * If zero, no pruning is performed.
+     */
+    double prune_threshold = 0;
+
     /**
      * Amount of approximation to use in the Barnes-Hut calculation of repulsive forces.
      * This is defined as the maximum \f$s/d\f$ at which a group of points can be approximated by their center of mass,
      * where \f$s\f$ is the maximum width of the box containing all points in the group (i.e., the longest side across all dimensions)
      * and \f$d\f$ is the distance from a point to the center of mass.
      * Lower values increase accuracy at the cost of computational time.
+     *
+     * For 1-dimensional embeddings, the repulsive forces are usually computed by interpolation along the line instead of a Barnes-Hut tree.
+     * This interpolation is also an approximation, not an exact calculation, though its relative error is typically below 1e-3.
+     * The number of interpolation intervals is capped to bound the cost of each iteration,
+     * so embeddings that span more than 10000 units (e.g., due to extreme outliers) fall back to a Barnes-Hut approximation on a kd-tree with this value of `theta`.
      */
     double theta = 1;
 
+    /**
+     * Amount of approximation to use in the Barnes-Hut calculation of repulsive forces during the early exaggeration phase, i.e., before `Options::stop_lying_iter`.
+     * The embedding is coarse during this phase and consists of tight, well-separated clusters, which tolerate a looser approximation than the later iterations.
+     * Larger values reduce the cost of the early iterations by stopping the tree traversal at shallower depths.
+     *
+     * If this is less than `Options::theta`, `Options::theta` is used for all iterations.
+     * For 1-dimensional embeddings, this is only used by the fallback described in `Options::theta`.
+     */
+    double early_theta = 0;
+
     /**
      * Maximum number of iterations to perform.
      */
@@ -90,16 +120,126 @@ struct Options {
      * The default is to use a large value, which means that the tree's depth is unbounded for most practical applications.
      * This aims to be consistent with the original implementation of the BH search,
      * but with some protection against near-duplicate points that would otherwise result in unnecessary recursion.
+     *
+     * This is ignored for 1-dimensional embeddings, see `Options::theta`.
      */
     int max_depth = 20;
 
+    /**
+     * Target number of points in each leaf node of the Barnes-Hut tree.
+     * If positive, the depth of the tree is chosen automatically whenever it is rebuilt (i.e., in each iteration), capped at `Options::max_depth`.
+     * Specifically, the depth is chosen so that the occupied leaf nodes contain `target_leaf_occupancy` points on average, based on the number of occupied cells at each depth of the previous iteration's tree.
+     * The first tree assumes that the points are uniformly distributed within their bounding box.
+     * This adapts the depth to the size and clustering of the embedding, which changes substantially during the optimization,
+     * and is most useful with `Options::leaf_approximation` where larger values reduce the number of leaf nodes at the cost of accuracy.
+     *
+     * If zero, the depth is always set to `Options::max_depth`.
+     * This is ignored for 1-dimensional embeddings, see `Options::theta`.
+     */
+    double target_leaf_occupancy = 0;
+
+    /**
+     * Maximum number of points in each leaf node of the Barnes-Hut tree.
+     * If greater than 1, a node is only split when it contains more than `bucket_size` points, so each leaf node holds a "bucket" of up to `bucket_size` points.
+     * The coordinates of each bucket's points are stored contiguously, and the repulsive forces from a leaf node that is too close for the Barnes-Hut approximation (or that contains the point itself) are computed exactly for each of its points.
+     * This reduces the number of nodes in the tree and the depth of the traversal, at the cost of more point-to-point calculations per leaf node.
+     * Values of 8 to 32 are usually reasonable.
+     *
+     * Leaf nodes can contain more than `bucket_size` points if they are at `Options::max_depth` or only contain duplicate points.
+     * This is ignored for 1-dimensional embeddings, see `Options::theta`.
+     */
+    int bucket_size = 1;
+
+    /**
+     * Whether to use a balanced kd-tree instead of a quadtree (or octree) for the Barnes-Hut force calculations.
+     * Each node of the kd-tree is split at the median along the dimension with the largest spread, so the depth of the tree is logarithmic in the number of points regardless of their distribution.
+     * This is faster than the quadtree for heavily clustered embeddings, where the quadtree's fixed midpoint splits create deep and unbalanced trees around the dense clusters.
+     * The Barnes-Hut criterion uses the longest side of the bounding box of each node's points, and nodes containing the point itself are never approximated.
+     *
+     * `Options::theta` and `Options::leaf_approximation` have the same meaning for the kd-tree, and each leaf node holds up to `Options::bucket_size` points.
+     * `Options::max_depth` and `Options::target_leaf_occupancy` are ignored as the depth is already balanced.
+     * This is ignored for 1-dimensional embeddings, see `Options::theta`.
+     */
+    bool kd_tree = false;
+
     /**
      * Whether to replace a point with the center of mass of its leaf node when computing the repulsive forces to all other points.
      * This allows the repulsive forces to be computed once per leaf node and then re-used across all points in that leaf node.
-     * The effectiveness of this option depends on `Options::max_depth`, which needs to be small enough so that many leaf nodes have multiple assigned points.
+     * The effectiveness of this option depends on `Options::max_depth`, which needs to be small enough so that many leaf nodes have multiple assigned points;
+     * alternatively, `Options::target_leaf_occupancy` can be used to choose the depth automatically.
+     *
+     * This is ignored for 1-dimensional embeddings, see `Options::theta`.
      */
     bool leaf_approximation = false;
 
+    /**
+     * Number of other points to sample for each point in each iteration, when estimating the repulsive forces by negative sampling.
+     * If positive, the repulsive forces and the normalizing constant are estimated from this many points that are randomly sampled from the entire dataset,
+     * instead of being computed with the Barnes-Hut tree.
+     * This reduces the cost of each iteration to be linear in the number of points, at the cost of introducing some noise into each update.
+     * Larger values reduce the noise at the cost of computational time.
+     *
+     * If zero, the Barnes-Hut tree is used instead.
+     * When positive, `Options::theta`, `Options::max_depth`, `Options::target_leaf_occupancy`, `Options::bucket_size`, `Options::kd_tree` and `Options::leaf_approximation` are ignored.
+     */
+    int negative_samples = 0;
+
+    /**
+     * Number of edges to sample for each point in each iteration, when estimating the attractive forces by edge sampling.
+     * If positive, the attractive force for each point with more than `edge_samples` neighbors (after symmetrization) is estimated from this many of its edges.
+     * Edges are sampled with replacement with probability proportional to their probabilities and reweighted to give an unbiased estimate of the exact force.
+     * This makes the cost of the attractive forces independent of the perplexity, at the cost of introducing some noise into each update.
+     * Points with no more than `edge_samples` neighbors use all of their edges.
+     *
+     * If zero, all edges are used for all points.
+     */
+    int edge_samples = 0;
+
+    /**
+     * Seed for the random number generator used by stochastic approximations, e.g., `Options::negative_samples` and `Options::edge_samples`.
+     * The random stream for each point is derived from this seed, the iteration number and the point's index, so results are reproducible regardless of `Options::num_threads`.
+     */
+    uint64_t seed = 42;
+
+    /**
+     * Number of iterations between publishing copies of the embedding in `run()`, see `Status::published()`.
+     * The final state of the embedding is also published at the end of each `run()` call.
+     * This allows other threads to read a consistent copy of the embedding while the optimization is in progress.
+     * If zero, no copies are published.
+     */
+    int publish_interval = 0;
+
+    /**
+     * Whether to reduce the memory usage of the `Status` object, e.g., for very large datasets.
+     * If true, the gains for each point are stored in single precision, and all workspaces (including the Barnes-Hut tree) are released at the end of each `run()` call.
+     * Storing the gains in single precision has no effect if `Float_` is `float`, and otherwise yields slightly different results from the default.
+     * The workspaces need to be reallocated at the start of each `run()` call, which is only costly if `run()` is called repeatedly for small numbers of iterations.
+     */
+    bool low_memory = false;
+
+    /**
+     * Whether to optimize the placement of the per-observation buffers for machines with multiple NUMA nodes, e.g., multi-socket servers.
+     * If true, each part of a buffer is first written by the worker thread that processes the corresponding observations in each iteration,
+     * so that operating systems with a first-touch policy (e.g., Linux) allocate it on the memory node of that worker.
+     * The edge forces, gradients and updates are also parallelized with the same partitioning of observations as the repulsive forces, so each worker mostly accesses local memory.
+     * This has no effect if `Options::num_threads` is 1 and does not change the results.
+     */
+    bool numa_aware = false;
+
+    /**
+     * Whether to pin each worker thread to a single CPU during the parallel sections of `Status::run()`.
+     * Worker `w` is pinned to the `w`-th CPU on which its thread was originally allowed to run (wrapping around if there are more workers than CPUs).
+     * Each worker thread stays pinned after the section, so a persistent thread pool only needs to be pinned once;
+     * the exception is the thread that called `Status::run()`, whose original affinity is restored at the end of each section.
+     * This ensures that the same observations are always processed on the same CPU, which is most useful with `Options::numa_aware = true`.
+     * Pinning is cheapest when the same threads are used for every section, e.g., with OpenMP or a persistent pool in `QDTSNE_CUSTOM_PARALLEL`.
+     * If fresh threads are created for each section (e.g., the default **subpar** backend without OpenMP),
+     * every new thread needs its own system calls to be pinned at the start of each section.
+     * The CPUs can be restricted with, e.g., `taskset` or `numactl` to control which sockets are used.
+     * Only supported on Linux and ignored on other platforms.
+     */
+    bool pin_threads = false;
+
     /**
      * Number of threads to use.
      * The parallelization scheme is determined by `parallelize()` for most calculations.
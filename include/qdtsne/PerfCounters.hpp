@@ -0,0 +1,137 @@
+#ifndef QDTSNE_PERF_COUNTERS_HPP
+#define QDTSNE_PERF_COUNTERS_HPP
+
+#include <array>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(QDTSNE_PERF_COUNTERS) && defined(__linux__)
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace qdtsne {
+
+namespace internal {
+
+/**
+ * This class holds a group of hardware performance counters for the calling
+ * thread, opened with perf_event_open on Linux. Each thread gets its own
+ * group on first use (see 'perf_counters()'), so counts are attributed to
+ * whichever worker did the work. The counters are left running and we take
+ * differences between reads, which avoids any system calls other than read().
+ *
+ * If the counters cannot be opened, e.g., because of the
+ * perf_event_paranoid setting or because we're not on Linux, available()
+ * returns false and the caller should not report any counts. Individual
+ * reads can also fail, in which case read() returns false and the caller
+ * should not report counts for the affected interval.
+ *
+ * As the counters are bound to the thread that opened them, the groups are
+ * only reused across parallel sections if the parallelization backend reuses
+ * its threads, e.g., OpenMP or a thread pool via QDTSNE_CUSTOM_PARALLEL. With
+ * subpar's fallback of spawning new threads for each parallel section, every
+ * section pays for opening and closing a group per worker (a few system
+ * calls each). This cost is excluded from the counts and from the workers'
+ * own events, as each group is opened before the first timestamp is taken,
+ * but it does appear in the duration of the enclosing phase.
+ */
+class PerfCounters {
+public:
+    static constexpr int num_counters = 3;
+
+    static constexpr std::array<const char*, num_counters> names() {
+        return { "instructions", "cache_misses", "branch_misses" };
+    }
+
+    typedef std::array<uint64_t, num_counters> Values;
+
+#if defined(QDTSNE_PERF_COUNTERS) && defined(__linux__)
+public:
+    PerfCounters() {
+        constexpr std::array<uint64_t, num_counters> configs{ PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+        for (int c = 0; c < num_counters; ++c) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[c];
+            attr.disabled = (c == 0); // only the group leader starts disabled.
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+
+            int fd = syscall(SYS_perf_event_open, &attr, 0, -1, (c == 0 ? -1 : my_fds[0]), 0);
+            if (fd < 0) {
+                close_all();
+                return;
+            }
+            my_fds[c] = fd;
+        }
+
+        ioctl(my_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(my_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    ~PerfCounters() {
+        close_all();
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const {
+        return my_fds[0] >= 0;
+    }
+
+    bool read(Values& output) const {
+        if (!available()) {
+            return false;
+        }
+
+        // Layout for PERF_FORMAT_GROUP: the number of counters, followed by each value.
+        std::array<uint64_t, num_counters + 1> buffer{};
+        if (::read(my_fds[0], buffer.data(), sizeof(buffer)) != static_cast<ssize_t>(sizeof(buffer)) || buffer[0] != num_counters) {
+            return false;
+        }
+        std::copy(buffer.begin() + 1, buffer.end(), output.begin());
+        return true;
+    }
+
+private:
+    std::array<int, num_counters> my_fds{ -1, -1, -1 };
+
+    void close_all() {
+        for (auto& fd : my_fds) {
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+
+#else
+public:
+    bool available() const {
+        return false;
+    }
+
+    bool read(Values&) const {
+        return false;
+    }
+#endif
+};
+
+inline const PerfCounters& perf_counters() {
+    static thread_local PerfCounters counters;
+    return counters;
+}
+
+}
+
+}
+
+#endif
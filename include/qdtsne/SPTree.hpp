@@ -37,6 +37,7 @@
 #include <array>
 #include <algorithm>
 #include <vector>
+#include <limits>
 
 #include "utils.hpp"
 
@@ -47,11 +48,32 @@ namespace internal {
 template<int num_dim_, typename Float_>
 class SPTree {
 public:
-    SPTree(size_t npts, int maxdepth) : my_npts(npts), my_maxdepth(maxdepth), my_locations(my_npts) {
-        my_store.reserve(std::min(static_cast<Float_>(my_npts), std::pow(static_cast<Float_>(4.0), static_cast<Float_>(my_maxdepth))) * 2);
+    SPTree(size_t npts, int maxdepth, double leaf_occupancy = 0, int bucket_size = 1) : 
+        my_npts(npts), 
+        my_maxdepth(maxdepth), 
+        my_depth(maxdepth), 
+        my_leaf_occupancy(leaf_occupancy), 
+        my_bucket_size(std::max(bucket_size, 1)),
+        my_locations(my_npts)
+    {
+        if (my_maxdepth < 1) {
+            my_leaf_occupancy = 0;
+        } else if (my_leaf_occupancy > 0) {
+            // Initial guess, assuming that the points are uniformly distributed within the bounding box.
+            double target = std::max(static_cast<double>(my_npts) / my_leaf_occupancy, 1.0);
+            my_depth = clamp_depth(std::lround(std::log2(target) / num_dim_));
+        }
+        reserve();
         return;
     }
 
+private:
+    void reserve() {
+        // Computing the bound in double precision, as Float_ may not be able to exactly represent 'my_npts'.
+        double max_leaves = std::min(std::ceil(static_cast<double>(my_npts) / my_bucket_size), std::pow(4.0, static_cast<double>(my_maxdepth)));
+        my_store.reserve(static_cast<size_t>(max_leaves) * 2);
+    }
+
 public:
     struct Node {
         Node(size_t i, const Float_* point) : index(i) {
@@ -79,6 +101,8 @@ public:
         // This should only be used when is_leaf = true. In cases where multiple
         // points are assigned to the same leaf node (e.g., duplicates, max depth
         // truncation), it is the index of the first point for this Node.
+        // For bucketed trees, it is instead the position of the leaf's first
+        // point in the contiguous bucket storage, see build_buckets().
         size_t index = -1; 
 
         bool is_leaf = true;
@@ -95,6 +119,9 @@ private:
     const Float_ * my_data = NULL;
     size_t my_npts;
     int my_maxdepth;
+    int my_depth;
+    double my_leaf_occupancy;
+    int my_bucket_size;
     std::vector<Node> my_store;
 
     // We need to store the on-tree locations for each point separately as each
@@ -104,12 +131,48 @@ private:
 
     std::vector<size_t> my_first_assignment;
 
+    // For bucketed trees, the points (and their coordinates) are reordered so
+    // that each leaf's points are stored contiguously.
+    std::vector<size_t> my_bucket_points;
+    std::vector<Float_> my_bucket_coords;
+
+    // Number of nodes created at each depth, and the number of those that
+    // were subsequently split into non-leaf nodes. These are used to choose
+    // the depth from the previous tree, see choose_depth(), so they are only
+    // filled (and sized according to the current depth) if the depth is
+    // chosen automatically.
+    std::vector<size_t> my_created, my_split;
+    bool my_has_counts = false;
+
+    // Cap on the automatically chosen depth, regardless of my_maxdepth.
+    // Beyond this, the cells are narrower than the spacing between
+    // representable coordinates (relative to the root's width), so there is
+    // nothing to gain from going deeper; this also protects against runaway
+    // extrapolation in choose_depth() for near-duplicate points.
+    static constexpr int max_auto_depth = std::numeric_limits<Float_>::digits;
+
     /****************************
      *** Construction methods ***
      ****************************/
 public:
     void set(const Float_* Y) {
         my_data = Y;
+        if (my_store.capacity() == 0) {
+            reserve(); // in case it was previously released.
+        }
+        my_locations.resize(my_npts);
+
+        if (my_leaf_occupancy > 0) {
+            if (my_has_counts) {
+                choose_depth();
+            }
+            my_created.clear();
+            my_created.resize(my_depth + 2);
+            my_split.clear();
+            my_split.resize(my_depth + 2);
+            my_created[0] = 1;
+            my_split[0] = 1;
+        }
 
         {
             my_store.clear();
@@ -146,13 +209,25 @@ public:
             }
         }
 
-        auto point = Y;
+        if (my_bucket_size > 1) {
+            build_buckets();
+        } else {
+            insert_points();
+        }
+
+        my_has_counts = true;
+        return;
+    }
+
+private:
+    void insert_points() {
+        auto point = my_data;
         my_first_assignment.resize(my_npts);
         for (size_t i = 0; i < my_npts; ++i, point += num_dim_) {
             std::array<bool, num_dim_> side;
             size_t parent = 0;
 
-            for (int depth = 1; depth <= my_maxdepth; ++depth) {
+            for (int depth = 1; depth <= my_depth; ++depth) {
                 size_t child_idx = find_child(parent, point, side.data());
 
                 // Be careful with persistent references to my_store's contents,
@@ -166,6 +241,7 @@ public:
                     my_store[parent].children[child_idx] = current_loc;
                     my_store.emplace_back(i, point);
                     my_first_assignment[i] = i;
+                    count_created(depth);
                     break;
                 } 
 
@@ -183,7 +259,7 @@ public:
                         break;
                     }
 
-                    if (depth == my_maxdepth) {
+                    if (depth == my_depth) {
                         my_first_assignment[i] = my_store[current_loc].index;
                     } else {
                         // Otherwise, we convert the current node into a non-leaf node to
@@ -201,6 +277,8 @@ public:
 
                         size_t new_child_idx = find_child(current_loc, my_store[new_loc].center_of_mass.data(), side.data());
                         my_store[current_loc].children[new_child_idx] = new_loc;
+                        count_split(depth);
+                        count_created(depth + 1);
                     }
                 }
 
@@ -233,9 +311,170 @@ public:
         for (size_t i = 0; i < my_npts; ++i) {
             auto tmp = my_locations[my_first_assignment[i]]; // break it up to avoid unsequencing errors when assigning to self.
             my_locations[i] = tmp;
-        } 
+        }
+    }
 
-        return;
+    // For bucketed trees, we build the tree from the top down. Each node's
+    // points occupy a contiguous range of my_bucket_points, which is
+    // partitioned among its children with a counting sort. A node becomes a
+    // leaf if it has no more than my_bucket_size points, if it is at the
+    // maximum depth, or if all of its points are duplicates.
+    void build_buckets() {
+        my_bucket_points.resize(my_npts);
+        for (size_t i = 0; i < my_npts; ++i) {
+            my_bucket_points[i] = i;
+        }
+        my_bucket_coords.resize(my_npts * static_cast<size_t>(num_dim_)); // cast to avoid overflow.
+        my_first_assignment.resize(my_npts); // re-used as scratch space for the partitioning.
+        build_bucket_node(0, 0, my_npts, 0);
+    }
+
+    void build_bucket_node(size_t position, size_t start, size_t count, int depth) {
+        auto points = my_bucket_points.data() + start;
+
+        {
+            auto& node = my_store[position];
+            node.number = count;
+            std::fill_n(node.center_of_mass.begin(), num_dim_, 0);
+            for (size_t i = 0; i < count; ++i) {
+                auto point = my_data + points[i] * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+                for (int d = 0; d < num_dim_; ++d) {
+                    node.center_of_mass[d] += point[d];
+                }
+            }
+            for (int d = 0; d < num_dim_; ++d) {
+                node.center_of_mass[d] /= count;
+            }
+        }
+
+        // The root is always split, as the traversals start from its children.
+        bool is_leaf = (depth > 0 && (count <= static_cast<size_t>(my_bucket_size) || depth >= my_depth));
+        if (!is_leaf && depth > 0) {
+            auto first = my_data + points[0] * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+            is_leaf = true;
+            for (size_t i = 1; i < count && is_leaf; ++i) {
+                auto point = my_data + points[i] * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+                is_leaf = std::equal(first, first + num_dim_, point);
+            }
+        }
+
+        if (is_leaf) {
+            auto& node = my_store[position];
+            node.is_leaf = true;
+            node.index = start;
+            auto coords = my_bucket_coords.data() + start * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+            for (size_t i = 0; i < count; ++i, coords += num_dim_) {
+                my_locations[points[i]] = position;
+                std::copy_n(my_data + points[i] * static_cast<size_t>(num_dim_), num_dim_, coords); // cast to avoid overflow.
+            }
+            return;
+        }
+
+        my_store[position].is_leaf = false;
+        if (depth > 0) {
+            count_split(depth);
+        }
+
+        std::array<size_t, Node::nchildren + 1> offsets{};
+        std::array<bool, num_dim_> side;
+        for (size_t i = 0; i < count; ++i) {
+            auto point = my_data + points[i] * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+            ++offsets[find_child(position, point, side.data()) + 1];
+        }
+        for (int c = 0; c < Node::nchildren; ++c) {
+            offsets[c + 1] += offsets[c];
+        }
+
+        auto scratch = my_first_assignment.data() + start;
+        auto fill = offsets;
+        for (size_t i = 0; i < count; ++i) {
+            auto point = my_data + points[i] * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+            scratch[fill[find_child(position, point, side.data())]++] = points[i];
+        }
+        std::copy_n(scratch, count, points);
+
+        for (int c = 0; c < Node::nchildren; ++c) {
+            size_t child_count = offsets[c + 1] - offsets[c];
+            if (child_count == 0) {
+                continue;
+            }
+
+            // Be careful with persistent references to my_store's contents,
+            // as the vector may be reallocated when a push_back() occurs.
+            size_t child = my_store.size();
+            my_store.emplace_back();
+            my_store[position].children[c] = child;
+            count_created(depth + 1);
+
+            for (int d = 0; d < num_dim_; ++d) {
+                side[d] = (c >> d) & 1;
+            }
+            set_child_boundaries(position, child, side.data());
+            build_bucket_node(child, start + offsets[c], child_count, depth + 1);
+        }
+    }
+
+private:
+    void count_created(int depth) {
+        if (my_leaf_occupancy > 0) {
+            ++my_created[depth];
+        }
+    }
+
+    void count_split(int depth) {
+        if (my_leaf_occupancy > 0) {
+            ++my_split[depth];
+        }
+    }
+
+    int clamp_depth(long depth) const {
+        return std::max(1L, std::min(depth, static_cast<long>(std::min(my_maxdepth, max_auto_depth))));
+    }
+
+    // We choose the depth from the previous tree, assuming that the embedding
+    // does not change much between consecutive calls to set(). The number of
+    // occupied cells at each depth up to the previous depth is known exactly
+    // from the node counts, as each occupied cell at a given depth corresponds
+    // to a node at that depth or a leaf node at a shallower depth. We pick the
+    // depth where the average number of points per occupied cell is closest
+    // to the target occupancy. If the previous tree was not deep enough, we
+    // extrapolate from the growth in occupied cells at its deepest level.
+    void choose_depth() {
+        const double npts = my_npts;
+        const double log_target = std::log(my_leaf_occupancy);
+        int best_depth = 1;
+        double best_error = std::numeric_limits<double>::infinity();
+        double last_occupied = 1, occupied = 1;
+        size_t shallow_leaves = 0;
+
+        for (int depth = 1; depth <= my_depth; ++depth) {
+            shallow_leaves += my_created[depth - 1] - my_split[depth - 1];
+            last_occupied = occupied;
+            occupied = my_created[depth] + shallow_leaves;
+            double error = std::abs(std::log(npts / occupied) - log_target);
+            if (error < best_error) {
+                best_error = error;
+                best_depth = depth;
+            }
+        }
+
+        // The occupancy cannot increase with depth, so if the deepest level
+        // is still too crowded, the shallower levels are even worse.
+        if (npts / occupied > my_leaf_occupancy) {
+            // Each level can increase the number of occupied cells by up to
+            // 2^num_dim_; we set a lower bound on the growth to ensure that
+            // we go deeper even if the last level was saturated.
+            double growth = std::max(std::min(occupied / last_occupied, static_cast<double>(1 << num_dim_)), 2.0);
+            long extra = std::lround(std::log(npts / (occupied * my_leaf_occupancy)) / std::log(growth));
+            best_depth = clamp_depth(my_depth + std::max(extra, 1L));
+        }
+
+        my_depth = best_depth;
+    }
+
+public:
+    int depth() const {
+        return my_depth;
     }
 
 private:
@@ -293,6 +532,37 @@ private:
         }
     }
 
+    // Exact interactions with each point in a bucketed leaf, which are stored
+    // contiguously so that this loop is cache- and SIMD-friendly. The point
+    // itself is included if it is in the bucket, contributing a value of 1 to
+    // the sum and nothing to the force.
+    Float_ add_bucket_forces(const Float_* point, const Node& node, Float_* neg_f) const {
+        std::array<Float_, num_dim_> force{};
+        Float_ result_sum = 0;
+        auto coords = my_bucket_coords.data() + node.index * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+
+        for (size_t j = 0, end = node.number; j < end; ++j, coords += num_dim_) {
+            std::array<Float_, num_dim_> delta;
+            Float_ sqdist = 0;
+            for (int d = 0; d < num_dim_; ++d) {
+                delta[d] = point[d] - coords[d];
+                sqdist += delta[d] * delta[d];
+            }
+
+            const Float_ div = static_cast<Float_>(1) / (static_cast<Float_>(1) + sqdist);
+            result_sum += div;
+            const Float_ mult = div * div;
+            for (int d = 0; d < num_dim_; ++d) {
+                force[d] += mult * delta[d];
+            }
+        }
+
+        for (int d = 0; d < num_dim_; ++d) {
+            neg_f[d] += force[d];
+        }
+        return result_sum;
+    }
+
     static void remove_self_from_center(const Float_* point, const std::array<Float_, num_dim_>& center, Float_ count, std::array<Float_, num_dim_>& temp) {
         for (int d = 0; d < num_dim_; ++d) { 
             temp[d] = (center[d] * count - point[d]) / (count - 1);
@@ -316,45 +586,8 @@ public:
     }
 
 private:
-    Float_ compute_non_edge_forces(size_t index, const Float_* point, Float_ theta, Float_* neg_f, size_t position) const {
-        const auto& node = my_store[position];
-
-        std::array<Float_, num_dim_> temp;
-        auto center = &(node.center_of_mass);
-        size_t count = node.number;
-
-        // Check if we're at the leaf node containing the 'index' point. We
-        // skip it if the leaf only contains that point, otherwise we remove
-        // the point from the center of mass for repulsive calculations.
-        if (position == my_locations[index]) {
-            if (count == 1) {
-                return 0; 
-            }
-            remove_self_from_center(point, *center, count, temp);
-            center = &temp;
-            --count;
-        }
-
-        Float_ sqdist = compute_sqdist(point, *center);
-
-        // Check whether we can use skip this node's children, either because
-        // it's already a leaf or because we can use the BH approximation.
-        bool skip_children = node.is_leaf || (node.max_width < theta * std::sqrt(sqdist));
-
-        Float_ result_sum = 0;
-        if (skip_children) {
-            add_non_edge_forces(point, *center, sqdist, count, result_sum, neg_f);
-        } else {
-            const auto& cur_children = node.children;
-            for (int i = 0; i < Node::nchildren; ++i) {
-                if (cur_children[i]) {
-                    result_sum += compute_non_edge_forces(index, point, theta, neg_f, cur_children[i]);
-                }
-            }
-        }
-
-        return result_sum;
-    }
+    QDTSNE_TARGET_CLONES
+    Float_ compute_non_edge_forces(size_t index, const Float_* point, Float_ theta, Float_* neg_f, size_t position) const;
 
     /*************************************************************
      *** Non-edge force calculations, using leaf approximation ***
@@ -387,6 +620,7 @@ public:
         };
 
         if (num_threads == 1) {
+            QDTSNE_TRACE_SCOPE("leaf pass");
             for (size_t n = 0; n < nnodes; ++n) {
                 if (my_store[n].is_leaf) {
                     process_leaf_node(n);
@@ -407,6 +641,7 @@ public:
 
             size_t nleaves = workspace.leaf_indices.size();
             parallelize(num_threads, nleaves, [&](int, size_t start, size_t length) -> void {
+                QDTSNE_TRACE_SCOPE("leaf pass");
                 for (size_t n = start, end = start + length; n < end; ++n) {
                     process_leaf_node(workspace.leaf_indices[n]);
                 }
@@ -421,7 +656,11 @@ public:
         std::copy(leaf_neg_f.begin(), leaf_neg_f.end(), neg_f);
 
         const auto& node = my_store[node_loc];
-        if (node.number != 1) {
+        if (my_bucket_size > 1) {
+            // Using exact interactions within the leaf, minus the self-interaction.
+            const Float_ * point = my_data + index * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+            result_sum += add_bucket_forces(point, node, neg_f) - static_cast<Float_>(1);
+        } else if (node.number != 1) {
             const Float_ * point = my_data + index * static_cast<size_t>(num_dim_); // cast to avoid overflow.
             std::array<Float_, num_dim_> temp;
             remove_self_from_center(point, node.center_of_mass, node.number, temp);
@@ -433,32 +672,45 @@ public:
     }
 
 private:
-    Float_ compute_non_edge_forces_for_leaves(size_t self_position, Float_ theta, Float_* neg_f, size_t position) const {
-        const auto& self_node = my_store[self_position];
-        auto point = self_node.center_of_mass.data();
+    QDTSNE_TARGET_CLONES
+    Float_ compute_non_edge_forces_for_leaves(size_t self_position, Float_ theta, Float_* neg_f, size_t position) const;
 
-        const auto& node = my_store[position];
-        Float_ sqdist = compute_sqdist(point, node.center_of_mass);
 
-        bool skip_children = node.is_leaf || (node.max_width < theta * std::sqrt(sqdist));
+public:
+    void release() {
+        my_data = NULL;
+        my_store.clear();
+        my_store.shrink_to_fit();
+        my_locations.clear();
+        my_locations.shrink_to_fit();
+        my_first_assignment.clear();
+        my_first_assignment.shrink_to_fit();
+        my_bucket_points.clear();
+        my_bucket_points.shrink_to_fit();
+        my_bucket_coords.clear();
+        my_bucket_coords.shrink_to_fit();
+    }
 
-        Float_ result_sum = 0;
-        if (skip_children) {
-            add_non_edge_forces(point, node.center_of_mass, sqdist, node.number, result_sum, neg_f);
-        } else {
-            const auto& cur_children = node.children;
-            for (int i = 0; i < Node::nchildren; ++i) {
-                if (cur_children[i] && cur_children[i] != self_position) {
-                    result_sum += compute_non_edge_forces_for_leaves(self_position, theta, neg_f, cur_children[i]);
-                }
-            }
-        }
+    static void release(LeafApproxWorkspace& workspace) {
+        workspace.leaf_indices.clear();
+        workspace.leaf_indices.shrink_to_fit();
+        workspace.leaf_neg_f.clear();
+        workspace.leaf_neg_f.shrink_to_fit();
+        workspace.leaf_sums.clear();
+        workspace.leaf_sums.shrink_to_fit();
+    }
 
-        return result_sum;
+    size_t memory_usage() const {
+        return my_store.capacity() * sizeof(Node) + (my_locations.capacity() + my_first_assignment.capacity() + my_bucket_points.capacity()) * sizeof(size_t) + 
+            my_bucket_coords.capacity() * sizeof(Float_);
     }
 
+    static size_t memory_usage(const LeafApproxWorkspace& workspace) {
+        return workspace.leaf_indices.capacity() * sizeof(size_t) +
+            workspace.leaf_neg_f.capacity() * sizeof(std::array<Float_, num_dim_>) +
+            workspace.leaf_sums.capacity() * sizeof(Float_);
+    }
 
-public:
 #ifndef NDEBUG
     // For testing purposes only.
     const auto& get_store() const {
@@ -471,6 +723,86 @@ public:
 #endif
 };
 
+// The recursive traversals are defined outside of the class so that they are
+// not implicitly inline. This ensures that they are not instantiated by users
+// of the precompiled library, which instead use the (multiversioned) copies
+// in the library itself; see QDTSNE_PRECOMPILED in Status.hpp.
+template<int num_dim_, typename Float_>
+Float_ SPTree<num_dim_, Float_>::compute_non_edge_forces(size_t index, const Float_* point, Float_ theta, Float_* neg_f, size_t position) const {
+    const auto& node = my_store[position];
+
+    // For bucketed leaves, we compute exact interactions with each point if
+    // the leaf contains the 'index' point or is too close for the BH
+    // approximation. The self-interaction is removed from the exact sum.
+    if (my_bucket_size > 1 && node.is_leaf) {
+        bool is_self = (position == my_locations[index]);
+        if (is_self || !(node.max_width < theta * std::sqrt(compute_sqdist(point, node.center_of_mass)))) {
+            return add_bucket_forces(point, node, neg_f) - static_cast<Float_>(is_self);
+        }
+    }
+
+    std::array<Float_, num_dim_> temp;
+    auto center = &(node.center_of_mass);
+    size_t count = node.number;
+
+    // Check if we're at the leaf node containing the 'index' point. We
+    // skip it if the leaf only contains that point, otherwise we remove
+    // the point from the center of mass for repulsive calculations.
+    if (position == my_locations[index]) {
+        if (count == 1) {
+            return 0; 
+        }
+        remove_self_from_center(point, *center, count, temp);
+        center = &temp;
+        --count;
+    }
+
+    Float_ sqdist = compute_sqdist(point, *center);
+
+    // Check whether we can use skip this node's children, either because
+    // it's already a leaf or because we can use the BH approximation.
+    bool skip_children = node.is_leaf || (node.max_width < theta * std::sqrt(sqdist));
+
+    Float_ result_sum = 0;
+    if (skip_children) {
+        add_non_edge_forces(point, *center, sqdist, count, result_sum, neg_f);
+    } else {
+        const auto& cur_children = node.children;
+        for (int i = 0; i < Node::nchildren; ++i) {
+            if (cur_children[i]) {
+                result_sum += compute_non_edge_forces(index, point, theta, neg_f, cur_children[i]);
+            }
+        }
+    }
+
+    return result_sum;
+}
+
+template<int num_dim_, typename Float_>
+Float_ SPTree<num_dim_, Float_>::compute_non_edge_forces_for_leaves(size_t self_position, Float_ theta, Float_* neg_f, size_t position) const {
+    const auto& self_node = my_store[self_position];
+    auto point = self_node.center_of_mass.data();
+
+    const auto& node = my_store[position];
+    Float_ sqdist = compute_sqdist(point, node.center_of_mass);
+
+    bool skip_children = node.is_leaf || (node.max_width < theta * std::sqrt(sqdist));
+
+    Float_ result_sum = 0;
+    if (skip_children) {
+        add_non_edge_forces(point, node.center_of_mass, sqdist, node.number, result_sum, neg_f);
+    } else {
+        const auto& cur_children = node.children;
+        for (int i = 0; i < Node::nchildren; ++i) {
+            if (cur_children[i] && cur_children[i] != self_position) {
+                result_sum += compute_non_edge_forces_for_leaves(self_position, theta, neg_f, cur_children[i]);
+            }
+        }
+    }
+
+    return result_sum;
+}
+
 }
 
 }
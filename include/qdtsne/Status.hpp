@@ -38,10 +38,23 @@
 #include <algorithm>
 #include <type_traits>
 #include <limits>
+#include <memory>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
 
 #include "SPTree.hpp"
+#include "KdTree.hpp"
+#include "LineInterpolator.hpp"
+#include "NegativeSampler.hpp"
+#include "EdgeSampler.hpp"
 #include "Options.hpp"
+#include "allocator.hpp"
+#include "memory.hpp"
+#include "recorder.hpp"
+#include "symmetrize.hpp"
 #include "utils.hpp"
+#include "trace.hpp"
 
 /**
  * @file Status.hpp
@@ -56,28 +69,34 @@ namespace qdtsne {
  * @tparam num_dim_ Number of dimensions in the t-SNE embedding.
  * @tparam Index_ Integer type for the neighbor indices.
  * @tparam Float_ Floating-point type for the distances.
+ * @tparam Allocator_ Allocator for the per-observation buffers, e.g., `HugePageAllocator`.
+ * This should have a `value_type` of `Float_` and support rebinding to `float`.
  *
  * This class holds the precomputed structures required to perform the t-SNE iterations.
  * Instances should not be constructed directly but instead created by `initialize()`.
  */
-template<int num_dim_, typename Index_, typename Float_> 
+template<int num_dim_, typename Index_, typename Float_, class Allocator_ = std::allocator<Float_> > 
 class Status {
 public:
     /**
      * @cond
      */
-    Status(NeighborList<Index_, Float_> neighbors, Options options) :
+    Status(NeighborList<Index_, Float_> neighbors, Options options, size_t num_pruned = 0) :
         my_neighbors(std::move(neighbors)),
-        my_dY(my_neighbors.size() * num_dim_), 
-        my_uY(my_neighbors.size() * num_dim_), 
-        my_gains(my_neighbors.size() * num_dim_, 1.0), 
-        my_pos_f(my_neighbors.size() * num_dim_), 
-        my_neg_f(my_neighbors.size() * num_dim_), 
-        my_tree(my_neighbors.size(), options.max_depth),
+        my_num_pruned(num_pruned),
+        my_edge_sampler(my_neighbors, options.edge_samples, options.seed, options.num_threads),
+        my_tree(create_tree(my_neighbors.size(), options)),
+        my_kd_tree(use_kd_tree(options) ? my_neighbors.size() : 0, options.bucket_size),
+        my_sampler(my_neighbors.size(), options.negative_samples, options.seed),
         my_options(std::move(options))
     {
-        if (options.num_threads > 1) {
-            my_parallel_buffer.resize(my_neighbors.size());
+        size_t ntotal = my_neighbors.size() * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+        allocate(my_uY, ntotal, 0);
+        if (my_options.low_memory) {
+            allocate(my_compact_gains, ntotal, 1);
+        } else {
+            allocate(my_gains, ntotal, 1);
+            allocate_workspace();
         }
     }
     /**
@@ -86,15 +105,62 @@ public:
 
 private:
     NeighborList<Index_, Float_> my_neighbors; 
-    std::vector<Float_> my_dY, my_uY, my_gains, my_pos_f, my_neg_f;
+    size_t my_num_pruned;
+    internal::EdgeSampler<Index_, Float_> my_edge_sampler;
 
-    internal::SPTree<num_dim_, Float_> my_tree;
-    std::vector<Float_> my_parallel_buffer; // Buffer to hold parallel-computed results prior to reduction.
+    typedef std::vector<Float_, internal::UninitializedAllocator<Allocator_> > Buffer;
+    typedef std::vector<float, internal::UninitializedAllocator<typename std::allocator_traits<Allocator_>::template rebind_alloc<float> > > CompactBuffer;
+    Buffer my_uY, my_gains, my_pos_f, my_neg_f;
+    CompactBuffer my_compact_gains; // used instead of 'my_gains' in low-memory mode.
+
+    // 1-dimensional embeddings don't need a tree, we can just interpolate along the line.
+    typename std::conditional<num_dim_ == 1, internal::LineInterpolator<Float_>, internal::SPTree<num_dim_, Float_> >::type my_tree;
+    internal::KdTree<num_dim_, Float_> my_kd_tree;
+    internal::NegativeSampler<num_dim_, Float_> my_sampler;
+    Buffer my_parallel_buffer; // Buffer to hold parallel-computed results prior to reduction.
+
+public:
+    /**
+     * @brief Published copy of the embedding.
+     */
+    struct Published {
+        /**
+         * Number of iterations that were performed when this copy was published.
+         */
+        int iteration;
+
+        /**
+         * Coordinates of the embedding, in the same format as `Y` in `run()`.
+         */
+        std::vector<Float_> coordinates;
+    };
+
+private:
+    internal::AtomicSharedPtr<const Published> my_published;
+    std::shared_ptr<Published> my_current_published, my_retired_published; // non-const handles for recycling, see publish().
 
     Options my_options;
     int my_iter = 0;
 
-    typename decltype(my_tree)::LeafApproxWorkspace my_leaf_workspace;
+    std::shared_ptr<Recorder<Float_> > my_recorder;
+    int my_record_interval = 0;
+
+    typename internal::SPTree<num_dim_, Float_>::LeafApproxWorkspace my_leaf_workspace;
+    typename internal::KdTree<num_dim_, Float_>::LeafApproxWorkspace my_kd_workspace;
+
+    static bool use_kd_tree(const Options& options) {
+        return num_dim_ > 1 && options.kd_tree && options.negative_samples == 0;
+    }
+
+    static auto create_tree(size_t num_points, const Options& options) {
+        if constexpr(num_dim_ == 1) {
+            return internal::LineInterpolator<Float_>(num_points);
+        } else {
+            // No need to allocate anything if the kd-tree or negative sampling is used instead.
+            bool used = options.negative_samples == 0 && !use_kd_tree(options);
+            return internal::SPTree<num_dim_, Float_>(used ? num_points : 0, options.max_depth, options.target_leaf_occupancy, options.bucket_size);
+        }
+    }
 
 public:
     /**
@@ -119,6 +185,84 @@ public:
         return my_neighbors.size();
     }
 
+    /**
+     * @return The number of edges used in the attractive force calculations.
+     * Each pair of neighboring observations is counted twice, once for each observation, after symmetrization.
+     */
+    size_t num_edges() const {
+        return internal::count_edges(my_neighbors);
+    }
+
+    /**
+     * @return The number of neighbors that were removed by pruning prior to symmetrization, see `Options::prune_threshold`.
+     * Each removed neighbor may or may not reduce `num_edges()`, depending on whether the same pair is retained in the other observation's list.
+     */
+    size_t num_pruned_edges() const {
+        return my_num_pruned;
+    }
+
+    /**
+     * This method can be safely called from other threads while `run()` is in progress,
+     * e.g., to visualize the current state of the embedding without stopping the optimization.
+     * The returned copy will not be modified by later iterations and remains valid for as long as the caller holds the pointer.
+     *
+     * @return The most recently published copy of the embedding, see `Options::publish_interval`.
+     * This is a null pointer if no copy has been published yet.
+     */
+    std::shared_ptr<const Published> published() const {
+        return my_published.load();
+    }
+
+    /**
+     * This can be compared to the output of `estimate_memory()`, e.g., to check the memory consumption of a job between calls to `run()`.
+     * Copies of the embedding from `published()` are included if they are still referenced by this object.
+     *
+     * Unlike `published()`, this method must not be called while `run()` is in progress in another thread,
+     * as it inspects buffers that are resized by `run()` without any synchronization.
+     *
+     * @return Current memory usage of this object, based on the capacities of its internal buffers.
+     */
+    MemoryUsage memory_usage() const {
+        MemoryUsage output;
+
+        output.neighbors = my_neighbors.capacity() * sizeof(typename NeighborList<Index_, Float_>::value_type);
+        for (const auto& current : my_neighbors) {
+            output.neighbors += current.capacity() * sizeof(typename NeighborList<Index_, Float_>::value_type::value_type);
+        }
+        output.neighbors += my_edge_sampler.memory_usage();
+
+        output.buffers = (my_uY.capacity() + my_gains.capacity() + my_pos_f.capacity() + my_neg_f.capacity()) * sizeof(Float_) + my_compact_gains.capacity() * sizeof(float);
+        output.tree = my_tree.memory_usage() + my_kd_tree.memory_usage();
+
+        output.workspace = my_parallel_buffer.capacity() * sizeof(Float_);
+        output.workspace += internal::SPTree<num_dim_, Float_>::memory_usage(my_leaf_workspace);
+        output.workspace += internal::KdTree<num_dim_, Float_>::memory_usage(my_kd_workspace);
+        for (const auto& current : { my_published.load(), std::shared_ptr<const Published>(my_retired_published) }) {
+            if (current) {
+                output.workspace += current->coordinates.capacity() * sizeof(Float_);
+            }
+        }
+
+        return output;
+    }
+
+    /**
+     * Attach a recorder to save snapshots of the embedding during `run()`, e.g., for quality control or animations.
+     * This is more efficient than calling `run()` in small increments and copying the coordinates after each call.
+     *
+     * @param recorder Recorder to be called every `interval` iterations, typically a `TrajectoryRecorder`.
+     * This may be a null pointer to remove an existing recorder.
+     * @param interval Number of iterations between snapshots.
+     * Snapshots are recorded whenever `iteration()` is a multiple of `interval`.
+     */
+    void set_recorder(std::shared_ptr<Recorder<Float_> > recorder, int interval) {
+        if (recorder && interval <= 0) {
+            throw std::runtime_error("recording interval should be positive");
+        }
+        my_recorder = std::move(recorder);
+        my_record_interval = interval;
+    }
+
 #ifndef NDEBUG
     /**
      * @cond
@@ -126,6 +270,11 @@ public:
     const auto& get_neighbors() const {
         return my_neighbors;
     }
+
+    template<typename Task_, class Run_>
+    void test_parallelize_pinned(Task_ num_tasks, Run_ run_task_range) const {
+        parallelize_pinned(num_tasks, std::move(run_task_range));
+    }
     /**
      * @endcond
      */
@@ -144,10 +293,35 @@ public:
      * `limit` may be greater than `max_iterations()`, to run the algorithm for more iterations than specified during construction of this `Status` object.
      */
     void run(Float_* Y, int limit) {
+        run(Y, limit, [](int) -> bool { return true; });
+    }
+
+    /**
+     * Run the algorithm to the specified number of iterations, invoking a callback after each iteration.
+     * This can be used to monitor progress or to cancel the run from another part of the application, e.g., in an asynchronous job server.
+     * A cancelled run can be resumed by calling `run()` again with the same `Y`.
+     *
+     * @tparam Callback_ Function that accepts an `int` and returns a `bool`.
+     *
+     * @param[in, out] Y Pointer to a array containing a column-major matrix with number of rows and columns equal to `num_dim_` and `num_observations()`, respectively.
+     * This should be the same as described for the other `run()` overloads.
+     * @param limit Number of iterations to run up to, see the other `run()` overloads.
+     * @param callback Function to be called after each iteration.
+     * This is passed the number of iterations performed so far, i.e., the current value of `iteration()`.
+     * It should return `true` to continue the run or `false` to stop immediately.
+     * On return, `Y` contains the embedding at the current iteration.
+     *
+     * @return Whether `limit` was reached.
+     * This is `false` if the run was cancelled by `callback`.
+     */
+    template<class Callback_>
+    bool run(Float_* Y, int limit, Callback_ callback) {
         Float_ multiplier = (my_iter < my_options.stop_lying_iter ? my_options.exaggeration_factor : 1);
         Float_ momentum = (my_iter < my_options.mom_switch_iter ? my_options.start_momentum : my_options.final_momentum);
+        bool completed = true;
+        allocate_workspace();
 
-        for(; my_iter < limit; ++my_iter) {
+        while (my_iter < limit) {
             // Stop lying about the P-values after a while, and switch momentum
             if (my_iter == my_options.stop_lying_iter) {
                 multiplier = 1;
@@ -157,7 +331,32 @@ public:
             }
 
             iterate(Y, multiplier, momentum);
+            ++my_iter;
+
+            if (my_options.publish_interval > 0 && my_iter % my_options.publish_interval == 0) {
+                publish(Y, my_iter);
+            }
+            if (my_recorder && my_iter % my_record_interval == 0) {
+                my_recorder->record(my_iter, Y, my_uY.size());
+            }
+
+            if (!callback(my_iter)) {
+                completed = false;
+                break;
+            }
+        }
+
+        if (my_options.publish_interval > 0) {
+            if (!my_current_published || my_current_published->iteration != my_iter) {
+                publish(Y, my_iter);
+            }
         }
+
+        if (my_options.low_memory) {
+            release_workspace();
+        }
+
+        return completed;
     }
 
     /**
@@ -174,6 +373,99 @@ public:
     }
 
 private:
+    void allocate_workspace() {
+        size_t ntotal = my_uY.size();
+        allocate(my_pos_f, ntotal, 0);
+        allocate(my_neg_f, ntotal, 0);
+        if (my_options.num_threads > 1) {
+            allocate(my_parallel_buffer, num_observations(), 0);
+        }
+    }
+
+    // The buffers are allocated without initialization and then filled here,
+    // so in the NUMA-aware mode, each page is first touched by the worker
+    // that processes the corresponding observations in each iteration.
+    template<class Vector_>
+    void allocate(Vector_& x, size_t n, typename Vector_::value_type value) {
+        if (x.size() == n) {
+            return;
+        }
+        x.resize(n);
+
+        size_t N = num_observations();
+        if (use_numa() && N) {
+            size_t stride = n / N;
+            parallelize_pinned(N, [&](int, size_t start, size_t length) -> void {
+                std::fill_n(x.data() + start * stride, length * stride, value);
+            });
+        } else {
+            std::fill(x.begin(), x.end(), value);
+        }
+    }
+
+    bool use_numa() const {
+        return my_options.numa_aware && my_options.num_threads > 1;
+    }
+
+    template<typename Task_, class Run_>
+    void parallelize_pinned(Task_ num_tasks, Run_ run_task_range) const {
+        if (my_options.pin_threads) {
+            // Worker threads stay pinned between sections, but the thread
+            // that called run() might also be used as a worker (e.g., by
+            // OpenMP) and should get its original affinity back.
+            auto caller = std::this_thread::get_id();
+            parallelize(my_options.num_threads, num_tasks, [&](int w, Task_ start, Task_ length) -> void {
+                internal::pin_thread(w);
+                internal::CallerUnpinGuard guard(caller);
+                run_task_range(w, start, length);
+            });
+        } else {
+            parallelize(my_options.num_threads, num_tasks, std::move(run_task_range));
+        }
+    }
+
+    // Everything that doesn't need to persist between iterations, i.e., all
+    // but the neighbors, the momentum-based updates and the gains.
+    template<typename Vector_>
+    static void release(Vector_& x) {
+        x.clear();
+        x.shrink_to_fit();
+    }
+
+    void release_workspace() {
+        release(my_pos_f);
+        release(my_neg_f);
+        release(my_parallel_buffer);
+        my_retired_published.reset();
+        my_tree.release();
+        internal::SPTree<num_dim_, Float_>::release(my_leaf_workspace);
+        my_kd_tree.release();
+        internal::KdTree<num_dim_, Float_>::release(my_kd_workspace);
+    }
+
+    void publish(const Float_* Y, int iteration) {
+        // We double-buffer the published copies, reusing the copy from the
+        // previous publication if no reader still holds it. Otherwise, we
+        // allocate a new one, so a copy is never modified once it is visible.
+        // use_count() is only a relaxed load, so the fence is needed to order
+        // the readers' accesses (which happen-before their release decrements
+        // of the reference count) before our writes into the recycled copy.
+        std::shared_ptr<Published> target;
+        if (my_retired_published && my_retired_published.use_count() == 1) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            target = std::move(my_retired_published);
+        } else {
+            my_retired_published.reset();
+            target = std::make_shared<Published>();
+        }
+
+        target->iteration = iteration;
+        target->coordinates.assign(Y, Y + my_uY.size());
+        my_published.store(target);
+        my_retired_published = std::move(my_current_published);
+        my_current_published = std::move(target);
+    }
+
     static Float_ sign(Float_ x) { 
         constexpr Float_ zero = 0;
         constexpr Float_ one = 1;
@@ -181,25 +473,54 @@ private:
     }
 
     void iterate(Float_* Y, Float_ multiplier, Float_ momentum) {
+        QDTSNE_TRACE_SCOPE("iteration");
         compute_gradient(Y, multiplier);
 
+        // Phases are traced inside each worker so that the performance
+        // counters are attributed to the threads doing the work.
+        if (use_numa()) {
+            parallelize_pinned(num_observations(), [&](int, size_t start, size_t length) -> void {
+                QDTSNE_TRACE_SCOPE("update");
+                update(Y, my_pos_f.data() + start * static_cast<size_t>(num_dim_), momentum, start, length); // cast to avoid overflow.
+            });
+        } else {
+            QDTSNE_TRACE_SCOPE("update");
+            update(Y, my_pos_f.data(), momentum, 0, num_observations());
+        }
+        center(Y);
+    }
+
+    void update(Float_* Y, const Float_* dY, Float_ momentum, size_t start, size_t length) {
+        if (my_options.low_memory) {
+            update(Y, dY, my_compact_gains.data(), momentum, start, length);
+        } else {
+            update(Y, dY, my_gains.data(), momentum, start, length);
+        }
+    }
+
+    template<typename Gain_>
+    QDTSNE_TARGET_CLONES
+    void update(Float_* Y, const Float_* dY, Gain_* gains, Float_ momentum, size_t start, size_t length) {
+        size_t first = start * static_cast<size_t>(num_dim_), last = (start + length) * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+
         // Update gains
-        size_t ngains = my_gains.size(); 
-        for (size_t i = 0; i < ngains; ++i) {
-            Float_& g = my_gains[i];
+        for (size_t i = first; i < last; ++i) {
+            Float_ g = gains[i];
             constexpr Float_ lower_bound = 0.01;
             constexpr Float_ to_add = 0.2;
             constexpr Float_ to_mult = 0.8;
-            g = std::max(lower_bound, sign(my_dY[i]) != sign(my_uY[i]) ? (g + to_add) : (g * to_mult));
+            gains[i] = std::max(lower_bound, sign(dY[i - first]) != sign(my_uY[i]) ? (g + to_add) : (g * to_mult));
         }
 
         // Perform gradient update (with momentum and gains)
-        for (size_t i = 0; i < ngains; ++i) {
-            my_uY[i] = momentum * my_uY[i] - my_options.eta * my_gains[i] * my_dY[i];
+        for (size_t i = first; i < last; ++i) {
+            my_uY[i] = momentum * my_uY[i] - my_options.eta * static_cast<Float_>(gains[i]) * dY[i - first];
             Y[i] += my_uY[i];
         }
+    }
 
-        // Make solution zero-mean
+    // Make solution zero-mean.
+    void center(Float_* Y) {
         size_t N = num_observations();
         for (int d = 0; d < num_dim_; ++d) {
             auto start = Y + d;
@@ -216,93 +537,234 @@ private:
                 *start -= sum;
             }
         }
-
-        return;
     }
 
 private:
     void compute_gradient(const Float_* Y, Float_ multiplier) {
-        my_tree.set(Y);
-        compute_edge_forces(Y, multiplier);
-
         size_t N = num_observations();
-        std::fill(my_neg_f.begin(), my_neg_f.end(), 0);
+        if (use_numa() && N) {
+            // Same as below, but using the same partitioning of observations
+            // as compute_non_edge_forces() so that each worker only writes to
+            // the pages that it first touched. The worker with the first range
+            // builds the tree before starting on its edge forces.
+            parallelize_pinned(N, [&](int, size_t start, size_t length) -> void {
+                if (start == 0) {
+                    set_repulsion(Y);
+                }
+                compute_edge_forces(Y, multiplier, start, length);
+            });
+
+        } else if (my_options.num_threads > 1) {
+            // Tree construction is serial but only reads 'Y', as do the edge
+            // force calculations. So, we build the tree in the first worker
+            // while the remaining workers split up the edge forces; both are
+            // joined by the time parallelize() returns.
+            int num_edge_workers = my_options.num_threads - 1;
+            size_t per_worker = N / num_edge_workers + (N % num_edge_workers > 0);
+            parallelize_pinned(my_options.num_threads, [&](int, int start, int length) -> void {
+                for (int t = start, end = start + length; t < end; ++t) {
+                    if (t == 0) {
+                        set_repulsion(Y);
+                    } else {
+                        size_t first = per_worker * static_cast<size_t>(t - 1);
+                        if (first < N) {
+                            compute_edge_forces(Y, multiplier, first, std::min(per_worker, N - first));
+                        }
+                    }
+                }
+            });
+
+        } else {
+            set_repulsion(Y);
+            compute_edge_forces(Y, multiplier, 0, N);
+        }
 
         Float_ sum_Q = compute_non_edge_forces();
 
-        // Compute final t-SNE gradient
-        size_t ntotal = N * static_cast<size_t>(num_dim_);
-        for (size_t i = 0; i < ntotal; ++i) {
-            my_dY[i] = my_pos_f[i] - (my_neg_f[i] / sum_Q);
+        // Compute final t-SNE gradient, overwriting the attractive forces as
+        // they are no longer needed; this avoids a separate gradient buffer.
+        auto finalize = [&](size_t start, size_t length) -> void {
+            size_t first = start * static_cast<size_t>(num_dim_), last = (start + length) * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+            for (size_t i = first; i < last; ++i) {
+                my_pos_f[i] -= my_neg_f[i] / sum_Q;
+            }
+        };
+
+        if (use_numa()) {
+            parallelize_pinned(N, [&](int, size_t start, size_t length) -> void {
+                finalize(start, length);
+            });
+        } else {
+            finalize(0, N);
         }
     }
 
-    void compute_edge_forces(const Float_* Y, Float_ multiplier) {
-        std::fill(my_pos_f.begin(), my_pos_f.end(), 0);
-        size_t N = num_observations();
+    void set_repulsion(const Float_* Y) {
+        QDTSNE_TRACE_SCOPE("tree build");
+        if (my_options.negative_samples > 0) {
+            my_sampler.set(Y, my_iter);
+        } else if (use_kd_tree(my_options)) {
+            my_kd_tree.set(Y);
+        } else {
+            my_tree.set(Y);
+        }
+    }
 
-        parallelize(my_options.num_threads, N, [&](int, size_t start, size_t length) -> void {
-            for (size_t n = start, end = start + length; n < end; ++n) {
-                const auto& current = my_neighbors[n];
-                size_t offset = n * static_cast<size_t>(num_dim_); // cast to avoid overflow.
-                const Float_* self = Y + offset;
-                Float_* pos_out = my_pos_f.data() + offset;
-
-                for (const auto& x : current) {
-                    Float_ sqdist = 0; 
-                    const Float_* neighbor = Y + static_cast<size_t>(x.first) * num_dim_; // cast to avoid overflow.
-                    for (int d = 0; d < num_dim_; ++d) {
-                        Float_ delta = self[d] - neighbor[d];
-                        sqdist += delta * delta;
-                    }
+    void compute_edge_forces(const Float_* Y, Float_ multiplier, size_t start, size_t length) {
+        QDTSNE_TRACE_SCOPE("edge forces");
+        std::fill_n(my_pos_f.data() + start * static_cast<size_t>(num_dim_), length * static_cast<size_t>(num_dim_), 0); // cast to avoid overflow.
+        for (size_t n = start, end = start + length; n < end; ++n) {
+            compute_edge_forces(Y, multiplier, n, my_pos_f.data() + n * static_cast<size_t>(num_dim_)); // cast to avoid overflow.
+        }
+    }
 
-                    const Float_ mult = multiplier * x.second / (static_cast<Float_>(1) + sqdist);
-                    for (int d = 0; d < num_dim_; ++d) {
-                        pos_out[d] += mult * (self[d] - neighbor[d]);
-                    }
+    QDTSNE_TARGET_CLONES
+    void compute_edge_forces(const Float_* Y, Float_ multiplier, size_t n, Float_* pos_out) const;
+
+    void prepare_non_edge_forces() {
+        if (my_options.negative_samples == 0) {
+            if constexpr(num_dim_ == 1) {
+                my_tree.compute_node_potentials(my_options.num_threads);
+            } else if (my_options.leaf_approximation) {
+                if (use_kd_tree(my_options)) {
+                    my_kd_tree.compute_non_edge_forces_for_leaves(current_theta(), my_kd_workspace, my_options.num_threads);
+                } else {
+                    my_tree.compute_non_edge_forces_for_leaves(current_theta(), my_leaf_workspace, my_options.num_threads);
                 }
             }
-        });
-
-        return;
+        }
     }
 
     Float_ compute_non_edge_forces() {
         size_t N = num_observations();
-
-        if (my_options.leaf_approximation) {
-            my_tree.compute_non_edge_forces_for_leaves(my_options.theta, my_leaf_workspace, my_options.num_threads);
-        }
+        prepare_non_edge_forces();
 
         if (my_options.num_threads > 1) {
             // Don't use reduction methods, otherwise we get numeric imprecision
             // issues (and stochastic results) based on the order of summation.
-            parallelize(my_options.num_threads, N, [&](int, size_t start, size_t length) -> void {
+            parallelize_pinned(N, [&](int, size_t start, size_t length) -> void {
+                QDTSNE_TRACE_SCOPE("traversal");
                 for (size_t n = start, end = start + length; n < end; ++n) {
                     auto neg_ptr = my_neg_f.data() + n * static_cast<size_t>(num_dim_); // cast to avoid overflow.
-                    if (my_options.leaf_approximation) {
-                        my_parallel_buffer[n] = my_tree.compute_non_edge_forces_from_leaves(n, neg_ptr, my_leaf_workspace);
-                    } else {
-                        my_parallel_buffer[n] = my_tree.compute_non_edge_forces(n, my_options.theta, neg_ptr);
-                    }
+                    std::fill_n(neg_ptr, num_dim_, 0);
+                    my_parallel_buffer[n] = compute_non_edge_forces(n, neg_ptr);
                 }
             });
             return std::accumulate(my_parallel_buffer.begin(), my_parallel_buffer.end(), static_cast<Float_>(0));
         }
 
+        QDTSNE_TRACE_SCOPE("traversal");
         Float_ sum_Q = 0;
         for (size_t n = 0; n < N; ++n) {
             auto neg_ptr = my_neg_f.data() + n * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+            std::fill_n(neg_ptr, num_dim_, 0);
+            sum_Q += compute_non_edge_forces(n, neg_ptr);
+        }
+        return sum_Q;
+    }
+
+    Float_ compute_non_edge_forces(size_t n, Float_* neg_ptr) const {
+        if (my_options.negative_samples > 0) {
+            return my_sampler.compute_non_edge_forces(n, neg_ptr);
+        } else if constexpr(num_dim_ == 1) {
+            return my_tree.compute_non_edge_forces(n, current_theta(), neg_ptr);
+        } else if (use_kd_tree(my_options)) {
             if (my_options.leaf_approximation) {
-                sum_Q += my_tree.compute_non_edge_forces_from_leaves(n, neg_ptr, my_leaf_workspace);
+                return my_kd_tree.compute_non_edge_forces_from_leaves(n, neg_ptr, my_kd_workspace);
             } else {
-                sum_Q += my_tree.compute_non_edge_forces(n, my_options.theta, neg_ptr);
+                return my_kd_tree.compute_non_edge_forces(n, current_theta(), neg_ptr);
             }
+        } else if (my_options.leaf_approximation) {
+            return my_tree.compute_non_edge_forces_from_leaves(n, neg_ptr, my_leaf_workspace);
+        } else {
+            return my_tree.compute_non_edge_forces(n, current_theta(), neg_ptr);
+        }
+    }
+
+    Float_ current_theta() const {
+        if (my_iter < my_options.stop_lying_iter) {
+            return std::max(my_options.theta, my_options.early_theta);
+        } else {
+            return my_options.theta;
         }
-        return sum_Q;
     }
 };
 
+/**
+ * @cond
+ */
+// Defined outside of the class so that it is not implicitly inline, see the
+// comments for SPTree::compute_non_edge_forces().
+template<int num_dim_, typename Index_, typename Float_, class Allocator_>
+void Status<num_dim_, Index_, Float_, Allocator_>::compute_edge_forces(const Float_* Y, Float_ multiplier, size_t n, Float_* pos_out) const {
+    const auto& current = my_neighbors[n];
+    const Float_* self = Y + n * static_cast<size_t>(num_dim_); // cast to avoid overflow.
+
+    auto add_force = [&](Index_ other, Float_ weight) -> void {
+        Float_ sqdist = 0; 
+        const Float_* neighbor = Y + static_cast<size_t>(other) * num_dim_; // cast to avoid overflow.
+        for (int d = 0; d < num_dim_; ++d) {
+            Float_ delta = self[d] - neighbor[d];
+            sqdist += delta * delta;
+        }
+
+        const Float_ mult = weight / (static_cast<Float_>(1) + sqdist);
+        for (int d = 0; d < num_dim_; ++d) {
+            pos_out[d] += mult * (self[d] - neighbor[d]);
+        }
+    };
+
+    if (my_edge_sampler.is_sampled(n)) {
+        const Float_ weight = multiplier * my_edge_sampler.scale(n);
+        my_edge_sampler.sample(n, my_iter, [&](size_t j) -> void {
+            add_force(current[j].first, weight);
+        });
+    } else {
+        for (const auto& x : current) {
+            add_force(x.first, multiplier * x.second);
+        }
+    }
+}
+
+// The common instantiations are compiled into the qdtsne_compiled library,
+// see QDTSNE_COMPILED_LIBRARY in the CMake configuration. Users linking to
+// that library should not need to instantiate them in every translation unit.
+// The configuration macros are checked in utils.hpp.
+#ifdef QDTSNE_PRECOMPILED
+namespace internal {
+
+extern template class SPTree<2, double>;
+extern template class SPTree<3, double>;
+extern template class SPTree<2, float>;
+
+extern template class KdTree<1, double>;
+extern template class KdTree<2, double>;
+extern template class KdTree<3, double>;
+extern template class KdTree<1, float>;
+extern template class KdTree<2, float>;
+
+extern template class LineInterpolator<double>;
+extern template class LineInterpolator<float>;
+
+extern template class NegativeSampler<1, double>;
+extern template class NegativeSampler<2, double>;
+extern template class NegativeSampler<3, double>;
+extern template class NegativeSampler<2, float>;
+
+extern template class EdgeSampler<int, double>;
+extern template class EdgeSampler<int, float>;
+
+}
+
+extern template class Status<1, int, double>;
+extern template class Status<2, int, double>;
+extern template class Status<3, int, double>;
+extern template class Status<2, int, float>;
+#endif
+/**
+ * @endcond
+ */
+
 }
 
 #endif
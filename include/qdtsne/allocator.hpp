@@ -0,0 +1,192 @@
+#ifndef QDTSNE_ALLOCATOR_HPP
+#define QDTSNE_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <type_traits>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+/**
+ * @file allocator.hpp
+ * @brief Allocator for the large buffers in the t-SNE iterations.
+ */
+
+namespace qdtsne {
+
+/**
+ * @cond
+ */
+namespace internal {
+
+// Enough for a cache line, or an AVX-512 register.
+constexpr size_t simd_alignment = 64;
+
+// Size of a huge page on x86-64 and most ARM64 configurations.
+constexpr size_t huge_page_size = static_cast<size_t>(2) * 1024 * 1024;
+
+inline size_t round_up_to_huge_page(size_t bytes) {
+    return (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+}
+
+inline void* allocate_huge(size_t bytes) {
+#ifdef __linux__
+    if (bytes >= huge_page_size) {
+        size_t rounded = round_up_to_huge_page(bytes);
+
+#ifdef QDTSNE_EXPLICIT_HUGE_PAGES
+        // Pages from the hugetlbfs pool are always aligned to the huge page
+        // size. If the pool is empty, we fall back to transparent huge pages.
+        void* explicit_ptr = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (explicit_ptr != MAP_FAILED) {
+            return explicit_ptr;
+        }
+#endif
+
+        // Over-allocating so that we can trim the mapping to start at a huge
+        // page boundary, otherwise the kernel can't back the whole range with
+        // transparent huge pages.
+        size_t padded = rounded + huge_page_size;
+        void* raw = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+
+        auto start = reinterpret_cast<uintptr_t>(raw);
+        auto aligned = (start + huge_page_size - 1) / huge_page_size * huge_page_size;
+        size_t head = aligned - start;
+        if (head) {
+            munmap(raw, head);
+        }
+        size_t tail = padded - head - rounded;
+        if (tail) {
+            munmap(reinterpret_cast<void*>(aligned + rounded), tail);
+        }
+
+        // This is only advisory, so failures (e.g., if THP is disabled) are ignored.
+        auto ptr = reinterpret_cast<void*>(aligned);
+        madvise(ptr, rounded, MADV_HUGEPAGE);
+        return ptr;
+    }
+#endif
+    return ::operator new(bytes, std::align_val_t(simd_alignment));
+}
+
+inline void deallocate_huge(void* ptr, size_t bytes) {
+#ifdef __linux__
+    if (bytes >= huge_page_size) {
+        munmap(ptr, round_up_to_huge_page(bytes));
+        return;
+    }
+#endif
+    ::operator delete(ptr, std::align_val_t(simd_alignment));
+}
+
+// Allocator adaptor that default-initializes values instead of
+// value-initializing them, so that resize() does not write to the new
+// elements. This allows the caller to decide which thread first touches each
+// page of the allocation, see Options::numa_aware.
+template<class Base_>
+class UninitializedAllocator : public Base_ {
+public:
+    UninitializedAllocator() = default;
+
+    UninitializedAllocator(const Base_& base) : Base_(base) {}
+
+    template<class Other_>
+    UninitializedAllocator(const UninitializedAllocator<Other_>& other) : Base_(static_cast<const Other_&>(other)) {}
+
+    template<typename Other_>
+    struct rebind {
+        typedef UninitializedAllocator<typename std::allocator_traits<Base_>::template rebind_alloc<Other_> > other;
+    };
+
+    template<typename Type_>
+    void construct(Type_* ptr) noexcept(std::is_nothrow_default_constructible<Type_>::value) {
+        ::new(static_cast<void*>(ptr)) Type_;
+    }
+
+    template<typename Type_, typename ... Args_>
+    void construct(Type_* ptr, Args_&& ... args) {
+        std::allocator_traits<Base_>::construct(static_cast<Base_&>(*this), ptr, std::forward<Args_>(args)...);
+    }
+};
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * @brief Allocator backed by huge pages.
+ *
+ * @tparam Type_ Type of the allocated values.
+ *
+ * On Linux, allocations of at least 2 MiB are mapped directly from the kernel, aligned to a 2 MiB boundary and marked as eligible for transparent huge pages.
+ * This reduces TLB misses in `Status::run()` when the per-observation buffers of the `Status` span several gigabytes, i.e., the forces, gains and update directions.
+ * The neighbor lists and the Barnes-Hut tree always use the standard allocator.
+ * The neighbor lists are `NeighborList` objects that are supplied by the caller or the neighbor search,
+ * so backing them with huge pages would require a different type in the public API.
+ *
+ * The embedding itself is owned by the caller and is randomly accessed by the attractive forces in each iteration,
+ * so it usually benefits the most from huge pages, e.g., by storing it in a `std::vector<double, HugePageAllocator<double> >`.
+ * If the `QDTSNE_EXPLICIT_HUGE_PAGES` macro is defined, large allocations are first attempted from the explicit huge page pool (see `/proc/sys/vm/nr_hugepages`),
+ * falling back to transparent huge pages if the pool is exhausted.
+ *
+ * Smaller allocations, and all allocations on other platforms, are aligned to 64 bytes for efficient vectorized access.
+ *
+ * This is intended to be used as the `Allocator_` for `Status`, e.g., `initialize<2, int, double, HugePageAllocator<double> >()`.
+ */
+template<typename Type_>
+class HugePageAllocator {
+public:
+    /**
+     * @cond
+     */
+    typedef Type_ value_type;
+
+    HugePageAllocator() = default;
+
+    template<typename Other_>
+    HugePageAllocator(const HugePageAllocator<Other_>&) {}
+
+    Type_* allocate(size_t n) {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(Type_)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<Type_*>(internal::allocate_huge(n * sizeof(Type_)));
+    }
+
+    void deallocate(Type_* ptr, size_t n) {
+        internal::deallocate_huge(ptr, n * sizeof(Type_));
+    }
+    /**
+     * @endcond
+     */
+};
+
+/**
+ * @cond
+ */
+template<typename Left_, typename Right_>
+bool operator==(const HugePageAllocator<Left_>&, const HugePageAllocator<Right_>&) {
+    return true;
+}
+
+template<typename Left_, typename Right_>
+bool operator!=(const HugePageAllocator<Left_>&, const HugePageAllocator<Right_>&) {
+    return false;
+}
+/**
+ * @endcond
+ */
+
+}
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef QDTSNE_ASYNC_HPP
+#define QDTSNE_ASYNC_HPP
+
+#include <future>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <stdexcept>
+#include <functional>
+#include <utility>
+
+#include "Status.hpp"
+
+/**
+ * @file async.hpp
+ * @brief Run the t-SNE iterations asynchronously.
+ */
+
+namespace qdtsne {
+
+/**
+ * @brief Handle to an asynchronous run of the t-SNE algorithm.
+ *
+ * Instances of this class are created by `run_async()`.
+ * They can be used to monitor the progress of the run, to cancel it, or to wait for its completion.
+ * If the handle is destroyed before the run has finished, the run is cancelled and the destructor waits for it to stop.
+ *
+ * A handle can be moved, e.g., to store it in a container.
+ * A moved-from handle behaves as if its run had already been waited on:
+ * `done()` returns true, `cancel()` does nothing, and `iteration()` and `wait()` throw an error.
+ */
+class AsyncRun {
+public:
+    /**
+     * @cond
+     */
+    struct State {
+        std::atomic<int> iteration;
+        std::atomic<bool> cancelled;
+        State(int start) : iteration(start), cancelled(false) {}
+    };
+
+    AsyncRun(std::shared_ptr<State> state, std::future<bool> result) : my_state(std::move(state)), my_result(std::move(result)) {}
+
+    AsyncRun(AsyncRun&&) = default;
+    AsyncRun& operator=(AsyncRun&& other) {
+        if (this != &other) {
+            stop();
+            my_state = std::move(other.my_state);
+            my_result = std::move(other.my_result);
+        }
+        return *this;
+    }
+
+    AsyncRun(const AsyncRun&) = delete;
+    AsyncRun& operator=(const AsyncRun&) = delete;
+
+    ~AsyncRun() {
+        stop();
+    }
+    /**
+     * @endcond
+     */
+
+private:
+    std::shared_ptr<State> my_state;
+    std::future<bool> my_result;
+
+    void stop() {
+        if (my_result.valid()) {
+            my_state->cancelled = true;
+            my_result.wait(); // any exception is discarded along with the future.
+        }
+    }
+
+public:
+    /**
+     * @return Number of iterations performed so far by the `Status` object.
+     * This is updated after each iteration and can be safely called while the run is in progress.
+     */
+    int iteration() const {
+        if (!my_state) {
+            throw std::runtime_error("asynchronous run handle has been moved from");
+        }
+        return my_state->iteration.load();
+    }
+
+    /**
+     * Request cancellation of the run.
+     * The run stops after the current iteration, after which the embedding can be safely used and the `Status` object can be resumed with another call to `Status::run()` or `run_async()`.
+     * This method does not block; use `wait()` to wait for the run to stop.
+     */
+    void cancel() {
+        if (my_state) {
+            my_state->cancelled = true;
+        }
+    }
+
+    /**
+     * @return Whether the run has stopped, either because the iteration limit was reached or because it was cancelled.
+     * This does not block.
+     */
+    bool done() const {
+        if (!my_result.valid()) {
+            return true; // already waited on.
+        }
+        return my_result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    /**
+     * Wait for the run to stop.
+     * Any exception thrown during the run is re-thrown here.
+     * If the job was discarded by the executor without being called (see `run_async()`), a `std::runtime_error` is thrown instead.
+     * This should be called at most once.
+     *
+     * @return Whether the iteration limit was reached, i.e., `false` if the run was cancelled.
+     */
+    bool wait() {
+        if (!my_result.valid()) {
+            throw std::runtime_error("asynchronous run has already been waited on");
+        }
+        try {
+            return my_result.get();
+        } catch (std::future_error& e) {
+            if (e.code() == std::future_errc::broken_promise) {
+                throw std::runtime_error("asynchronous run was discarded by the executor without being started");
+            }
+            throw;
+        }
+    }
+};
+
+/**
+ * @cond
+ */
+namespace internal {
+
+template<int num_dim_, typename Index_, typename Float_, class Allocator_>
+auto async_job(Status<num_dim_, Index_, Float_, Allocator_>& status, Float_* Y, int limit, std::shared_ptr<AsyncRun::State> state) {
+    return [&status, Y, limit, state]() -> bool {
+        return status.run(Y, limit, [&](int iter) -> bool {
+            state->iteration = iter;
+            return !(state->cancelled.load());
+        });
+    };
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * Run the t-SNE algorithm on a separate thread, returning immediately with a handle to monitor, cancel or wait for the run.
+ * The iterations themselves are parallelized as described in `Status::run()`, i.e., with `Options::num_threads` workers.
+ *
+ * This overload creates a new thread for each run.
+ * Applications that multiplex many jobs should use the other overload to run each job on their own executor.
+ *
+ * @tparam num_dim_ Number of dimensions of the final embedding.
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type to use for the calculations.
+ * @tparam Allocator_ Allocator for the per-observation buffers in the `Status`.
+ *
+ * @param status The `Status` object, typically created by `initialize()`.
+ * This should outlive the returned handle and should not be used elsewhere until the run has stopped.
+ * @param[in, out] Y Pointer to the embedding, see `Status::run()`.
+ * This should not be accessed elsewhere until the run has stopped; use `Options::publish_interval` to inspect intermediate embeddings while the run is in progress.
+ * @param limit Number of iterations to run up to, see `Status::run()`.
+ *
+ * @return Handle to the asynchronous run.
+ */
+template<int num_dim_, typename Index_, typename Float_, class Allocator_>
+AsyncRun run_async(Status<num_dim_, Index_, Float_, Allocator_>& status, Float_* Y, int limit) {
+    auto state = std::make_shared<AsyncRun::State>(status.iteration());
+    auto result = std::async(std::launch::async, internal::async_job(status, Y, limit, state));
+    return AsyncRun(std::move(state), std::move(result));
+}
+
+/**
+ * Overload of `run_async()` that runs the job on an application-supplied executor, e.g., a thread pool shared by many jobs.
+ * No new threads are created other than the workers used by the iterations, see `Options::num_threads`.
+ *
+ * @tparam num_dim_ Number of dimensions of the final embedding.
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type to use for the calculations.
+ * @tparam Allocator_ Allocator for the per-observation buffers in the `Status`.
+ * @tparam Executor_ Function that accepts a `std::function<void()>` and arranges for it to be called exactly once, e.g., by submitting it to a thread pool.
+ *
+ * @param status The `Status` object, see the other overload.
+ * @param[in, out] Y Pointer to the embedding, see the other overload.
+ * @param limit Number of iterations to run up to, see `Status::run()`.
+ * @param executor Executor for the job.
+ * The job may be called before `executor` returns, in which case `run_async()` only returns after the run has stopped.
+ * If the job is never called, `AsyncRun::wait()` and the handle's destructor will block indefinitely.
+ *
+ * @return Handle to the asynchronous run.
+ */
+template<int num_dim_, typename Index_, typename Float_, class Allocator_, class Executor_>
+AsyncRun run_async(Status<num_dim_, Index_, Float_, Allocator_>& status, Float_* Y, int limit, Executor_ executor) {
+    auto state = std::make_shared<AsyncRun::State>(status.iteration());
+
+    // std::function requires a copyable callable, hence the shared pointer.
+    auto task = std::make_shared<std::packaged_task<bool()> >(internal::async_job(status, Y, limit, state));
+    auto result = task->get_future();
+    executor(std::function<void()>([task]() -> void { (*task)(); }));
+
+    return AsyncRun(std::move(state), std::move(result));
+}
+
+}
+
+#endif
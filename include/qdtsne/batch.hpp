@@ -0,0 +1,171 @@
+#ifndef QDTSNE_BATCH_HPP
+#define QDTSNE_BATCH_HPP
+
+#include <vector>
+#include <optional>
+#include <numeric>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <memory>
+
+#include "Status.hpp"
+#include "Options.hpp"
+#include "initialize.hpp"
+#include "utils.hpp"
+
+/**
+ * @file batch.hpp
+ * @brief Run t-SNE on many small datasets.
+ */
+
+namespace qdtsne {
+
+/**
+ * @cond
+ */
+namespace internal {
+
+// Workers pull datasets from a shared counter rather than being assigned a
+// contiguous range up front, as the datasets may have very different sizes.
+// We also process the largest datasets first so that the stragglers are small.
+template<class Size_, class Function_>
+void parallelize_batch(int num_threads, const std::vector<Size_>& sizes, Function_ fun) {
+    size_t num_datasets = sizes.size();
+    if (num_datasets == 0) {
+        return;
+    }
+
+    std::vector<size_t> order(num_datasets);
+    std::iota(order.begin(), order.end(), static_cast<size_t>(0));
+    std::stable_sort(order.begin(), order.end(), [&](size_t left, size_t right) -> bool { return sizes[left] > sizes[right]; });
+
+    std::atomic<size_t> next(0);
+    int num_workers = std::min(static_cast<size_t>(std::max(num_threads, 1)), num_datasets);
+    parallelize(num_workers, num_workers, [&](int, int start, int length) -> void {
+        for (int w = start, end = start + length; w < end; ++w) {
+            while (true) {
+                size_t i = next.fetch_add(1);
+                if (i >= num_datasets) {
+                    break;
+                }
+                fun(order[i]);
+            }
+        }
+    });
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * Initialize the t-SNE algorithm for each of many datasets, typically small ones, e.g., per-sample embeddings.
+ * Each dataset is processed by a single thread and multiple datasets are processed in parallel.
+ * This is more efficient than parallelizing within each dataset when each dataset is too small to keep all threads busy.
+ *
+ * @tparam num_dim_ Number of dimensions of the final embedding.
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type to use for the calculations.
+ * @tparam Allocator_ Allocator for the per-observation buffers in each `Status`.
+ *
+ * @param neighbors Vector of neighbor lists, one per dataset.
+ * Each entry should be as described for the `NeighborList` overload of `initialize()`.
+ * @param options Further options.
+ * These are applied to each dataset, except that `Options::num_threads` is used to parallelize across datasets.
+ *
+ * @return Vector of `Status` objects, one per dataset.
+ * Each object is configured to use a single thread in its own `Status::run()`, see `run_batch()`.
+ */
+template<int num_dim_, typename Index_, typename Float_, class Allocator_ = std::allocator<Float_> >
+std::vector<Status<num_dim_, Index_, Float_, Allocator_> > initialize_batch(std::vector<NeighborList<Index_, Float_> > neighbors, const Options& options) {
+    size_t num_datasets = neighbors.size();
+    std::vector<size_t> sizes;
+    sizes.reserve(num_datasets);
+    for (const auto& nn : neighbors) {
+        sizes.push_back(nn.size() * (nn.empty() ? 0 : nn.front().size()));
+    }
+
+    Options single = options;
+    single.num_threads = 1;
+
+    std::vector<std::optional<Status<num_dim_, Index_, Float_, Allocator_> > > tmp(num_datasets);
+    internal::parallelize_batch(options.num_threads, sizes, [&](size_t i) -> void {
+        tmp[i].emplace(initialize<num_dim_, Index_, Float_, Allocator_>(std::move(neighbors[i]), single));
+    });
+
+    std::vector<Status<num_dim_, Index_, Float_, Allocator_> > output;
+    output.reserve(num_datasets);
+    for (auto& t : tmp) {
+        output.emplace_back(std::move(*t));
+    }
+    return output;
+}
+
+/**
+ * Run the t-SNE algorithm for each of many datasets, processing multiple datasets in parallel.
+ *
+ * @tparam num_dim_ Number of dimensions of the final embedding.
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type to use for the calculations.
+ * @tparam Allocator_ Allocator for the per-observation buffers in each `Status`.
+ *
+ * @param statuses Vector of `Status` objects, typically created by `initialize_batch()`.
+ * @param[in, out] embeddings Vector of pointers to the embedding for each dataset, see `Status::run()` for details.
+ * This should have the same length as `statuses`.
+ * @param limit Number of iterations to run up to, see `Status::run()`.
+ * @param num_threads Number of threads to use.
+ */
+template<int num_dim_, typename Index_, typename Float_, class Allocator_>
+void run_batch(std::vector<Status<num_dim_, Index_, Float_, Allocator_> >& statuses, const std::vector<Float_*>& embeddings, int limit, int num_threads) {
+    size_t num_datasets = statuses.size();
+    if (embeddings.size() != num_datasets) {
+        throw std::runtime_error("number of embeddings should be equal to the number of datasets");
+    }
+
+    std::vector<size_t> sizes;
+    sizes.reserve(num_datasets);
+    for (const auto& s : statuses) {
+        sizes.push_back(s.num_observations() * static_cast<size_t>(std::max(limit - s.iteration(), 0)));
+    }
+
+    internal::parallelize_batch(num_threads, sizes, [&](size_t i) -> void {
+        statuses[i].run(embeddings[i], limit);
+    });
+}
+
+/**
+ * Overload of `run_batch()` that runs each dataset to its maximum number of iterations.
+ *
+ * @tparam num_dim_ Number of dimensions of the final embedding.
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type to use for the calculations.
+ * @tparam Allocator_ Allocator for the per-observation buffers in each `Status`.
+ *
+ * @param statuses Vector of `Status` objects, typically created by `initialize_batch()`.
+ * @param[in, out] embeddings Vector of pointers to the embedding for each dataset, see `Status::run()` for details.
+ * This should have the same length as `statuses`.
+ * @param num_threads Number of threads to use.
+ */
+template<int num_dim_, typename Index_, typename Float_, class Allocator_>
+void run_batch(std::vector<Status<num_dim_, Index_, Float_, Allocator_> >& statuses, const std::vector<Float_*>& embeddings, int num_threads) {
+    size_t num_datasets = statuses.size();
+    if (embeddings.size() != num_datasets) {
+        throw std::runtime_error("number of embeddings should be equal to the number of datasets");
+    }
+
+    std::vector<size_t> sizes;
+    sizes.reserve(num_datasets);
+    for (const auto& s : statuses) {
+        sizes.push_back(s.num_observations() * static_cast<size_t>(std::max(s.max_iterations() - s.iteration(), 0)));
+    }
+
+    internal::parallelize_batch(num_threads, sizes, [&](size_t i) -> void {
+        statuses[i].run(embeddings[i]);
+    });
+}
+
+}
+
+#endif
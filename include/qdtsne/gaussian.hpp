@@ -6,6 +6,8 @@
 #include <vector>
 #include <numeric>
 #include <algorithm>
+#include <stdexcept>
+#include <type_traits>
 
 #include "utils.hpp"
 
@@ -36,153 +38,255 @@ namespace internal {
  * trusted reference implementation. It should not be defined in production.
  */
 
-template<bool use_newton_ = 
+template<typename Float_>
+struct GaussianWorkspace {
+    std::vector<Float_> squared_delta_dist;
+    std::vector<Float_> quad_delta_dist;
+    std::vector<Float_> prob_numerator; // i.e., the numerator of the probability.
+};
+
+/**
+ * Computes the probabilities for a single observation with 'K' neighbors.
+ * The distance to the m-th neighbor is obtained by 'get_distance(m)', and
+ * the probability for that neighbor is reported via 'set_probability(m, p)'.
+ * All distances are read before any probabilities are reported, so it is
+ * safe for both functions to refer to the same storage.
+ */
+template<bool use_newton_, typename Float_, class GetDistance_, class SetProbability_>
+QDTSNE_TARGET_CLONES
+void compute_gaussian_perplexity(int K, GetDistance_ get_distance, SetProbability_ set_probability, Float_ log_perplexity, GaussianWorkspace<Float_>& work) {
+    if (K == 0) {
+        return;
+    }
+
+    auto& squared_delta_dist = work.squared_delta_dist;
+    auto& quad_delta_dist = work.quad_delta_dist;
+    auto& prob_numerator = work.prob_numerator;
+    squared_delta_dist.resize(K);
+    quad_delta_dist.resize(K);
+
+    // We adjust the probabilities by subtracting the first squared
+    // distance from everything. This avoids problems with underflow
+    // when converting distances to probabilities; it otherwise has no
+    // effect on the entropy or even the final probabilities because it
+    // just scales all probabilities up/down (and they need to be
+    // normalized anyway, so any scaling effect just cancels out).
+    const Float_ first = get_distance(0);
+    const Float_ first2 = first * first;
+
+    for (int m = 1; m < K; ++m) {
+        Float_ dist = get_distance(m);
+        Float_ squared_delta_dist_raw = dist * dist - first2; 
+        squared_delta_dist[m] = squared_delta_dist_raw;
+        quad_delta_dist[m] = squared_delta_dist_raw * squared_delta_dist_raw;
+    }
+
+    auto last_squared_delta = squared_delta_dist.back();
+    if (last_squared_delta == 0) { // quitting early as entropy doesn't depend on beta.
+        for (int m = 0; m < K; ++m) {
+            set_probability(m, static_cast<Float_>(1.0 / K));
+        }
+        return;
+    }
+
+    // Choosing an initial beta that matches the scale of the (squared) distances.
+    // The choice of numerator is largely based on trial and error to see what
+    // minimizes the number of iterations in some simulated data.
+    Float_ beta = 
 #ifndef QDTSNE_R_PACKAGE_TESTING
-true
+        3.0 / last_squared_delta
 #else
-false
+        1
 #endif
-, typename Index_, typename Float_>
-void compute_gaussian_perplexity(NeighborList<Index_, Float_>& neighbors, Float_ perplexity, int nthreads) {
-    const size_t num_points = neighbors.size();
-    const Float_ log_perplexity = std::log(perplexity);
+    ;
 
-    parallelize(nthreads, num_points, [&](int, size_t start, size_t length) -> void {
-        std::vector<Float_> squared_delta_dist;
-        std::vector<Float_> quad_delta_dist;
-        std::vector<Float_> prob_numerator; // i.e., the numerator of the probability.
+    constexpr Float_ max_value = std::numeric_limits<Float_>::max();
+    Float_ min_beta = 0, max_beta = max_value;
+    Float_ sum_P = 0;
+    prob_numerator.resize(K);
+    prob_numerator[0] = 1;
 
-        for (size_t n = start, end = start + length; n < end; ++n) {
-            auto& current = neighbors[n];
-            const int K = current.size();
-            if (K == 0) {
-                continue;
-            }
+    constexpr int max_iter = 200;
+    for (int iter = 0; iter < max_iter; ++iter) {
+        // We skip the first value because we know that squared_delta_dist[0] = 0
+        // (as we subtracted 'first') and thus prob_numerator[0] = 1. We repeat this for
+        // all iterations from [1, K), e.g., squared_delta_dist, quad_delta_dist.
+        for (int m = 1; m < K; ++m) {
+            prob_numerator[m] = std::exp(-beta * squared_delta_dist[m]); 
+        }
 
-            squared_delta_dist.resize(K);
-            quad_delta_dist.resize(K);
+        sum_P = std::accumulate(prob_numerator.begin() + 1, prob_numerator.end(), static_cast<Float_>(1));
+        const Float_ prod = std::inner_product(squared_delta_dist.begin() + 1, squared_delta_dist.end(), prob_numerator.begin() + 1, static_cast<Float_>(0));
+        const Float_ entropy = beta * (prod / sum_P) + std::log(sum_P);
 
-            // We adjust the probabilities by subtracting the first squared
-            // distance from everything. This avoids problems with underflow
-            // when converting distances to probabilities; it otherwise has no
-            // effect on the entropy or even the final probabilities because it
-            // just scales all probabilities up/down (and they need to be
-            // normalized anyway, so any scaling effect just cancels out).
-            const Float_ first = current[0].second;
-            const Float_ first2 = first * first;
+        const Float_ diff = entropy - log_perplexity;
+        constexpr Float_ tol = 1e-5;
+        if (std::abs(diff) < tol) {
+            break;
+        }
 
-            for (int m = 1; m < K; ++m) {
-                Float_ dist = current[m].second;
-                Float_ squared_delta_dist_raw = dist * dist - first2; 
-                squared_delta_dist[m] = squared_delta_dist_raw;
-                quad_delta_dist[m] = squared_delta_dist_raw * squared_delta_dist_raw;
+        // Refining the search interval for a (potential) binary search
+        // later. We know that the entropy is monotonic decreasing with
+        // increasing beta, so if the difference from the target is
+        // positive, the current beta must be on the left of the root,
+        // and vice versa if the difference is negative.
+        if (diff > 0) {
+            min_beta = beta;
+        } else {
+            max_beta = beta;
+        }
+
+        bool nr_ok = false;
+        if constexpr(use_newton_) {
+            // Attempt a Newton-Raphson search first. Note to self: derivative was a bit
+            // painful but pops out nicely enough, use R's D() to prove it to yourself
+            // in the simple case of K = 2 where d0, d1 are the squared deltas.
+            // > D(expression(b * (d0 * exp(- b * d0) + d1 * exp(- b * d1)) / (exp(-b*d0) + exp(-b*d1)) + log(exp(-b*d0) + exp(-b*d1))), name="b")
+            const Float_ prod2 = std::inner_product(quad_delta_dist.begin() + 1, quad_delta_dist.end(), prob_numerator.begin() + 1, static_cast<Float_>(0));
+            const Float_ d1 = - beta / sum_P * (prod2 - prod * prod / sum_P);
+
+            if (d1) {
+                const Float_ alt_beta = beta - (diff / d1); // if it overflows, we should get Inf or -Inf, so the following comparison should be fine.
+                if (alt_beta > min_beta && alt_beta < max_beta) {
+                    beta = alt_beta;
+                    nr_ok = true;
+                }
             }
+        }
 
-            auto last_squared_delta = squared_delta_dist.back();
-            if (last_squared_delta == 0) { // quitting early as entropy doesn't depend on beta.
-                for (auto& x : current) {
-                    x.second = 1.0 / K;
+        if (!nr_ok) {
+            // Doing the binary search, if Newton's failed or was not requested.
+            if (diff > 0) {
+                if (max_beta == max_value) {
+                    beta *= static_cast<Float_>(2);
+                } else {
+                    beta += (max_beta - beta) / static_cast<Float_>(2); // i.e., midpoint that avoids problems with potential overflow.
                 }
-                continue;
+            } else {
+                beta += (min_beta - beta) / static_cast<Float_>(2); // i.e., midpoint that avoids problems with potential underflow.
             }
+        }
 
-            // Choosing an initial beta that matches the scale of the (squared) distances.
-            // The choice of numerator is largely based on trial and error to see what
-            // minimizes the number of iterations in some simulated data.
-            Float_ beta = 
+        if (std::isinf(beta)) {
+            // Avoid propagation of NaNs via Inf * 0. 
+            for (int m = 1; m < K; ++m) {
+                prob_numerator[m] = (squared_delta_dist[m] == 0);
+            }
+            sum_P = std::accumulate(prob_numerator.begin(), prob_numerator.end(), static_cast<Float_>(0));
+            break;
+        }
+    }
+
+    for (int m = 0; m < K; ++m) {
+        set_probability(m, prob_numerator[m] / sum_P);
+    }
+}
+
+template<bool use_newton_ = 
 #ifndef QDTSNE_R_PACKAGE_TESTING
-                3.0 / last_squared_delta
+true
 #else
-                1
+false
 #endif
-            ;
-
-            constexpr Float_ max_value = std::numeric_limits<Float_>::max();
-            Float_ min_beta = 0, max_beta = max_value;
-            Float_ sum_P = 0;
-            prob_numerator.resize(K);
-            prob_numerator[0] = 1;
-
-            constexpr int max_iter = 200;
-            for (int iter = 0; iter < max_iter; ++iter) {
-                // We skip the first value because we know that squared_delta_dist[0] = 0
-                // (as we subtracted 'first') and thus prob_numerator[0] = 1. We repeat this for
-                // all iterations from [1, K), e.g., squared_delta_dist, quad_delta_dist.
-                for (int m = 1; m < K; ++m) {
-                    prob_numerator[m] = std::exp(-beta * squared_delta_dist[m]); 
-                }
+, typename Index_, typename Float_>
+void compute_gaussian_perplexity(NeighborList<Index_, Float_>& neighbors, Float_ perplexity, int nthreads) {
+    const size_t num_points = neighbors.size();
+    const Float_ log_perplexity = std::log(perplexity);
 
-                sum_P = std::accumulate(prob_numerator.begin() + 1, prob_numerator.end(), static_cast<Float_>(1));
-                const Float_ prod = std::inner_product(squared_delta_dist.begin() + 1, squared_delta_dist.end(), prob_numerator.begin() + 1, static_cast<Float_>(0));
-                const Float_ entropy = beta * (prod / sum_P) + std::log(sum_P);
+    parallelize(nthreads, num_points, [&](int, size_t start, size_t length) -> void {
+        GaussianWorkspace<Float_> work;
+        for (size_t n = start, end = start + length; n < end; ++n) {
+            auto& current = neighbors[n];
+            compute_gaussian_perplexity<use_newton_>(
+                current.size(),
+                [&](int m) -> Float_ { return current[m].second; },
+                [&](int m, Float_ prob) -> void { current[m].second = prob; },
+                log_perplexity,
+                work
+            );
+        }
+    });
 
-                const Float_ diff = entropy - log_perplexity;
-                constexpr Float_ tol = 1e-5;
-                if (std::abs(diff) < tol) {
-                    break;
-                }
+    return;
+}
 
-                // Refining the search interval for a (potential) binary search
-                // later. We know that the entropy is monotonic decreasing with
-                // increasing beta, so if the difference from the target is
-                // positive, the current beta must be on the left of the root,
-                // and vice versa if the difference is negative.
-                if (diff > 0) {
-                    min_beta = beta;
-                } else {
-                    max_beta = beta;
-                }
+/**
+ * Overload for neighbor search results in dense matrices, with 'num_neighbors'
+ * rows and 'num_points' columns. Entry (m, n) of each matrix is stored at
+ * offset 'm * row_stride + n * column_stride', so that both row- and
+ * column-major layouts can be used without a transposing copy. The probabilities are
+ * written directly into a new NeighborList, which avoids an intermediate copy
+ * of the search results. We also reserve enough space in each observation's
+ * vector to accommodate the extra entries added by symmetrize_matrix(), so
+ * that there is no need for reallocation later.
+ */
+template<bool use_newton_ = 
+#ifndef QDTSNE_R_PACKAGE_TESTING
+true
+#else
+false
+#endif
+, typename Index_, typename Float_>
+NeighborList<Index_, Float_> compute_gaussian_perplexity(size_t num_points, int num_neighbors, const Index_* indices, const Float_* distances, size_t row_stride, size_t column_stride, Float_ perplexity, int nthreads) {
+    if (num_neighbors < 0) {
+        throw std::runtime_error("number of neighbors should be non-negative");
+    }
+    const Float_ log_perplexity = std::log(perplexity);
+    const size_t K = num_neighbors;
 
-                bool nr_ok = false;
-                if constexpr(use_newton_) {
-                    // Attempt a Newton-Raphson search first. Note to self: derivative was a bit
-                    // painful but pops out nicely enough, use R's D() to prove it to yourself
-                    // in the simple case of K = 2 where d0, d1 are the squared deltas.
-                    // > D(expression(b * (d0 * exp(- b * d0) + d1 * exp(- b * d1)) / (exp(-b*d0) + exp(-b*d1)) + log(exp(-b*d0) + exp(-b*d1))), name="b")
-                    const Float_ prod2 = std::inner_product(quad_delta_dist.begin() + 1, quad_delta_dist.end(), prob_numerator.begin() + 1, static_cast<Float_>(0));
-                    const Float_ d1 = - beta / sum_P * (prod2 - prod * prod / sum_P);
-
-                    if (d1) {
-                        const Float_ alt_beta = beta - (diff / d1); // if it overflows, we should get Inf or -Inf, so the following comparison should be fine.
-                        if (alt_beta > min_beta && alt_beta < max_beta) {
-                            beta = alt_beta;
-                            nr_ok = true;
-                        }
-                    }
-                }
+    // Indices are validated here as they are used to address other arrays,
+    // both below and in symmetrize_matrix(). This is cheap compared to the
+    // perplexity calculations and we need to make this pass anyway.
+    std::vector<size_t> reverse(num_points);
+    for (size_t n = 0; n < num_points; ++n) {
+        const Index_* cur_indices = indices + n * column_stride; // already size_t, no need to cast to avoid overflow.
+        for (size_t m = 0; m < K; ++m) {
+            auto idx = cur_indices[m * row_stride];
+            bool invalid = static_cast<typename std::make_unsigned<Index_>::type>(idx) >= num_points;
+            if constexpr(std::is_signed<Index_>::value) {
+                invalid = invalid || idx < 0;
+            }
+            if (invalid) {
+                throw std::runtime_error("neighbor indices should lie in [0, num_points)");
+            }
+            ++reverse[idx];
+        }
+    }
 
-                if (!nr_ok) {
-                    // Doing the binary search, if Newton's failed or was not requested.
-                    if (diff > 0) {
-                        if (max_beta == max_value) {
-                            beta *= static_cast<Float_>(2);
-                        } else {
-                            beta += (max_beta - beta) / static_cast<Float_>(2); // i.e., midpoint that avoids problems with potential overflow.
-                        }
-                    } else {
-                        beta += (min_beta - beta) / static_cast<Float_>(2); // i.e., midpoint that avoids problems with potential underflow.
-                    }
-                }
+    NeighborList<Index_, Float_> neighbors(num_points);
+    parallelize(nthreads, num_points, [&](int, size_t start, size_t length) -> void {
+        GaussianWorkspace<Float_> work;
+        for (size_t n = start, end = start + length; n < end; ++n) {
+            const Index_* cur_indices = indices + n * column_stride;
+            const Float_* cur_distances = distances + n * column_stride;
 
-                if (std::isinf(beta)) {
-                    // Avoid propagation of NaNs via Inf * 0. 
-                    for (int m = 1; m < K; ++m) {
-                        prob_numerator[m] = (squared_delta_dist[m] == 0);
-                    }
-                    sum_P = std::accumulate(prob_numerator.begin(), prob_numerator.end(), static_cast<Float_>(0));
-                    break;
-                }
+            auto& current = neighbors[n];
+            current.reserve(K + reverse[n]);
+            for (size_t m = 0; m < K; ++m) {
+                current.emplace_back(cur_indices[m * row_stride], 0);
             }
 
-            for (int m = 0; m < K; ++m) {
-                current[m].second = prob_numerator[m] / sum_P;
-            }
+            compute_gaussian_perplexity<use_newton_>(
+                num_neighbors,
+                [&](int m) -> Float_ { return cur_distances[static_cast<size_t>(m) * row_stride]; },
+                [&](int m, Float_ prob) -> void { current[m].second = prob; },
+                log_perplexity,
+                work
+            );
         }
     });
 
-    return;
+    return neighbors;
 }
 
+// Compiled into the qdtsne_compiled library, see QDTSNE_PRECOMPILED in Status.hpp.
+#ifdef QDTSNE_PRECOMPILED
+extern template void compute_gaussian_perplexity<true, int, double>(NeighborList<int, double>&, double, int);
+extern template void compute_gaussian_perplexity<true, int, float>(NeighborList<int, float>&, float, int);
+extern template NeighborList<int, double> compute_gaussian_perplexity<true, int, double>(size_t, int, const int*, const double*, size_t, size_t, double, int);
+extern template NeighborList<int, float> compute_gaussian_perplexity<true, int, float>(size_t, int, const int*, const float*, size_t, size_t, float, int);
+#endif
+
 }
 
 }
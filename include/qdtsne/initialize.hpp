@@ -37,6 +37,7 @@
 
 #include <vector>
 #include <stdexcept>
+#include <memory>
 
 #include "Status.hpp"
 #include "Options.hpp"
@@ -55,11 +56,13 @@ namespace qdtsne {
  */
 namespace internal {
 
-template<int num_dim_, typename Index_, typename Float_>
-Status<num_dim_, Index_, Float_> initialize(NeighborList<Index_, Float_> nn, Float_ perp, const Options& options) {
+template<int num_dim_, typename Index_, typename Float_, class Allocator_ = std::allocator<Float_> >
+Status<num_dim_, Index_, Float_, Allocator_> initialize(NeighborList<Index_, Float_> nn, Float_ perp, const Options& options) {
+    check_prune_threshold(options.prune_threshold);
     compute_gaussian_perplexity(nn, perp, options.num_threads);
+    size_t pruned = prune_matrix(nn, static_cast<Float_>(options.prune_threshold), options.num_threads);
     symmetrize_matrix(nn);
-    return Status<num_dim_, Index_, Float_>(std::move(nn), options);
+    return Status<num_dim_, Index_, Float_, Allocator_>(std::move(nn), options, pruned);
 }
 
 }
@@ -73,6 +76,7 @@ Status<num_dim_, Index_, Float_> initialize(NeighborList<Index_, Float_> nn, Flo
  * @tparam num_dim_ Number of dimensions of the final embedding.
  * @tparam Index_ Integer type for the neighbor indices.
  * @tparam Float_ Floating-point type to use for the calculations.
+ * @tparam Allocator_ Allocator for the per-observation buffers in the `Status`, see `HugePageAllocator` for an example.
  *
  * @param neighbors List of indices and distances to nearest neighbors for each observation. 
  * Each observation should have the same number of neighbors, sorted by increasing distance, which should not include itself.
@@ -81,15 +85,85 @@ Status<num_dim_, Index_, Float_> initialize(NeighborList<Index_, Float_> nn, Flo
  *
  * @return A `Status` object representing an initial state of the t-SNE algorithm.
  */
-template<int num_dim_, typename Index_, typename Float_>
-Status<num_dim_, Index_, Float_> initialize(NeighborList<Index_, Float_> neighbors, const Options& options) {
+template<int num_dim_, typename Index_, typename Float_, class Allocator_ = std::allocator<Float_> >
+Status<num_dim_, Index_, Float_, Allocator_> initialize(NeighborList<Index_, Float_> neighbors, const Options& options) {
     Float_ perp;
     if (options.infer_perplexity && neighbors.size()) {
         perp = static_cast<Float_>(neighbors.front().size())/3;
     } else {
         perp = options.perplexity;
     }
-    return internal::initialize<num_dim_>(std::move(neighbors), perp, options);
+    return internal::initialize<num_dim_, Index_, Float_, Allocator_>(std::move(neighbors), perp, options);
+}
+
+/**
+ * Overload that accepts the nearest neighbor search results in dense matrices, e.g., from an external search.
+ * This avoids the need to create an intermediate `NeighborList` from the search results,
+ * as the probabilities are computed directly from the supplied arrays.
+ *
+ * @tparam num_dim_ Number of dimensions of the final embedding.
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type to use for the calculations.
+ * @tparam Allocator_ Allocator for the per-observation buffers in the `Status`, see `HugePageAllocator` for an example.
+ *
+ * @param num_points Number of observations.
+ * @param num_neighbors Number of nearest neighbors for each observation.
+ * This should be non-negative, otherwise an error is thrown.
+ * @param[in] indices Pointer to an array containing a matrix with `num_neighbors` rows and `num_points` columns.
+ * Each column corresponds to an observation and contains the indices of its nearest neighbors, sorted by increasing distance.
+ * Each column should not contain the observation itself or any duplicate indices.
+ * All indices should lie in `[0, num_points)`, otherwise an error is thrown.
+ * @param[in] distances Pointer to an array containing a matrix with `num_neighbors` rows and `num_points` columns.
+ * Each column corresponds to an observation and contains the distances to its nearest neighbors, in the same order as `indices`.
+ * @param row_stride Distance between consecutive rows, i.e., the offset between the `j`-th and `(j + 1)`-th neighbor of an observation.
+ * @param column_stride Distance between consecutive columns, i.e., the offset between the `j`-th neighbor of the `i`-th and `(i + 1)`-th observations.
+ *
+ * Both matrices should have the same layout, where the entry for the `j`-th neighbor of the `i`-th observation is stored at `i * column_stride + j * row_stride`.
+ * For example, search results with one row per observation can be used by setting `row_stride = 1` and `column_stride = num_neighbors` if they are stored in row-major order,
+ * or `row_stride = num_points` and `column_stride = 1` if they are stored in column-major order.
+ * @param options Further options.
+ * If `Options::infer_perplexity = true`, the perplexity is determined from `num_neighbors` and the value in `Options::perplexity` is ignored.
+ *
+ * @return A `Status` object representing an initial state of the t-SNE algorithm.
+ */
+template<int num_dim_, typename Index_, typename Float_, class Allocator_ = std::allocator<Float_> >
+Status<num_dim_, Index_, Float_, Allocator_> initialize(size_t num_points, int num_neighbors, const Index_* indices, const Float_* distances, size_t row_stride, size_t column_stride, const Options& options) {
+    internal::check_prune_threshold(options.prune_threshold);
+
+    Float_ perp;
+    if (options.infer_perplexity && num_points) {
+        perp = static_cast<Float_>(num_neighbors)/3;
+    } else {
+        perp = options.perplexity;
+    }
+
+    auto nn = internal::compute_gaussian_perplexity(num_points, num_neighbors, indices, distances, row_stride, column_stride, perp, options.num_threads);
+    size_t pruned = internal::prune_matrix(nn, static_cast<Float_>(options.prune_threshold), options.num_threads);
+    internal::symmetrize_matrix(nn);
+    return Status<num_dim_, Index_, Float_, Allocator_>(std::move(nn), options, pruned);
+}
+
+/**
+ * Overload for contiguous column-major matrices, i.e., each column immediately follows the previous one.
+ * This is equivalent to calling the strided overload with `row_stride = 1` and `column_stride = num_neighbors`.
+ *
+ * @tparam num_dim_ Number of dimensions of the final embedding.
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type to use for the calculations.
+ * @tparam Allocator_ Allocator for the per-observation buffers in the `Status`, see `HugePageAllocator` for an example.
+ *
+ * @param num_points Number of observations.
+ * @param num_neighbors Number of nearest neighbors for each observation.
+ * This should be non-negative, otherwise an error is thrown.
+ * @param[in] indices Pointer to an array containing a column-major matrix with `num_neighbors` rows and `num_points` columns, see above for details.
+ * @param[in] distances Pointer to an array containing a column-major matrix with `num_neighbors` rows and `num_points` columns, see above for details.
+ * @param options Further options.
+ *
+ * @return A `Status` object representing an initial state of the t-SNE algorithm.
+ */
+template<int num_dim_, typename Index_, typename Float_, class Allocator_ = std::allocator<Float_> >
+Status<num_dim_, Index_, Float_, Allocator_> initialize(size_t num_points, int num_neighbors, const Index_* indices, const Float_* distances, const Options& options) {
+    return initialize<num_dim_, Index_, Float_, Allocator_>(num_points, num_neighbors, indices, distances, 1, static_cast<size_t>(num_neighbors), options);
 }
 
 /**
@@ -100,14 +174,16 @@ Status<num_dim_, Index_, Float_> initialize(NeighborList<Index_, Float_> neighbo
  * @tparam Dim_ Integer type for the dataset dimensions.
  * @tparam Index_ Integer type for the neighbor indices.
  * @tparam Float_ Floating-point type to use for the calculations.
+ * @tparam Allocator_ Allocator for the per-observation buffers in the `Status`, see `HugePageAllocator` for an example.
  *
  * @param prebuilt A `knncolle::Prebuilt` instance containing a neighbor search index built on the dataset of interest.
  * @param options Further options.
  *
  * @return A `Status` object representing an initial state of the t-SNE algorithm.
  */
-template<int num_dim_, typename Dim_, typename Index_, typename Float_>
-Status<num_dim_, Index_, Float_> initialize(const knncolle::Prebuilt<Dim_, Index_, Float_>& prebuilt, const Options& options) { 
+template<int num_dim_, typename Dim_, typename Index_, typename Float_, class Allocator_ = std::allocator<Float_> >
+Status<num_dim_, Index_, Float_, Allocator_> initialize(const knncolle::Prebuilt<Dim_, Index_, Float_>& prebuilt, const Options& options) { 
+    internal::check_prune_threshold(options.prune_threshold); // before the expensive neighbor search.
     const Index_ K = perplexity_to_k(options.perplexity);
     Index_ N = prebuilt.num_observations();
     if (K >= N) {
@@ -115,7 +191,7 @@ Status<num_dim_, Index_, Float_> initialize(const knncolle::Prebuilt<Dim_, Index
     }
 
     auto neighbors = find_nearest_neighbors(prebuilt, K, options.num_threads);
-    return internal::initialize<num_dim_>(std::move(neighbors), options.perplexity, options);
+    return internal::initialize<num_dim_, Index_, Float_, Allocator_>(std::move(neighbors), static_cast<Float_>(options.perplexity), options);
 }
 
 /**
@@ -126,6 +202,7 @@ Status<num_dim_, Index_, Float_> initialize(const knncolle::Prebuilt<Dim_, Index
  * @tparam Dim_ Integer type for the dataset dimensions.
  * @tparam Index_ Integer type for the neighbor indices.
  * @tparam Float_ Floating-point type to use for the calculations.
+ * @tparam Allocator_ Allocator for the per-observation buffers in the `Status`, see `HugePageAllocator` for an example.
  *
  * @param data_dim Number of rows of the matrix at `data`, corresponding to the dimensions of the input dataset.
  * @param num_points Number of columns of the matrix at `data`, corresponding to the points of the input dataset.
@@ -135,16 +212,17 @@ Status<num_dim_, Index_, Float_> initialize(const knncolle::Prebuilt<Dim_, Index
  *
  * @return A `Status` object representing an initial state of the t-SNE algorithm.
  */
-template<int num_dim_, typename Dim_, typename Index_, typename Float_>
-Status<num_dim_, Index_, Float_> initialize(
+template<int num_dim_, typename Dim_, typename Index_, typename Float_, class Allocator_ = std::allocator<Float_> >
+Status<num_dim_, Index_, Float_, Allocator_> initialize(
     Dim_ data_dim,
     Index_ num_points,
     const Float_* data,
     const knncolle::Builder<knncolle::SimpleMatrix<Dim_, Index_, Float_>, Float_>& builder,
     const Options& options) 
 {
+    internal::check_prune_threshold(options.prune_threshold);
     auto index = builder.build_unique(knncolle::SimpleMatrix<Dim_, Index_, Float_>(data_dim, num_points, data));
-    return initialize<num_dim_>(*index, options);
+    return initialize<num_dim_, Dim_, Index_, Float_, Allocator_>(*index, options);
 }
 
 }
@@ -0,0 +1,158 @@
+#ifndef QDTSNE_MEMORY_HPP
+#define QDTSNE_MEMORY_HPP
+
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+
+#include "SPTree.hpp"
+#include "KdTree.hpp"
+#include "Options.hpp"
+
+/**
+ * @file memory.hpp
+ * @brief Estimate the memory usage of the t-SNE algorithm.
+ */
+
+namespace qdtsne {
+
+/**
+ * @brief Breakdown of memory usage, in bytes.
+ */
+struct MemoryUsage {
+    /**
+     * Memory used by the neighbor indices and probabilities.
+     */
+    size_t neighbors = 0;
+
+    /**
+     * Memory used by the per-observation buffers for the gradients, updates and gains.
+     */
+    size_t buffers = 0;
+
+    /**
+     * Memory used by the data structure for computing the repulsive forces, e.g., the Barnes-Hut tree.
+     */
+    size_t tree = 0;
+
+    /**
+     * Memory used by other workspaces, e.g., for parallelization, leaf approximations or published copies of the embedding.
+     */
+    size_t workspace = 0;
+
+    /**
+     * @return Total memory usage.
+     */
+    size_t total() const {
+        return neighbors + buffers + tree + workspace;
+    }
+};
+
+/**
+ * @brief Estimated memory usage for each phase of the t-SNE algorithm.
+ */
+struct MemoryEstimate {
+    /**
+     * Estimated memory usage during `initialize()`, i.e., while calibrating and symmetrizing the probabilities.
+     * This does not include the memory used by the nearest-neighbor search itself.
+     */
+    MemoryUsage initialization;
+
+    /**
+     * Estimated memory usage of the `Status` object during `Status::run()`.
+     * If `Options::low_memory = true`, the tree and workspaces are released between `Status::run()` calls.
+     */
+    MemoryUsage iteration;
+
+    /**
+     * @return Estimated peak memory usage across both phases.
+     */
+    size_t peak() const {
+        return std::max(initialization.total(), iteration.total());
+    }
+};
+
+/**
+ * Estimate the memory required by the t-SNE algorithm, e.g., to decide how many jobs can be run concurrently on a machine.
+ * These estimates are upper bounds in the typical case:
+ * the number of neighbors for each observation after symmetrization is assumed to be twice `num_neighbors`,
+ * and the Barnes-Hut tree is assumed to fit in the space reserved for it based on `Options::max_depth`.
+ * For 1-dimensional embeddings, the interpolation grid depends on the range of the embedding and is not included in the estimate, though it is usually small.
+ *
+ * @tparam num_dim_ Number of dimensions of the final embedding.
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type to use for the calculations.
+ *
+ * @param num_points Number of observations.
+ * @param num_neighbors Number of nearest neighbors for each observation, e.g., from `perplexity_to_k()`.
+ * @param options Further options.
+ *
+ * @return Estimated memory usage for initialization and iterations.
+ */
+template<int num_dim_, typename Index_, typename Float_>
+MemoryEstimate estimate_memory(size_t num_points, int num_neighbors, const Options& options) {
+    MemoryEstimate output;
+    const size_t num_edges = num_points * static_cast<size_t>(num_neighbors) * 2;
+    const size_t neighbors = num_points * sizeof(std::vector<std::pair<Index_, Float_> >) + num_edges * sizeof(std::pair<Index_, Float_>);
+
+    // Symmetrization needs two size_t's per observation, while the perplexity
+    // calibration needs three vectors of length 'num_neighbors' per thread.
+    output.initialization.neighbors = neighbors;
+    output.initialization.workspace = num_points * sizeof(size_t) * 2 + static_cast<size_t>(num_neighbors) * sizeof(Float_) * 3 * std::max(options.num_threads, 1);
+
+    const size_t per_point = num_points * static_cast<size_t>(num_dim_) * sizeof(Float_);
+    output.iteration.neighbors = neighbors;
+    if (options.edge_samples > 0) {
+        // Alias tables, assuming that all points have enough edges to be sampled.
+        output.iteration.neighbors += (num_points + 1) * sizeof(size_t) + num_points * sizeof(Float_) + num_edges * (sizeof(Float_) + sizeof(Index_));
+    }
+    output.iteration.buffers = per_point * 3;
+    if (options.low_memory) {
+        output.iteration.buffers += num_points * static_cast<size_t>(num_dim_) * sizeof(float);
+    } else {
+        output.iteration.buffers += per_point;
+    }
+
+    size_t num_nodes = 0;
+    const bool use_kd_tree = (num_dim_ > 1 && options.kd_tree && options.negative_samples == 0);
+    if (use_kd_tree) {
+        num_nodes = internal::KdTree<num_dim_, Float_>::max_nodes(num_points, std::max(options.bucket_size, 1));
+
+        // Leaf locations, reordered indices and reordered coordinates.
+        output.iteration.tree = num_nodes * sizeof(typename internal::KdTree<num_dim_, Float_>::Node) + num_points * (sizeof(size_t) * 2 + static_cast<size_t>(num_dim_) * sizeof(Float_));
+
+    } else if (num_dim_ > 1 && options.negative_samples == 0) {
+        double max_leaves = std::min(std::ceil(static_cast<double>(num_points) / std::max(options.bucket_size, 1)), std::pow(4.0, static_cast<double>(options.max_depth)));
+        num_nodes = static_cast<size_t>(max_leaves) * 2;
+
+        // Nodes, plus the per-point leaf locations and insertion order.
+        output.iteration.tree = num_nodes * sizeof(typename internal::SPTree<num_dim_, Float_>::Node) + num_points * sizeof(size_t) * 2;
+        if (options.bucket_size > 1) {
+            // Reordered indices and coordinates for the buckets.
+            output.iteration.tree += num_points * (sizeof(size_t) + static_cast<size_t>(num_dim_) * sizeof(Float_));
+        }
+    }
+
+    auto& workspace = output.iteration.workspace;
+    if (options.num_threads > 1) {
+        workspace += num_points * sizeof(Float_);
+    }
+    if (options.leaf_approximation && num_nodes) {
+        workspace += num_nodes * (sizeof(std::array<Float_, num_dim_>) + sizeof(Float_));
+        if (options.num_threads > 1) {
+            workspace += num_nodes * sizeof(size_t);
+        }
+    }
+    if (options.publish_interval > 0) {
+        // The current copy and the previous one that is recycled for the next publication.
+        workspace += per_point * 2;
+    }
+
+    return output;
+}
+
+}
+
+#endif
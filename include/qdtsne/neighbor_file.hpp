@@ -0,0 +1,527 @@
+#ifndef QDTSNE_NEIGHBOR_FILE_HPP
+#define QDTSNE_NEIGHBOR_FILE_HPP
+
+#include <vector>
+#include <array>
+#include <string>
+#include <istream>
+#include <ostream>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#include "utils.hpp"
+
+/**
+ * @file neighbor_file.hpp
+ * @brief Read and write precomputed neighbors in a compact binary format.
+ *
+ * The file starts with a 32-byte header, containing (in order):
+ *
+ * - the magic string `QDTSNENN`.
+ * - a 32-bit unsigned version number, currently 1.
+ * - a 32-bit unsigned integer containing flags.
+ *   If the lowest bit is set, the indices are compressed.
+ *   All other bits are reserved and should be zero; files with any of them set are rejected.
+ * - a 64-bit unsigned integer containing the number of observations.
+ * - a 32-bit unsigned integer containing the number of neighbors for each observation.
+ * - a 32-bit unsigned integer containing the number of observations per block.
+ *
+ * This is followed by the blocks of observations, where all blocks except the last contain the specified number of observations.
+ * Each block contains the indices for all observations in that block, followed by the distances.
+ * Both are stored as column-major matrices where each column is an observation and each row is a neighbor, sorted by increasing distance.
+ * Uncompressed indices are stored as 32-bit signed integers while distances are always stored as 32-bit floats.
+ * If the indices are compressed, the indices for the block are preceded by a 64-bit unsigned integer containing the number of bytes used by the compressed indices.
+ * Each neighbor's index is then stored as the difference from the index of its observation, zig-zag encoded and written as a LEB128 variable-length integer;
+ * this is most effective when neighbors tend to have similar indices, e.g., when the observations are sorted by cluster.
+ *
+ * All values are little-endian.
+ */
+
+namespace qdtsne {
+
+/**
+ * @cond
+ */
+namespace internal {
+
+inline constexpr char neighbor_file_magic[8] = { 'Q', 'D', 'T', 'S', 'N', 'E', 'N', 'N' };
+inline constexpr uint32_t neighbor_file_version = 1;
+inline constexpr uint32_t neighbor_file_compressed = 1;
+
+template<typename Type_>
+void write_value(std::ostream& output, Type_ value) {
+    output.write(reinterpret_cast<const char*>(&value), sizeof(Type_));
+}
+
+template<typename Type_>
+Type_ read_value(std::istream& input) {
+    Type_ value;
+    input.read(reinterpret_cast<char*>(&value), sizeof(Type_));
+    if (!input) {
+        throw std::runtime_error("unexpected end of the neighbor file");
+    }
+    return value;
+}
+
+inline void write_varint(std::vector<unsigned char>& buffer, int64_t delta) {
+    uint64_t zigzag = (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63);
+    while (zigzag >= 0x80) {
+        buffer.push_back(static_cast<unsigned char>(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    buffer.push_back(static_cast<unsigned char>(zigzag));
+}
+
+// Differences between 32-bit signed indices fit into 32 bits after zig-zag
+// encoding, i.e., at most 5 bytes. Longer encodings or larger values can
+// only come from a corrupt file, so we reject them rather than dropping bits.
+inline constexpr int max_varint_bytes = 5;
+
+inline int64_t read_varint(const unsigned char*& current, const unsigned char* end) {
+    uint64_t zigzag = 0;
+    int shift = 0;
+    for (int b = 0; ; ++b) {
+        if (current == end || b == max_varint_bytes) {
+            throw std::runtime_error("invalid compressed indices in the neighbor file");
+        }
+        unsigned char byte = *(current++);
+        zigzag |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+        shift += 7;
+    }
+    if (zigzag > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("invalid compressed indices in the neighbor file");
+    }
+    return static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * Write neighbors to a stream in the binary format described in `neighbor_file.hpp`.
+ * Distances are converted to single precision.
+ *
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type for the distances.
+ *
+ * @param output Stream to write to.
+ * This should be opened in binary mode.
+ * @param neighbors List of neighbors for each observation, typically from `knncolle::find_nearest_neighbors()`.
+ * All observations should have the same number of neighbors.
+ * @param compress Whether to compress the indices.
+ * @param block_size Number of observations in each block.
+ * Larger values reduce the number of reads, at the cost of increasing the memory usage when writing compressed indices.
+ */
+template<typename Index_, typename Float_>
+void write_neighbors(std::ostream& output, const NeighborList<Index_, Float_>& neighbors, bool compress = false, uint32_t block_size = 65536) {
+    internal::check_little_endian("neighbor files");
+    if (block_size == 0) {
+        throw std::runtime_error("block size should be positive");
+    }
+
+    size_t num_points = neighbors.size();
+    size_t num_neighbors = (num_points ? neighbors.front().size() : 0);
+    for (const auto& current : neighbors) {
+        if (current.size() != num_neighbors) {
+            throw std::runtime_error("all observations should have the same number of neighbors");
+        }
+    }
+    if (static_cast<uint64_t>(num_points) > static_cast<uint64_t>(std::numeric_limits<int32_t>::max())) {
+        throw std::runtime_error("number of observations should fit into a 32-bit signed integer");
+    }
+
+    output.write(internal::neighbor_file_magic, sizeof(internal::neighbor_file_magic));
+    internal::write_value<uint32_t>(output, internal::neighbor_file_version);
+    internal::write_value<uint32_t>(output, compress ? internal::neighbor_file_compressed : 0);
+    internal::write_value<uint64_t>(output, num_points);
+    internal::write_value<uint32_t>(output, num_neighbors);
+    internal::write_value<uint32_t>(output, block_size);
+
+    std::vector<int32_t> indices;
+    std::vector<float> distances;
+    std::vector<unsigned char> compressed;
+
+    for (size_t start = 0; start < num_points; start += block_size) {
+        size_t end = std::min(num_points, start + static_cast<size_t>(block_size));
+        size_t block_total = (end - start) * num_neighbors;
+
+        distances.clear();
+        distances.reserve(block_total);
+        for (size_t i = start; i < end; ++i) {
+            for (const auto& x : neighbors[i]) {
+                distances.push_back(x.second);
+            }
+        }
+
+        if (compress) {
+            compressed.clear();
+            for (size_t i = start; i < end; ++i) {
+                for (const auto& x : neighbors[i]) {
+                    internal::write_varint(compressed, static_cast<int64_t>(x.first) - static_cast<int64_t>(i));
+                }
+            }
+            internal::write_value<uint64_t>(output, compressed.size());
+            output.write(reinterpret_cast<const char*>(compressed.data()), compressed.size());
+
+        } else {
+            indices.clear();
+            indices.reserve(block_total);
+            for (size_t i = start; i < end; ++i) {
+                for (const auto& x : neighbors[i]) {
+                    indices.push_back(x.first);
+                }
+            }
+            output.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(int32_t));
+        }
+
+        output.write(reinterpret_cast<const char*>(distances.data()), distances.size() * sizeof(float));
+    }
+
+    if (!output) {
+        throw std::runtime_error("failed to write the neighbor file");
+    }
+}
+
+/**
+ * Overload of `write_neighbors()` that writes to a file.
+ *
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type for the distances.
+ *
+ * @param path Path to the output file.
+ * @param neighbors List of neighbors for each observation, see the other overload.
+ * @param compress Whether to compress the indices.
+ * @param block_size Number of observations in each block.
+ */
+template<typename Index_, typename Float_>
+void write_neighbors(const std::string& path, const NeighborList<Index_, Float_>& neighbors, bool compress = false, uint32_t block_size = 65536) {
+    std::ofstream output(path, std::ios::binary);
+    if (!output) {
+        throw std::runtime_error("failed to open '" + path + "' for writing");
+    }
+    write_neighbors(output, neighbors, compress, block_size);
+}
+
+/**
+ * @brief Streaming reader for neighbor files.
+ *
+ * This reads the neighbors from a file in the format described in `neighbor_file.hpp`, one block at a time.
+ * Each block is read directly into the caller's arrays where possible, so the memory usage is independent of the number of observations.
+ *
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type for the distances.
+ */
+template<typename Index_, typename Float_>
+class NeighborFileReader {
+public:
+    /**
+     * @param input Stream to read from, opened in binary mode.
+     * This should be positioned at the start of the header and should outlive this object.
+     */
+    NeighborFileReader(std::istream& input) : my_input(input) {
+        internal::check_little_endian("neighbor files");
+
+        char magic[sizeof(internal::neighbor_file_magic)];
+        input.read(magic, sizeof(magic));
+        if (!input || std::memcmp(magic, internal::neighbor_file_magic, sizeof(magic)) != 0) {
+            throw std::runtime_error("input is not a neighbor file");
+        }
+
+        auto version = internal::read_value<uint32_t>(input);
+        if (version != internal::neighbor_file_version) {
+            throw std::runtime_error("unsupported version of the neighbor file");
+        }
+
+        // Unknown flags may change the layout of the blocks, so we can't just ignore them.
+        auto flags = internal::read_value<uint32_t>(input);
+        if (flags & ~internal::neighbor_file_compressed) {
+            throw std::runtime_error("unknown flags in the neighbor file");
+        }
+        my_compressed = (flags & internal::neighbor_file_compressed);
+
+        // Validating the header before anyone allocates memory based on it.
+        auto num_points = internal::read_value<uint64_t>(input);
+        if (num_points > static_cast<uint64_t>(std::numeric_limits<int32_t>::max())) {
+            throw std::runtime_error("number of observations in the neighbor file does not fit into a 32-bit signed integer");
+        }
+        my_num_points = num_points;
+        if (num_points && num_points - 1 > static_cast<uint64_t>(std::numeric_limits<Index_>::max())) {
+            throw std::runtime_error("number of observations in the neighbor file does not fit into the index type");
+        }
+
+        // Neighbors exclude the observation itself and are not duplicated.
+        auto num_neighbors = internal::read_value<uint32_t>(input);
+        if (num_neighbors > 0 && num_neighbors >= num_points) {
+            throw std::runtime_error("number of neighbors in the neighbor file should be less than the number of observations");
+        }
+        my_num_neighbors = num_neighbors;
+
+        my_block_size = internal::read_value<uint32_t>(input);
+        if (my_block_size == 0 && my_num_points) {
+            throw std::runtime_error("invalid block size in the neighbor file");
+        }
+
+        check_remaining_size();
+    }
+
+private:
+    std::istream& my_input;
+    bool my_compressed;
+    size_t my_num_points;
+    int my_num_neighbors;
+    size_t my_block_size;
+    size_t my_position = 0;
+
+    std::vector<int32_t> my_index_buffer;
+    std::vector<float> my_distance_buffer;
+    std::vector<unsigned char> my_compressed_buffer;
+
+public:
+    /**
+     * @return Number of observations in the file.
+     */
+    size_t num_observations() const {
+        return my_num_points;
+    }
+
+    /**
+     * @return Number of neighbors for each observation.
+     */
+    int num_neighbors() const {
+        return my_num_neighbors;
+    }
+
+    /**
+     * @return Number of observations that have been read so far.
+     */
+    size_t position() const {
+        return my_position;
+    }
+
+    /**
+     * Read the next block of observations.
+     *
+     * @param[out] indices Pointer to an array of length equal to the product of `num_neighbors()` and the block size.
+     * On output, the first `num_neighbors() * n` entries are filled with a column-major matrix of neighbor indices, where `n` is the return value.
+     * @param[out] distances Pointer to an array of the same length as `indices`.
+     * On output, this is filled with the distances to each neighbor in `indices`.
+     *
+     * @return Number of observations that were read, i.e., `n`.
+     * This is zero if all observations have already been read.
+     */
+    size_t read_block(Index_* indices, Float_* distances) {
+        if (my_position >= my_num_points) {
+            return 0;
+        }
+
+        size_t block_points = std::min(my_block_size, my_num_points - my_position);
+        size_t block_total = block_points * static_cast<size_t>(my_num_neighbors);
+
+        if (my_compressed) {
+            // Each index is encoded by 1 to 5 bytes, see read_varint().
+            auto nbytes = internal::read_value<uint64_t>(my_input);
+            if (nbytes < block_total || nbytes > block_total * 5) {
+                throw std::runtime_error("invalid compressed indices in the neighbor file");
+            }
+            my_compressed_buffer.resize(nbytes);
+            read_bytes(my_compressed_buffer.data(), nbytes);
+
+            const unsigned char* current = my_compressed_buffer.data();
+            const unsigned char* end = current + nbytes;
+            for (size_t i = 0; i < block_points; ++i) {
+                // Checking the difference before adding, so that a corrupt
+                // value can't overflow. Both bounds fit easily into 64 bits.
+                int64_t self = my_position + i;
+                int64_t lower = -self, upper = static_cast<int64_t>(my_num_points) - 1 - self;
+                for (int k = 0; k < my_num_neighbors; ++k) {
+                    auto delta = internal::read_varint(current, end);
+                    if (delta < lower || delta > upper) {
+                        throw std::runtime_error("out-of-range neighbor index in the neighbor file");
+                    }
+                    *(indices++) = self + delta;
+                }
+            }
+            if (current != end) {
+                throw std::runtime_error("invalid compressed indices in the neighbor file");
+            }
+
+        } else if constexpr(std::is_same<Index_, int32_t>::value) {
+            read_bytes(indices, block_total * sizeof(int32_t));
+            for (size_t i = 0; i < block_total; ++i) {
+                check_index(indices[i]);
+            }
+
+        } else {
+            my_index_buffer.resize(block_total);
+            read_bytes(my_index_buffer.data(), block_total * sizeof(int32_t));
+            for (size_t i = 0; i < block_total; ++i) {
+                indices[i] = check_index(my_index_buffer[i]);
+            }
+        }
+
+        if constexpr(std::is_same<Float_, float>::value) {
+            read_bytes(distances, block_total * sizeof(float));
+        } else {
+            my_distance_buffer.resize(block_total);
+            read_bytes(my_distance_buffer.data(), block_total * sizeof(float));
+            std::copy(my_distance_buffer.begin(), my_distance_buffer.end(), distances);
+        }
+
+        my_position += block_points;
+        return block_points;
+    }
+
+    /**
+     * @return Maximum number of observations returned by each call to `read_block()`.
+     */
+    size_t block_size() const {
+        return my_block_size;
+    }
+
+private:
+    // For seekable streams, we check that the rest of the file is large enough
+    // for the number of observations and neighbors in the header. Each
+    // neighbor requires at least 4 bytes for its distance plus 4 bytes for an
+    // uncompressed index or 1 byte for a compressed index.
+    void check_remaining_size() {
+        auto here = my_input.tellg();
+        if (here == std::streampos(-1)) {
+            my_input.clear();
+            return;
+        }
+
+        my_input.seekg(0, std::ios::end);
+        auto end = my_input.tellg();
+        my_input.clear();
+        my_input.seekg(here);
+        if (end == std::streampos(-1) || !my_input) {
+            my_input.clear();
+            my_input.seekg(here);
+            return;
+        }
+
+        uint64_t available = static_cast<uint64_t>(end - here);
+        uint64_t per_neighbor = (my_compressed ? 1 : sizeof(int32_t)) + sizeof(float);
+        uint64_t total = static_cast<uint64_t>(my_num_points) * static_cast<uint64_t>(my_num_neighbors); // no overflow, both are less than 2^31.
+        if (total > available / per_neighbor) {
+            throw std::runtime_error("unexpected end of the neighbor file, given the number of observations and neighbors in its header");
+        }
+    }
+
+    void read_bytes(void* destination, size_t nbytes) {
+        my_input.read(static_cast<char*>(destination), nbytes);
+        if (!my_input) {
+            throw std::runtime_error("unexpected end of the neighbor file");
+        }
+    }
+
+    // The header check guarantees that all valid indices fit into 'Index_'.
+    Index_ check_index(int64_t index) const {
+        if (index < 0 || static_cast<uint64_t>(index) >= static_cast<uint64_t>(my_num_points)) {
+            throw std::runtime_error("out-of-range neighbor index in the neighbor file");
+        }
+        return index;
+    }
+};
+
+/**
+ * @brief Neighbors for all observations, stored as dense matrices.
+ *
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type for the distances.
+ */
+template<typename Index_, typename Float_>
+struct NeighborMatrix {
+    /**
+     * Number of observations.
+     */
+    size_t num_points = 0;
+
+    /**
+     * Number of neighbors for each observation.
+     */
+    int num_neighbors = 0;
+
+    /**
+     * Column-major matrix of neighbor indices, with `num_neighbors` rows and `num_points` columns.
+     */
+    std::vector<Index_> indices;
+
+    /**
+     * Column-major matrix of distances to each neighbor in `indices`.
+     */
+    std::vector<Float_> distances;
+};
+
+/**
+ * Read all neighbors from a stream in the binary format described in `neighbor_file.hpp`.
+ * Unlike `NeighborFileReader`, this holds all neighbors in memory at once.
+ * The output can be passed to the dense overload of `initialize()`:
+ *
+ * ```cpp
+ * auto nn = qdtsne::read_neighbors<int, double>(input);
+ * auto status = qdtsne::initialize<2>(nn.num_points, nn.num_neighbors, nn.indices.data(), nn.distances.data(), opt);
+ * ```
+ *
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type for the distances.
+ *
+ * @param input Stream to read from, opened in binary mode.
+ *
+ * @return Neighbors for all observations.
+ */
+template<typename Index_, typename Float_>
+NeighborMatrix<Index_, Float_> read_neighbors(std::istream& input) {
+    NeighborFileReader<Index_, Float_> reader(input);
+    NeighborMatrix<Index_, Float_> output;
+    output.num_points = reader.num_observations();
+    output.num_neighbors = reader.num_neighbors();
+
+    size_t total = output.num_points * static_cast<size_t>(output.num_neighbors); // cast to avoid overflow.
+    output.indices.resize(total);
+    output.distances.resize(total);
+
+    size_t offset = 0;
+    while (true) {
+        size_t n = reader.read_block(output.indices.data() + offset, output.distances.data() + offset);
+        if (n == 0) {
+            break;
+        }
+        offset += n * static_cast<size_t>(output.num_neighbors);
+    }
+
+    return output;
+}
+
+/**
+ * Overload of `read_neighbors()` that reads from a file.
+ *
+ * @tparam Index_ Integer type for the neighbor indices.
+ * @tparam Float_ Floating-point type for the distances.
+ *
+ * @param path Path to the input file.
+ *
+ * @return Neighbors for all observations.
+ */
+template<typename Index_, typename Float_>
+NeighborMatrix<Index_, Float_> read_neighbors(const std::string& path) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("failed to open '" + path + "' for reading");
+    }
+    return read_neighbors<Index_, Float_>(input);
+}
+
+}
+
+#endif
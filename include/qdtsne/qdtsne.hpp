@@ -8,8 +8,14 @@
  */
 
 #include "Options.hpp"
+#include "allocator.hpp"
 #include "initialize.hpp"
 #include "Status.hpp"
+#include "batch.hpp"
+#include "async.hpp"
+#include "memory.hpp"
+#include "neighbor_file.hpp"
+#include "recorder.hpp"
 #include "utils.hpp"
 
 /**
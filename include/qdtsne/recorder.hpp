@@ -0,0 +1,446 @@
+#ifndef QDTSNE_RECORDER_HPP
+#define QDTSNE_RECORDER_HPP
+
+#include <vector>
+#include <string>
+#include <istream>
+#include <ostream>
+#include <iterator>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+#include "utils.hpp"
+
+/**
+ * @file recorder.hpp
+ * @brief Record the trajectory of the embedding during the t-SNE iterations.
+ */
+
+namespace qdtsne {
+
+/**
+ * @brief Interface for recording the embedding during `Status::run()`.
+ *
+ * @tparam Float_ Floating-point type for the coordinates.
+ *
+ * Instances of subclasses can be attached to a `Status` object with `Status::set_recorder()`.
+ */
+template<typename Float_>
+class Recorder {
+public:
+    /**
+     * @cond
+     */
+    Recorder() = default;
+    Recorder(Recorder&&) = default;
+    Recorder(const Recorder&) = default;
+    Recorder& operator=(Recorder&&) = default;
+    Recorder& operator=(const Recorder&) = default;
+    virtual ~Recorder() = default;
+    /**
+     * @endcond
+     */
+
+    /**
+     * This is called from the thread running `Status::run()`, so it should be fast to avoid slowing down the iterations.
+     *
+     * @param iteration Number of iterations performed so far.
+     * @param Y Pointer to a column-major array of coordinates, see `Status::run()`.
+     * @param num_values Length of the array at `Y`, i.e., the product of the number of dimensions and observations.
+     */
+    virtual void record(int iteration, const Float_* Y, size_t num_values) = 0;
+};
+
+/**
+ * @cond
+ */
+namespace internal {
+
+inline constexpr char trajectory_magic[8] = { 'Q', 'D', 'T', 'S', 'N', 'E', 'T', 'R' };
+inline constexpr uint32_t trajectory_version = 1;
+inline constexpr uint32_t trajectory_half = 1;
+inline constexpr uint32_t trajectory_delta = 2;
+inline constexpr uint16_t max_finite_half = 0x7bff;
+inline constexpr size_t trajectory_header_size = 24;
+
+// IEEE 754 binary16 conversions with round-to-nearest-even, so that we don't
+// depend on compiler support for a half-precision type.
+inline uint16_t float_to_half(float value) {
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mantissa = x & 0x7fffff;
+    int32_t exponent = static_cast<int32_t>((x >> 23) & 0xff);
+
+    if (exponent == 0xff) { // infinity or NaN.
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    }
+
+    int32_t half_exponent = exponent - 127 + 15;
+    if (half_exponent >= 0x1f) {
+        return sign | 0x7c00;
+    }
+
+    if (half_exponent <= 0) { // subnormal or zero in half precision.
+        if (half_exponent < -10) {
+            return sign;
+        }
+        mantissa |= 0x800000;
+        int shift = 14 - half_exponent;
+        uint32_t half_mantissa = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half_mantissa & 1))) {
+            ++half_mantissa;
+        }
+        return sign | half_mantissa;
+    }
+
+    uint32_t half = sign | (static_cast<uint32_t>(half_exponent) << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+        ++half; // carries into the exponent if necessary.
+    }
+    return half;
+}
+
+inline float half_to_float(uint16_t half) {
+    uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+
+    uint32_t x;
+    if (exponent == 0x1f) {
+        x = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent == 0) {
+        if (mantissa == 0) {
+            x = sign;
+        } else {
+            // Normalizing the subnormal value.
+            uint32_t shift = 0;
+            do {
+                ++shift;
+                mantissa <<= 1;
+            } while (!(mantissa & 0x400));
+            x = sign | ((113 - shift) << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    } else {
+        x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+
+    float output;
+    std::memcpy(&output, &x, sizeof(output));
+    return output;
+}
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * @brief Options for the `TrajectoryRecorder`.
+ */
+struct TrajectoryRecorderOptions {
+    /**
+     * Whether to store the coordinates in half precision.
+     * This reduces the size of each snapshot by 2- to 4-fold, at the cost of some precision.
+     */
+    bool half_precision = false;
+
+    /**
+     * Whether to store the difference from the previous snapshot instead of the coordinates themselves.
+     * With `half_precision = true`, this improves the precision of each snapshot as the differences are typically much smaller than the coordinates.
+     * The differences are computed from the decoded values of the previous snapshot, so errors do not accumulate across snapshots.
+     * With `half_precision = true`, differences beyond the half-precision range are clamped to the largest finite value,
+     * and the remainder is carried into the difference for the next snapshot.
+     */
+    bool delta = false;
+};
+
+/**
+ * @brief Snapshot of the embedding at a particular iteration.
+ *
+ * @tparam Float_ Floating-point type for the coordinates.
+ */
+template<typename Float_>
+struct TrajectorySnapshot {
+    /**
+     * Number of iterations performed when the snapshot was recorded.
+     */
+    int iteration;
+
+    /**
+     * Coordinates of the embedding, in the same format as `Y` in `Status::run()`.
+     */
+    std::vector<Float_> coordinates;
+};
+
+/**
+ * @brief Record snapshots of the embedding in a compact binary format.
+ *
+ * The snapshots are either appended to an in-memory buffer or written to a stream, and can be recovered with `decode_trajectory()`.
+ * The recorded data starts with a 24-byte header containing the magic string `QDTSNETR`,
+ * a 32-bit version number, a 32-bit set of flags (1 for half precision, 2 for delta encoding; all other bits are reserved and should be zero),
+ * a 32-bit size of each stored value in bytes and a 32-bit number of values in each snapshot.
+ * Each snapshot consists of a 32-bit iteration number followed by the values.
+ * All values are little-endian, and recording or decoding a trajectory on a big-endian system throws an error.
+ *
+ * @tparam Float_ Floating-point type for the coordinates.
+ */
+template<typename Float_>
+class TrajectoryRecorder final : public Recorder<Float_> {
+public:
+    /**
+     * Record snapshots into an in-memory buffer, see `buffer()`.
+     *
+     * @param num_values Number of values in each snapshot, i.e., the product of the number of dimensions and observations.
+     * @param max_snapshots Expected number of snapshots, used to preallocate the buffer.
+     * More snapshots can be recorded but will require reallocation.
+     * @param options Further options.
+     */
+    TrajectoryRecorder(size_t num_values, size_t max_snapshots, TrajectoryRecorderOptions options = TrajectoryRecorderOptions()) :
+        my_num_values(num_values), my_options(options)
+    {
+        initialize();
+        my_buffer.reserve(internal::trajectory_header_size + max_snapshots * snapshot_size());
+        my_buffer.resize(internal::trajectory_header_size);
+        fill_header(my_buffer.data());
+    }
+
+    /**
+     * Record snapshots into a stream, e.g., a file opened in binary mode.
+     *
+     * @param output Stream to write to.
+     * This should outlive the `TrajectoryRecorder`.
+     * @param num_values Number of values in each snapshot, i.e., the product of the number of dimensions and observations.
+     * @param options Further options.
+     */
+    TrajectoryRecorder(std::ostream& output, size_t num_values, TrajectoryRecorderOptions options = TrajectoryRecorderOptions()) :
+        my_output(&output), my_num_values(num_values), my_options(options)
+    {
+        initialize();
+        my_buffer.resize(std::max(internal::trajectory_header_size, snapshot_size()));
+        fill_header(my_buffer.data());
+        write(internal::trajectory_header_size);
+    }
+
+private:
+    std::ostream* my_output = NULL;
+    size_t my_num_values;
+    TrajectoryRecorderOptions my_options;
+    std::vector<Float_> my_reference;
+    std::vector<unsigned char> my_buffer;
+    size_t my_num_snapshots = 0;
+
+    void initialize() {
+        internal::check_little_endian("trajectories");
+        if (my_num_values > 0xffffffff) {
+            throw std::runtime_error("number of values in each snapshot should fit into a 32-bit unsigned integer");
+        }
+        if (my_options.delta) {
+            my_reference.resize(my_num_values);
+        }
+    }
+
+    size_t value_size() const {
+        return (my_options.half_precision ? sizeof(uint16_t) : sizeof(Float_));
+    }
+
+    size_t snapshot_size() const {
+        return sizeof(int32_t) + my_num_values * value_size();
+    }
+
+    void fill_header(unsigned char* ptr) const {
+        std::copy(std::begin(internal::trajectory_magic), std::end(internal::trajectory_magic), ptr);
+        uint32_t values[4];
+        values[0] = internal::trajectory_version;
+        values[1] = (my_options.half_precision ? internal::trajectory_half : 0) | (my_options.delta ? internal::trajectory_delta : 0);
+        values[2] = value_size();
+        values[3] = my_num_values;
+        std::memcpy(ptr + sizeof(internal::trajectory_magic), values, sizeof(values));
+    }
+
+    void write(size_t nbytes) {
+        my_output->write(reinterpret_cast<const char*>(my_buffer.data()), nbytes);
+        if (!*my_output) {
+            throw std::runtime_error("failed to write the trajectory");
+        }
+    }
+
+public:
+    /**
+     * @cond
+     */
+    void record(int iteration, const Float_* Y, size_t num_values) override {
+        if (num_values != my_num_values) {
+            throw std::runtime_error("inconsistent number of values in the snapshot");
+        }
+
+        unsigned char* ptr;
+        if (my_output) {
+            ptr = my_buffer.data();
+        } else {
+            size_t offset = my_buffer.size();
+            my_buffer.resize(offset + snapshot_size());
+            ptr = my_buffer.data() + offset;
+        }
+
+        int32_t iter = iteration;
+        std::memcpy(ptr, &iter, sizeof(iter));
+        ptr += sizeof(iter);
+
+        for (size_t i = 0; i < my_num_values; ++i) {
+            Float_ value = Y[i];
+            if (my_options.delta) {
+                value -= my_reference[i];
+            }
+
+            if (my_options.half_precision) {
+                uint16_t half = internal::float_to_half(value);
+                if (my_options.delta) {
+                    // An infinite difference would make the reference (and every later snapshot) non-finite,
+                    // so we clamp it and let the next snapshot's difference make up the rest.
+                    if ((half & 0x7fff) == 0x7c00 && std::isfinite(value)) {
+                        half = (half & 0x8000) | internal::max_finite_half;
+                    }
+                    my_reference[i] += internal::half_to_float(half);
+                }
+                std::memcpy(ptr, &half, sizeof(half));
+                ptr += sizeof(half);
+            } else {
+                std::memcpy(ptr, &value, sizeof(value));
+                ptr += sizeof(value);
+                if (my_options.delta) {
+                    my_reference[i] += value;
+                }
+            }
+        }
+
+        if (my_output) {
+            write(snapshot_size());
+        }
+        ++my_num_snapshots;
+    }
+    /**
+     * @endcond
+     */
+
+    /**
+     * @return Recorded data, including the header.
+     * This is only meaningful if the recorder was constructed to store snapshots in memory.
+     */
+    const std::vector<unsigned char>& buffer() const {
+        return my_buffer;
+    }
+
+    /**
+     * @return Number of snapshots recorded so far.
+     */
+    size_t num_snapshots() const {
+        return my_num_snapshots;
+    }
+};
+
+/**
+ * Decode the data recorded by a `TrajectoryRecorder`.
+ *
+ * @tparam Float_ Floating-point type for the coordinates.
+ * This should be the same as that used to record the snapshots.
+ *
+ * @param data Pointer to the recorded data, e.g., from `TrajectoryRecorder::buffer()`.
+ * @param size Length of the array at `data`.
+ *
+ * @return Vector of snapshots in the order in which they were recorded.
+ */
+template<typename Float_>
+std::vector<TrajectorySnapshot<Float_> > decode_trajectory(const unsigned char* data, size_t size) {
+    internal::check_little_endian("trajectories");
+    if (size < internal::trajectory_header_size || !std::equal(std::begin(internal::trajectory_magic), std::end(internal::trajectory_magic), data)) {
+        throw std::runtime_error("input is not a trajectory");
+    }
+
+    uint32_t values[4];
+    std::memcpy(values, data + sizeof(internal::trajectory_magic), sizeof(values));
+    if (values[0] != internal::trajectory_version) {
+        throw std::runtime_error("unsupported version of the trajectory");
+    }
+
+    // Unknown flags may change the layout of the snapshots, so we can't just ignore them.
+    if (values[1] & ~(internal::trajectory_half | internal::trajectory_delta)) {
+        throw std::runtime_error("unknown flags in the trajectory");
+    }
+    bool half_precision = (values[1] & internal::trajectory_half);
+    bool delta = (values[1] & internal::trajectory_delta);
+    if (values[2] != (half_precision ? sizeof(uint16_t) : sizeof(Float_))) {
+        throw std::runtime_error("trajectory was recorded with a different floating-point type");
+    }
+    size_t num_values = values[3];
+    size_t snapshot_size = sizeof(int32_t) + num_values * values[2];
+
+    data += internal::trajectory_header_size;
+    size -= internal::trajectory_header_size;
+    if (size % snapshot_size) {
+        throw std::runtime_error("trajectory contains an incomplete snapshot");
+    }
+
+    std::vector<TrajectorySnapshot<Float_> > output;
+    output.reserve(size / snapshot_size);
+    for (; size; size -= snapshot_size) {
+        output.emplace_back();
+        auto& current = output.back();
+
+        int32_t iteration;
+        std::memcpy(&iteration, data, sizeof(iteration));
+        current.iteration = iteration;
+        data += sizeof(iteration);
+
+        if (delta && output.size() > 1) {
+            current.coordinates = output[output.size() - 2].coordinates;
+        } else {
+            current.coordinates.resize(num_values);
+        }
+
+        for (size_t i = 0; i < num_values; ++i) {
+            Float_ value;
+            if (half_precision) {
+                uint16_t half;
+                std::memcpy(&half, data, sizeof(half));
+                data += sizeof(half);
+                value = internal::half_to_float(half);
+            } else {
+                std::memcpy(&value, data, sizeof(value));
+                data += sizeof(value);
+            }
+
+            if (delta) {
+                current.coordinates[i] += value;
+            } else {
+                current.coordinates[i] = value;
+            }
+        }
+    }
+
+    return output;
+}
+
+/**
+ * Overload of `decode_trajectory()` that reads from a stream.
+ *
+ * @tparam Float_ Floating-point type for the coordinates.
+ *
+ * @param input Stream containing the data written by a `TrajectoryRecorder`, opened in binary mode.
+ *
+ * @return Vector of snapshots in the order in which they were recorded.
+ */
+template<typename Float_>
+std::vector<TrajectorySnapshot<Float_> > decode_trajectory(std::istream& input) {
+    std::vector<unsigned char> contents((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    return decode_trajectory<Float_>(contents.data(), contents.size());
+}
+
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <vector>
 #include <algorithm>
+#include <numeric>
+#include <stdexcept>
 
 #include "utils.hpp"
 
@@ -10,6 +12,68 @@ namespace qdtsne {
 
 namespace internal {
 
+template<typename Index_, typename Float_>
+size_t count_edges(const NeighborList<Index_, Float_>& x) {
+    size_t total = 0;
+    for (const auto& current : x) {
+        total += current.size();
+    }
+    return total;
+}
+
+inline void check_prune_threshold(double threshold) {
+    if (threshold < 0 || threshold >= 1) {
+        throw std::runtime_error("pruning threshold should lie in [0, 1)");
+    }
+}
+
+// Removes all neighbors with probabilities below 'threshold' times the
+// largest probability for each observation. The remaining probabilities are
+// rescaled to sum to unity, consistent with the output of the perplexity
+// calibration. Returns the number of removed edges.
+template<typename Index_, typename Float_>
+size_t prune_matrix(NeighborList<Index_, Float_>& x, Float_ threshold, int num_threads) {
+    check_prune_threshold(threshold);
+    if (threshold == 0) {
+        return 0;
+    }
+
+    size_t before = count_edges(x);
+    parallelize(num_threads, x.size(), [&](int, size_t start, size_t length) -> void {
+        for (size_t i = start, end = start + length; i < end; ++i) {
+            auto& current = x[i];
+            if (current.empty()) {
+                continue;
+            }
+
+            Float_ largest = 0;
+            for (const auto& y : current) {
+                largest = std::max(largest, y.second);
+            }
+
+            const Float_ cutoff = largest * threshold;
+            auto old_size = current.size();
+            current.erase(
+                std::remove_if(current.begin(), current.end(), [&](const auto& y) -> bool { return y.second < cutoff; }),
+                current.end()
+            );
+            if (current.size() < old_size) {
+                current.shrink_to_fit(); // otherwise, pruning doesn't actually save any memory.
+            }
+
+            Float_ remaining = 0;
+            for (const auto& y : current) {
+                remaining += y.second;
+            }
+            for (auto& y : current) {
+                y.second /= remaining;
+            }
+        }
+    });
+
+    return before - count_edges(x);
+}
+
 template<typename Index_, typename Float_>
 void symmetrize_matrix(NeighborList<Index_, Float_>& x) {
     size_t num_points = x.size();
@@ -0,0 +1,291 @@
+#ifndef QDTSNE_TRACE_HPP
+#define QDTSNE_TRACE_HPP
+
+/**
+ * @file trace.hpp
+ * @brief Optional tracing of the t-SNE iterations.
+ *
+ * If the `QDTSNE_TRACE` macro is defined before including any **qdtsne** headers,
+ * each worker in `parallelize()` and each phase of `Status::run()` records a begin/end event.
+ * Phases that are parallelized are recorded separately by each worker, so their events (and counts) are attributed to the threads that did the work.
+ * These can be exported with `dump_trace()` as a Chrome trace, which can be viewed in `chrome://tracing` or Perfetto to inspect the per-worker timelines.
+ * If `QDTSNE_TRACE` is not defined, all tracing hooks compile to nothing.
+ *
+ * If the `QDTSNE_PERF_COUNTERS` macro is defined (which implies `QDTSNE_TRACE`),
+ * each event also records the number of instructions, cache misses and branch misses on the calling thread, using `perf_event_open` on Linux.
+ * This is useful for determining whether each phase is memory- or compute-bound.
+ * Counts are silently omitted if the counters are not available, e.g., on other platforms or if `/proc/sys/kernel/perf_event_paranoid` is too restrictive, and for any event where the counters could not be read.
+ */
+
+#if defined(QDTSNE_PERF_COUNTERS) && !defined(QDTSNE_TRACE)
+#define QDTSNE_TRACE
+#endif
+
+#ifdef QDTSNE_TRACE
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <string>
+#include <ostream>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+#include "PerfCounters.hpp"
+#endif
+
+namespace qdtsne {
+
+#ifdef QDTSNE_TRACE
+/**
+ * @cond
+ */
+namespace internal {
+
+// Index of the worker of the innermost parallelize() call on this thread, or
+// -1 outside of any parallel section. We record this instead of the OS thread
+// as the worker index is what the user can relate to the task ranges.
+inline int& trace_worker() {
+    thread_local int worker = -1;
+    return worker;
+}
+
+class TraceWorkerScope {
+public:
+    TraceWorkerScope(int worker) : my_previous(trace_worker()) {
+        trace_worker() = worker;
+    }
+
+    ~TraceWorkerScope() {
+        trace_worker() = my_previous;
+    }
+
+    TraceWorkerScope(const TraceWorkerScope&) = delete;
+    TraceWorkerScope& operator=(const TraceWorkerScope&) = delete;
+
+private:
+    int my_previous;
+};
+
+struct TraceEvent {
+    const char* name;
+    int thread;
+    double start, duration; // in microseconds.
+    bool has_counters;
+    PerfCounters::Values counters;
+};
+
+class TraceLog {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    double now() const {
+        return std::chrono::duration<double, std::micro>(Clock::now() - my_origin).count();
+    }
+
+    void add(const char* name, double start, double end, bool has_counters, const PerfCounters::Values& counters) {
+        int thread = trace_worker() + 1;
+        std::lock_guard<std::mutex> lock(my_mutex);
+        my_events.push_back(TraceEvent{ name, thread, start, end - start, has_counters, counters });
+    }
+
+    template<class Function_>
+    void visit(Function_ fun) {
+        std::lock_guard<std::mutex> lock(my_mutex);
+        for (const auto& e : my_events) {
+            fun(e);
+        }
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(my_mutex);
+        my_events.clear();
+    }
+
+private:
+    Clock::time_point my_origin = Clock::now();
+    std::mutex my_mutex;
+    std::vector<TraceEvent> my_events;
+};
+
+inline TraceLog& trace_log() {
+    static TraceLog log;
+    return log;
+}
+
+class TraceScope {
+public:
+    TraceScope(const char* name) : my_name(name) {
+#ifdef QDTSNE_PERF_COUNTERS
+        my_has_counters = perf_counters().read(my_counters);
+#endif
+        my_start = trace_log().now();
+    }
+
+    ~TraceScope() {
+        auto& log = trace_log();
+        double end = log.now();
+#ifdef QDTSNE_PERF_COUNTERS
+        // Counts are omitted if either read failed, rather than subtracting
+        // from a zeroed value and wrapping around.
+        PerfCounters::Values current;
+        if (my_has_counters && perf_counters().read(current)) {
+            for (int c = 0; c < PerfCounters::num_counters; ++c) {
+                my_counters[c] = current[c] - my_counters[c];
+            }
+            log.add(my_name, my_start, end, true, my_counters);
+            return;
+        }
+#endif
+        log.add(my_name, my_start, end, false, PerfCounters::Values{});
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* my_name;
+    double my_start;
+#ifdef QDTSNE_PERF_COUNTERS
+    bool my_has_counters;
+    PerfCounters::Values my_counters;
+#endif
+};
+
+}
+/**
+ * @endcond
+ */
+
+/**
+ * Write all events recorded so far in the Chrome trace event format.
+ * Events recorded by worker `w` of `parallelize()` are assigned a thread ID of `w + 1`, while events outside of any parallel section (e.g., each iteration of `Status::run()`) have a thread ID of zero.
+ * For nested sections, the innermost worker index is used, unless that section only has one worker.
+ * Timestamps and durations are reported in microseconds with nanosecond resolution.
+ * This function is only available if the `QDTSNE_TRACE` macro is defined.
+ *
+ * @param output Stream to write the JSON to.
+ */
+inline void dump_trace(std::ostream& output) {
+    auto old_flags = output.flags();
+    auto old_precision = output.precision();
+    output << std::fixed << std::setprecision(3);
+
+    output << "{\"traceEvents\":[";
+    bool first = true;
+    internal::trace_log().visit([&](const internal::TraceEvent& e) -> void {
+        if (!first) {
+            output << ",";
+        }
+        first = false;
+        output << "\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.thread << ",\"ts\":" << e.start << ",\"dur\":" << e.duration;
+        if (e.has_counters) {
+            output << ",\"args\":{";
+            for (int c = 0; c < internal::PerfCounters::num_counters; ++c) {
+                output << (c ? "," : "") << "\"" << internal::PerfCounters::names()[c] << "\":" << e.counters[c];
+            }
+            output << "}";
+        }
+        output << "}";
+    });
+    output << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    output.flags(old_flags);
+    output.precision(old_precision);
+}
+
+/**
+ * Overload of `dump_trace()` that writes to a file.
+ * This function is only available if the `QDTSNE_TRACE` macro is defined.
+ *
+ * @param path Path to the output file.
+ */
+inline void dump_trace(const std::string& path) {
+    std::ofstream output(path);
+    if (!output) {
+        throw std::runtime_error("failed to open '" + path + "' for writing the trace");
+    }
+    dump_trace(output);
+}
+
+/**
+ * Write a summary of all events recorded so far, with one row per event name.
+ * Each row contains the number of events, the total time in milliseconds summed across threads,
+ * and the total hardware counts over all events with counts if `QDTSNE_PERF_COUNTERS` is defined and the counters are available.
+ * This function is only available if the `QDTSNE_TRACE` macro is defined.
+ *
+ * @param output Stream to write the tab-separated summary to.
+ */
+inline void dump_trace_summary(std::ostream& output) {
+    struct Summary {
+        size_t count = 0;
+        double duration = 0;
+        bool has_counters = false;
+        internal::PerfCounters::Values counters{};
+    };
+
+    std::map<std::string, Summary> summaries;
+    internal::trace_log().visit([&](const internal::TraceEvent& e) -> void {
+        auto& current = summaries[e.name];
+        ++current.count;
+        current.duration += e.duration;
+        if (e.has_counters) {
+            current.has_counters = true;
+            for (int c = 0; c < internal::PerfCounters::num_counters; ++c) {
+                current.counters[c] += e.counters[c];
+            }
+        }
+    });
+
+    auto old_flags = output.flags();
+    auto old_precision = output.precision();
+    output << "phase\tcount\ttime_ms";
+    for (auto n : internal::PerfCounters::names()) {
+        output << "\t" << n;
+    }
+    output << "\n";
+
+    for (const auto& s : summaries) {
+        output << s.first << "\t" << s.second.count << "\t" << std::fixed << std::setprecision(3) << s.second.duration / 1000;
+        for (int c = 0; c < internal::PerfCounters::num_counters; ++c) {
+            output << "\t";
+            if (s.second.has_counters) {
+                output << s.second.counters[c];
+            } else {
+                output << "NA";
+            }
+        }
+        output << "\n";
+    }
+
+    output.flags(old_flags);
+    output.precision(old_precision);
+}
+
+/**
+ * Discard all events recorded so far, e.g., to only trace a particular call to `Status::run()`.
+ * This function is only available if the `QDTSNE_TRACE` macro is defined.
+ */
+inline void clear_trace() {
+    internal::trace_log().clear();
+}
+#endif
+
+}
+
+/**
+ * @cond
+ */
+#ifdef QDTSNE_TRACE
+#define QDTSNE_TRACE_CONCAT_INNER(x, y) x##y
+#define QDTSNE_TRACE_CONCAT(x, y) QDTSNE_TRACE_CONCAT_INNER(x, y)
+#define QDTSNE_TRACE_SCOPE(name) ::qdtsne::internal::TraceScope QDTSNE_TRACE_CONCAT(qdtsne_trace_scope_, __LINE__)(name)
+#else
+#define QDTSNE_TRACE_SCOPE(name)
+#endif
+/**
+ * @endcond
+ */
+
+#endif
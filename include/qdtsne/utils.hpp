@@ -10,14 +10,56 @@
 #include <random>
 #include <cmath>
 #include <vector>
+#include <cstdint>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include "aarand/aarand.hpp"
 #include "knncolle/knncolle.hpp"
 
+#include "trace.hpp"
+
 #ifndef QDTSNE_CUSTOM_PARALLEL
 #include "subpar/subpar.hpp"
 #endif
 
+// The precompiled library (see QDTSNE_PRECOMPILED in Status.hpp) is compiled
+// without any of these macros, so defining them in the user's code would give
+// different definitions of the same instantiations in the library and in the
+// user's code. Users who need these macros should link to the header-only
+// qdtsne target instead.
+#if defined(QDTSNE_PRECOMPILED) && (defined(QDTSNE_TRACE) || defined(QDTSNE_CUSTOM_PARALLEL))
+#error "QDTSNE_TRACE, QDTSNE_PERF_COUNTERS and QDTSNE_CUSTOM_PARALLEL cannot be used with the precompiled qdtsne library"
+#endif
+
+/**
+ * @cond
+ */
+// Function multiversioning for the hot kernels, enabled by defining the
+// QDTSNE_MULTIVERSION macro. Each annotated function is compiled for several
+// instruction sets and the best one is chosen at runtime based on the CPU, so
+// portable binaries can still use wide vector instructions. Some of the
+// targets support FMA, so the code should be compiled with -ffp-contract=off
+// to prevent the compiler from contracting multiply-adds, otherwise the
+// results will depend on the chosen version.
+#if defined(QDTSNE_MULTIVERSION) && defined(__x86_64__) && defined(__linux__) && (defined(__clang__) ? (__clang_major__ >= 14) : defined(__GNUC__))
+#define QDTSNE_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define QDTSNE_TARGET_CLONES
+#endif
+/**
+ * @endcond
+ */
+
 namespace qdtsne {
 
 /**
@@ -113,17 +155,195 @@ std::vector<Float_> initialize_random(size_t num_points, int seed = 42) {
  * By default, this is an alias to `subpar::parallelize_range()`.
  * However, if the `QDTSNE_CUSTOM_PARALLEL` function-like macro is defined, it is called instead. 
  * Any user-defined macro should accept the same arguments as `subpar::parallelize_range()`.
+ * If `QDTSNE_TRACE` is defined, each worker records an event for its range of tasks, see `dump_trace()`.
  */
 template<typename Task_, class Run_>
 void parallelize(int num_workers, Task_ num_tasks, Run_ run_task_range) {
+#ifdef QDTSNE_TRACE
+    // A single worker stays on the enclosing worker's timeline.
+    int enclosing = internal::trace_worker();
+    auto run = [&](int w, Task_ start, Task_ length) -> void {
+        internal::TraceWorkerScope worker(num_workers > 1 ? w : enclosing);
+        QDTSNE_TRACE_SCOPE("worker");
+        run_task_range(w, start, length);
+    };
+#else
+    auto& run = run_task_range;
+#endif
+
 #ifndef QDTSNE_CUSTOM_PARALLEL
     // Don't make this nothrow_ = true, there's too many allocations and the
     // derived methods for the nearest neighbors search could do anything...
-    subpar::parallelize(num_workers, num_tasks, std::move(run_task_range));
+    subpar::parallelize(num_workers, num_tasks, std::move(run));
+#else
+    QDTSNE_CUSTOM_PARALLEL(num_workers, num_tasks, run);
+#endif
+}
+
+/**
+ * @cond
+ */
+namespace internal {
+
+// SplitMix64, which is cheap to seed and good enough for picking indices.
+inline uint64_t splitmix64(uint64_t& state) {
+    state += 0x9e3779b97f4a7c15;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+// Our binary formats are little-endian and are read and written with a
+// plain memcpy, so they are only supported on little-endian systems.
+inline void check_little_endian(const char* format) {
+    uint16_t test = 1;
+    unsigned char first;
+    std::memcpy(&first, &test, 1);
+    if (first != 1) {
+        throw std::runtime_error(std::string(format) + " are only supported on little-endian systems");
+    }
+}
+
+// Pins the calling thread to the 'worker'-th CPU in the affinity mask that
+// the thread had before it was first pinned, see Options::pin_threads. The
+// pinning persists for the lifetime of the thread, so a persistent worker only
+// pays for the system call when it is first assigned to a different worker
+// index; unpin_thread() restores the original mask.
+#if defined(__linux__) && defined(_GNU_SOURCE)
+struct ThreadPinState {
+    bool initialized = false;
+    cpu_set_t original;
+    int worker = -1;
+};
+
+inline ThreadPinState& thread_pin_state() {
+    thread_local ThreadPinState state;
+    return state;
+}
+#endif
+
+inline void pin_thread([[maybe_unused]] int worker) {
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    auto& state = thread_pin_state();
+    if (!state.initialized) {
+        if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &state.original) != 0) {
+            return;
+        }
+        state.initialized = true;
+    }
+    if (state.worker == worker) {
+        return;
+    }
+
+    int available = CPU_COUNT(&state.original);
+    if (available == 0) {
+        return;
+    }
+
+    int target = worker % available;
+    for (int c = 0; c < CPU_SETSIZE; ++c) {
+        if (!CPU_ISSET(c, &state.original)) {
+            continue;
+        }
+        if (target == 0) {
+            cpu_set_t pinned;
+            CPU_ZERO(&pinned);
+            CPU_SET(c, &pinned);
+            if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &pinned) == 0) {
+                state.worker = worker;
+            }
+            break;
+        }
+        --target;
+    }
+#endif
+}
+
+inline void unpin_thread() {
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    auto& state = thread_pin_state();
+    if (state.worker >= 0) {
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &state.original);
+        state.worker = -1;
+    }
+#endif
+}
+
+// Restores the original affinity on scope exit if the current thread is the
+// one that created the guard, i.e., the caller of a parallel section that was
+// itself used as a worker. This also covers exceptions thrown by the worker.
+class CallerUnpinGuard {
+public:
+    CallerUnpinGuard(std::thread::id caller) : my_caller(caller) {}
+
+    CallerUnpinGuard(const CallerUnpinGuard&) = delete;
+    CallerUnpinGuard& operator=(const CallerUnpinGuard&) = delete;
+
+    ~CallerUnpinGuard() {
+        if (std::this_thread::get_id() == my_caller) {
+            unpin_thread();
+        }
+    }
+
+private:
+    std::thread::id my_caller;
+};
+
+// Shared pointer that can be loaded and stored concurrently. The free
+// std::atomic_load/atomic_store overloads for shared_ptr are deprecated in
+// C++20 in favor of std::atomic<std::shared_ptr>, so we use the latter when
+// it is available. Moving is not atomic and should only be done when no other
+// thread is accessing either object.
+template<typename Type_>
+class AtomicSharedPtr {
+public:
+    AtomicSharedPtr() = default;
+
+    AtomicSharedPtr(AtomicSharedPtr&& other) noexcept {
+        store(other.load());
+        other.store(nullptr);
+    }
+
+    AtomicSharedPtr& operator=(AtomicSharedPtr&& other) noexcept {
+        if (this != &other) {
+            store(other.load());
+            other.store(nullptr);
+        }
+        return *this;
+    }
+
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    std::shared_ptr<Type_> load() const {
+#ifdef __cpp_lib_atomic_shared_ptr
+        return my_pointer.load();
+#else
+        return std::atomic_load(&my_pointer);
+#endif
+    }
+
+    void store(std::shared_ptr<Type_> ptr) {
+#ifdef __cpp_lib_atomic_shared_ptr
+        my_pointer.store(std::move(ptr));
+#else
+        std::atomic_store(&my_pointer, std::move(ptr));
+#endif
+    }
+
+private:
+#ifdef __cpp_lib_atomic_shared_ptr
+    std::atomic<std::shared_ptr<Type_> > my_pointer;
 #else
-    QDTSNE_CUSTOM_PARALLEL(num_workers, num_tasks, run_task_range);
+    std::shared_ptr<Type_> my_pointer;
 #endif
+};
+
 }
+/**
+ * @endcond
+ */
 
 }
 
@@ -0,0 +1,52 @@
+#include "qdtsne/qdtsne.hpp"
+
+/*
+ * Explicit instantiations for the qdtsne_compiled library. These should be
+ * kept in sync with the 'extern template' declarations in Status.hpp and
+ * gaussian.hpp. As the library is compiled with QDTSNE_MULTIVERSION, the hot
+ * kernels in each instantiation are compiled for several instruction sets and
+ * dispatched at runtime, so a single portable binary can still use
+ * AVX2/AVX-512 if present.
+ *
+ * There is no SPTree<1, double> as 1-dimensional embeddings use the
+ * LineInterpolator instead.
+ */
+
+namespace qdtsne {
+
+namespace internal {
+
+template class SPTree<2, double>;
+template class SPTree<3, double>;
+template class SPTree<2, float>;
+
+template class KdTree<1, double>;
+template class KdTree<2, double>;
+template class KdTree<3, double>;
+template class KdTree<1, float>;
+template class KdTree<2, float>;
+
+template class LineInterpolator<double>;
+template class LineInterpolator<float>;
+
+template class NegativeSampler<1, double>;
+template class NegativeSampler<2, double>;
+template class NegativeSampler<3, double>;
+template class NegativeSampler<2, float>;
+
+template class EdgeSampler<int, double>;
+template class EdgeSampler<int, float>;
+
+template void compute_gaussian_perplexity<true, int, double>(NeighborList<int, double>&, double, int);
+template void compute_gaussian_perplexity<true, int, float>(NeighborList<int, float>&, float, int);
+template NeighborList<int, double> compute_gaussian_perplexity<true, int, double>(size_t, int, const int*, const double*, size_t, size_t, double, int);
+template NeighborList<int, float> compute_gaussian_perplexity<true, int, float>(size_t, int, const int*, const float*, size_t, size_t, float, int);
+
+}
+
+template class Status<1, int, double>;
+template class Status<2, int, double>;
+template class Status<3, int, double>;
+template class Status<2, int, float>;
+
+}
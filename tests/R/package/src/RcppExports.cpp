@@ -11,8 +11,8 @@ Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
 // run_tsne
-Rcpp::NumericMatrix run_tsne(Rcpp::IntegerMatrix indices, Rcpp::NumericMatrix distances, Rcpp::NumericMatrix init, int iter, int max_depth, int lie_iter, int mom_iter, bool leaf_approx, int num_threads);
-RcppExport SEXP _qdtsne_run_tsne(SEXP indicesSEXP, SEXP distancesSEXP, SEXP initSEXP, SEXP iterSEXP, SEXP max_depthSEXP, SEXP lie_iterSEXP, SEXP mom_iterSEXP, SEXP leaf_approxSEXP, SEXP num_threadsSEXP) {
+Rcpp::NumericMatrix run_tsne(Rcpp::IntegerMatrix indices, Rcpp::NumericMatrix distances, Rcpp::NumericMatrix init, int iter, int max_depth, int lie_iter, int mom_iter, bool leaf_approx, int num_threads, bool dense);
+RcppExport SEXP _qdtsne_run_tsne(SEXP indicesSEXP, SEXP distancesSEXP, SEXP initSEXP, SEXP iterSEXP, SEXP max_depthSEXP, SEXP lie_iterSEXP, SEXP mom_iterSEXP, SEXP leaf_approxSEXP, SEXP num_threadsSEXP, SEXP denseSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::traits::input_parameter< Rcpp::IntegerMatrix >::type indices(indicesSEXP);
@@ -24,13 +24,14 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< int >::type mom_iter(mom_iterSEXP);
     Rcpp::traits::input_parameter< bool >::type leaf_approx(leaf_approxSEXP);
     Rcpp::traits::input_parameter< int >::type num_threads(num_threadsSEXP);
-    rcpp_result_gen = Rcpp::wrap(run_tsne(indices, distances, init, iter, max_depth, lie_iter, mom_iter, leaf_approx, num_threads));
+    Rcpp::traits::input_parameter< bool >::type dense(denseSEXP);
+    rcpp_result_gen = Rcpp::wrap(run_tsne(indices, distances, init, iter, max_depth, lie_iter, mom_iter, leaf_approx, num_threads, dense));
     return rcpp_result_gen;
 END_RCPP
 }
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_qdtsne_run_tsne", (DL_FUNC) &_qdtsne_run_tsne, 9},
+    {"_qdtsne_run_tsne", (DL_FUNC) &_qdtsne_run_tsne, 10},
     {NULL, NULL, 0}
 };
 
@@ -13,7 +13,8 @@ Rcpp::NumericMatrix run_tsne(
     int lie_iter,
     int mom_iter,
     bool leaf_approx,
-    int num_threads) 
+    int num_threads,
+    bool dense) 
 {
     qdtsne::Options opt;
     opt.max_iterations = iter;
@@ -24,6 +25,14 @@ Rcpp::NumericMatrix run_tsne(
     opt.num_threads = num_threads;
 
     int nr = indices.nrow(), nc = indices.ncol();
+    Rcpp::NumericMatrix output(Rcpp::transpose(init));
+
+    if (dense) {
+        auto status = qdtsne::initialize<2>(nc, nr, static_cast<const int*>(indices.begin()), static_cast<const double*>(distances.begin()), opt);
+        status.run(static_cast<double*>(output.begin()));
+        return Rcpp::transpose(output);
+    }
+
     qdtsne::NeighborList<int, double> neighbors(nc);
     for (int i = 0; i < nc; ++i) {
         auto icol = indices.column(i);
@@ -33,8 +42,6 @@ Rcpp::NumericMatrix run_tsne(
         }
     }
 
-    Rcpp::NumericMatrix output(Rcpp::transpose(init));
-
     auto status = qdtsne::initialize<2>(std::move(neighbors), opt);
     status.run(static_cast<double*>(output.begin()));
 
@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "qdtsne/EdgeSampler.hpp"
+
+class EdgeSamplerTest : public ::testing::TestWithParam<int> {
+protected:
+    static qdtsne::NeighborList<int, double> simulate(size_t N, int K) {
+        qdtsne::NeighborList<int, double> output(N);
+        std::mt19937_64 rng(N * K);
+        std::uniform_real_distribution<> dist(0, 1);
+        for (size_t i = 0; i < N; ++i) {
+            // Varying the number of neighbors so that some points are not sampled.
+            int num = (i % 3 == 0 ? K / 2 : K);
+            for (int k = 0; k < num; ++k) {
+                output[i].emplace_back((i + k + 1) % N, dist(rng) * dist(rng));
+            }
+        }
+        return output;
+    }
+};
+
+TEST_P(EdgeSamplerTest, Frequencies) {
+    int K = GetParam();
+    size_t N = 20;
+    auto neighbors = simulate(N, K);
+    int nsamples = K / 2;
+    qdtsne::internal::EdgeSampler<int, double> sampler(neighbors, nsamples, 42, 1);
+
+    int niter = 2000;
+    for (size_t i = 0; i < N; ++i) {
+        const auto& current = neighbors[i];
+        if (current.size() <= static_cast<size_t>(nsamples)) {
+            EXPECT_FALSE(sampler.is_sampled(i));
+            continue;
+        }
+        ASSERT_TRUE(sampler.is_sampled(i));
+
+        double total = 0;
+        for (const auto& x : current) {
+            total += x.second;
+        }
+        EXPECT_FLOAT_EQ(sampler.scale(i), total / nsamples);
+
+        std::vector<int> counts(current.size());
+        for (int it = 0; it < niter; ++it) {
+            sampler.sample(i, it, [&](size_t j) -> void {
+                ASSERT_LT(j, current.size());
+                ++counts[j];
+            });
+        }
+
+        double num_draws = static_cast<double>(niter) * nsamples;
+        for (size_t j = 0; j < current.size(); ++j) {
+            double expected = current[j].second / total;
+            EXPECT_NEAR(counts[j] / num_draws, expected, 0.01 + expected * 0.1);
+        }
+    }
+}
+
+TEST_P(EdgeSamplerTest, Reproducible) {
+    int K = GetParam();
+    size_t N = 50;
+    auto neighbors = simulate(N, K);
+    qdtsne::internal::EdgeSampler<int, double> sampler(neighbors, 3, 42, 1);
+    qdtsne::internal::EdgeSampler<int, double> psampler(neighbors, 3, 42, 3);
+
+    auto collect = [&](const qdtsne::internal::EdgeSampler<int, double>& s, size_t i, int it) -> std::vector<size_t> {
+        std::vector<size_t> output;
+        s.sample(i, it, [&](size_t j) -> void { output.push_back(j); });
+        return output;
+    };
+
+    for (size_t i = 0; i < N; ++i) {
+        EXPECT_EQ(collect(sampler, i, 10), collect(psampler, i, 10));
+        EXPECT_EQ(collect(sampler, i, 10).size(), 3);
+    }
+
+    // Different iterations and seeds give different samples.
+    qdtsne::internal::EdgeSampler<int, double> other(neighbors, 3, 1234, 1);
+    int same_iteration = 0, same_seed = 0;
+    for (size_t i = 0; i < N; ++i) {
+        same_iteration += (collect(sampler, i, 10) == collect(sampler, i, 11));
+        same_seed += (collect(sampler, i, 10) == collect(other, i, 10));
+    }
+    EXPECT_LT(same_iteration, N / 2);
+    EXPECT_LT(same_seed, N / 2);
+}
+
+TEST(EdgeSampler, Disabled) {
+    qdtsne::NeighborList<int, double> neighbors(10);
+    for (size_t i = 0; i < 10; ++i) {
+        neighbors[i].emplace_back((i + 1) % 10, 1);
+        neighbors[i].emplace_back((i + 2) % 10, 1);
+    }
+
+    qdtsne::internal::EdgeSampler<int, double> sampler(neighbors, 0, 42, 1);
+    EXPECT_EQ(sampler.memory_usage(), 0);
+    for (size_t i = 0; i < 10; ++i) {
+        EXPECT_FALSE(sampler.is_sampled(i));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    EdgeSampler,
+    EdgeSamplerTest,
+    ::testing::Values(10, 20, 40)
+);
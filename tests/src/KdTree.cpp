@@ -0,0 +1,242 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+#include <cmath>
+
+#include "qdtsne/KdTree.hpp"
+#include "qdtsne/SPTree.hpp"
+
+template<class Store_>
+static int quad_depth(const Store_& store, size_t position = 0) {
+    int depth = 0;
+    for (auto child : store[position].children) {
+        if (child) {
+            depth = std::max(depth, 1 + quad_depth(store, child));
+        }
+    }
+    return depth;
+}
+
+template<class Store_>
+static int max_depth(const Store_& store, size_t position = 0) {
+    const auto& node = store[position];
+    if (node.is_leaf()) {
+        return 0;
+    }
+    return 1 + std::max(max_depth(store, node.left), max_depth(store, node.right));
+}
+
+class KdTreeTest : public ::testing::TestWithParam<std::tuple<int, int, bool> > {
+protected:
+    static constexpr int ndim = 2;
+
+    static double reference_non_edge_forces(const double* point, const double* data, size_t N, double* neg_f) {
+        double resultSum = 0;
+        std::fill_n(neg_f, ndim, 0);
+
+        for (size_t n = 0; n < N; ++n, data += ndim) {
+            if (point == data) {
+                continue;
+            }
+
+            double sqdist = 0;
+            for(int d = 0; d < ndim; d++) {
+                sqdist += (point[d] - data[d]) * (point[d] - data[d]);
+            }
+
+            sqdist = 1.0 / (1.0 + sqdist);
+            double mult = sqdist;
+            resultSum += mult;
+            mult *= sqdist;
+
+            for (int d = 0; d < ndim; ++d) {
+                neg_f[d] += mult * (point[d] - data[d]);
+            }
+        }
+        return resultSum;
+    }
+};
+
+TEST_P(KdTreeTest, CheckTree) {
+    auto param = GetParam();
+    size_t N = std::get<0>(param);
+    int bucket = std::get<1>(param);
+    bool dup = std::get<2>(param);
+
+    std::vector<double> Y(N * ndim);
+    {
+        std::mt19937_64 rng(N * bucket);
+        std::normal_distribution<> dist(0, 1);
+        for (auto& y : Y) {
+            y = dist(rng);
+        }
+    }
+
+    if (dup) {
+        // Adding more duplicates than the bucket size.
+        auto copy = Y;
+        for (int b = 0; b <= bucket; ++b) {
+            Y.insert(Y.end(), copy.begin(), copy.begin() + ndim * 5);
+        }
+        N += static_cast<size_t>(bucket + 1) * 5;
+    }
+
+    qdtsne::internal::KdTree<2, double> tree(N, bucket);
+    tree.set(Y.data());
+
+    // Each node's range is split between its children, and each point is in a
+    // leaf that only exceeds the bucket size if it consists of duplicates.
+    const auto& store = tree.get_store();
+    const auto& locations = tree.get_locations();
+    size_t total = 0;
+    for (const auto& node : store) {
+        if (node.is_leaf()) {
+            total += node.number;
+            if (!dup) {
+                EXPECT_LE(node.number, static_cast<size_t>(bucket));
+            }
+        } else {
+            const auto& left = store[node.left];
+            const auto& right = store[node.right];
+            EXPECT_EQ(left.start, node.start);
+            EXPECT_EQ(right.start, node.start + left.number);
+            EXPECT_EQ(left.number + right.number, node.number);
+            EXPECT_LE(right.number - left.number, 1); // balanced.
+
+            for (int d = 0; d < ndim; ++d) {
+                EXPECT_FLOAT_EQ(node.center_of_mass[d], (left.center_of_mass[d] * left.number + right.center_of_mass[d] * right.number) / node.number);
+            }
+        }
+    }
+    EXPECT_EQ(total, N);
+    for (size_t i = 0; i < N; ++i) {
+        EXPECT_TRUE(store[locations[i]].is_leaf());
+    }
+
+    // Depth is logarithmic in the number of points.
+    EXPECT_LE(max_depth(store), std::ceil(std::log2(static_cast<double>(N))) + 1);
+
+    // Exact with theta = 0.
+    int top = std::min(static_cast<int>(N), 20); // computing just the top set for simplicity.
+    for (int i = 0; i < top; ++i) {
+        std::array<double, 2> neg_f, neg_f_ref;
+        double no_theta = tree.compute_non_edge_forces(i, 0, neg_f.data());
+        double expected = reference_non_edge_forces(Y.data() + i * ndim, Y.data(), N, neg_f_ref.data());
+        EXPECT_FLOAT_EQ(neg_f_ref[0], neg_f[0]);
+        EXPECT_FLOAT_EQ(neg_f_ref[1], neg_f[1]);
+        EXPECT_FLOAT_EQ(no_theta, expected);
+
+        // Approximation is close for non-zero theta.
+        std::array<double, 2> approx;
+        double approx_sum = tree.compute_non_edge_forces(i, 0.5, approx.data());
+        EXPECT_NEAR(approx_sum, expected, expected * 0.05);
+    }
+
+    // Leaf approximation is reproducible in parallel.
+    decltype(tree)::LeafApproxWorkspace workspace1, workspace3;
+    tree.compute_non_edge_forces_for_leaves(0.5, workspace1, 1);
+    tree.compute_non_edge_forces_for_leaves(0.5, workspace3, 3);
+    for (size_t n = 0; n < N; ++n) {
+        std::array<double, 2> serial, parallel;
+        auto serial_sum = tree.compute_non_edge_forces_from_leaves(n, serial.data(), workspace1);
+        auto parallel_sum = tree.compute_non_edge_forces_from_leaves(n, parallel.data(), workspace3);
+        EXPECT_EQ(serial, parallel);
+        EXPECT_EQ(serial_sum, parallel_sum);
+        EXPECT_TRUE(std::isfinite(serial[0]));
+        EXPECT_TRUE(std::isfinite(serial[1]));
+    }
+
+    // With single-point leaves and theta = 0, the leaf approximation is exact.
+    if (bucket == 1) {
+        decltype(tree)::LeafApproxWorkspace workspace;
+        tree.compute_non_edge_forces_for_leaves(0, workspace, 1);
+        for (int i = 0; i < top; ++i) {
+            std::array<double, 2> neg_f, neg_f_ref;
+            double approx_sum = tree.compute_non_edge_forces_from_leaves(i, neg_f.data(), workspace);
+            double expected = reference_non_edge_forces(Y.data() + i * ndim, Y.data(), N, neg_f_ref.data());
+            if (!dup) {
+                EXPECT_FLOAT_EQ(neg_f_ref[0], neg_f[0]);
+                EXPECT_FLOAT_EQ(neg_f_ref[1], neg_f[1]);
+                EXPECT_FLOAT_EQ(approx_sum, expected);
+            }
+        }
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    KdTree,
+    KdTreeTest,
+    ::testing::Combine(
+        ::testing::Values(10, 100, 1000), // number of observations
+        ::testing::Values(1, 4, 16), // bucket size
+        ::testing::Values(false, true) // duplicates
+    )
+);
+
+TEST(KdTree, MaxNodes) {
+    // The node store should be reserved with enough space for the largest
+    // possible tree, so that it is never reallocated during construction.
+    // Odd bucket sizes are the worst case, as a node with 'bucket + 1' points
+    // is split into leaves of roughly half the bucket size.
+    std::mt19937_64 rng(99);
+    std::normal_distribution<> dist(0, 1);
+    for (size_t N = 1; N <= 200; N += 7) {
+        std::vector<double> Y(N * 2);
+        for (auto& y : Y) {
+            y = dist(rng);
+        }
+
+        for (int bucket = 1; bucket <= 9; ++bucket) {
+            qdtsne::internal::KdTree<2, double> tree(N, bucket);
+            tree.set(Y.data());
+            const auto& store = tree.get_store();
+            size_t expected = qdtsne::internal::KdTree<2, double>::max_nodes(N, bucket);
+            EXPECT_LE(store.size(), expected);
+            EXPECT_EQ(store.capacity(), expected) << "N = " << N << ", bucket = " << bucket;
+        }
+    }
+
+    EXPECT_EQ((qdtsne::internal::KdTree<2, double>::max_nodes(0, 4)), 1);
+    EXPECT_EQ((qdtsne::internal::KdTree<2, double>::max_nodes(8, 3)), 7);
+}
+
+TEST(KdTree, Clustered) {
+    // A few tight clusters in a large empty space.
+    size_t N = 5000;
+    std::vector<double> Y(N * 2);
+    std::mt19937_64 rng(N);
+    std::normal_distribution<> dist(0, 1e-3);
+    for (size_t i = 0; i < N; ++i) {
+        Y[i * 2] = dist(rng) + (i % 2 ? 100 : -100);
+        Y[i * 2 + 1] = dist(rng) + (i % 3) * 100;
+    }
+
+    qdtsne::internal::KdTree<2, double> tree(N, 1);
+    tree.set(Y.data());
+    qdtsne::internal::SPTree<2, double> quad(N, 50);
+    quad.set(Y.data());
+
+    // The quadtree needs many levels to separate the clusters and then the
+    // points within each cluster, while the kd-tree stays balanced.
+    int kd_depth = max_depth(tree.get_store());
+    EXPECT_LE(kd_depth, std::ceil(std::log2(static_cast<double>(N))));
+    EXPECT_GT(quad_depth(quad.get_store()), kd_depth * 1.5);
+
+    // Same results as the quadtree when exact.
+    for (size_t i = 0; i < 20; ++i) {
+        std::array<double, 2> kd_f, quad_f;
+        double kd_sum = tree.compute_non_edge_forces(i, 0, kd_f.data());
+        double quad_sum = quad.compute_non_edge_forces(i, 0, quad_f.data());
+        EXPECT_FLOAT_EQ(kd_sum, quad_sum);
+        EXPECT_FLOAT_EQ(kd_f[0], quad_f[0]);
+        EXPECT_FLOAT_EQ(kd_f[1], quad_f[1]);
+    }
+
+    // Re-setting with new coordinates.
+    for (auto& y : Y) {
+        y = dist(rng);
+    }
+    tree.set(Y.data());
+    EXPECT_EQ(tree.get_store().size(), N * 2 - 1);
+}
@@ -0,0 +1,182 @@
+#include <gtest/gtest.h>
+
+#ifdef CUSTOM_PARALLEL_TEST
+// must be before any qdtsne includes.
+#include "custom_parallel.h"
+#endif
+
+#include <random>
+#include <vector>
+#include <cmath>
+
+#include "qdtsne/LineInterpolator.hpp"
+
+class LineInterpolatorTest : public ::testing::TestWithParam<std::tuple<int, double> > {
+protected:
+    // Only used by the fallback when the number of intervals is capped.
+    inline static double theta = 0.5;
+
+    static double reference_non_edge_forces(size_t self, const std::vector<double>& Y, double& neg_f) {
+        double result_sum = 0;
+        neg_f = 0;
+        for (size_t n = 0, N = Y.size(); n < N; ++n) {
+            if (n == self) {
+                continue;
+            }
+            double delta = Y[self] - Y[n];
+            double q = 1.0 / (1.0 + delta * delta);
+            result_sum += q;
+            neg_f += q * q * delta;
+        }
+        return result_sum;
+    }
+};
+
+TEST_P(LineInterpolatorTest, Accuracy) {
+    auto param = GetParam();
+    size_t N = std::get<0>(param);
+    double scale = std::get<1>(param);
+
+    std::vector<double> Y(N);
+    std::mt19937_64 rng(N * scale);
+    std::normal_distribution<> dist(0, scale);
+    for (auto& y : Y) {
+        y = dist(rng);
+    }
+
+    qdtsne::internal::LineInterpolator<double> interp(N);
+    interp.set(Y.data());
+    interp.compute_node_potentials(1);
+
+    double max_sum = 0, max_force = 0;
+    std::vector<double> sums(N), forces(N), ref_sums(N), ref_forces(N);
+    for (size_t i = 0; i < N; ++i) {
+        sums[i] = interp.compute_non_edge_forces(i, theta, forces.data() + i);
+        ref_sums[i] = reference_non_edge_forces(i, Y, ref_forces[i]);
+        max_sum = std::max(max_sum, ref_sums[i]);
+        max_force = std::max(max_force, std::abs(ref_forces[i]));
+    }
+
+    // Error should be small relative to the scale of the forces.
+    for (size_t i = 0; i < N; ++i) {
+        EXPECT_LT(std::abs(sums[i] - ref_sums[i]), max_sum * 1e-3);
+        EXPECT_LT(std::abs(forces[i] - ref_forces[i]), max_force * 1e-3);
+    }
+
+    // Same results in parallel.
+    interp.compute_node_potentials(3);
+    for (size_t i = 0; i < N; ++i) {
+        double pforce;
+        EXPECT_EQ(interp.compute_non_edge_forces(i, theta, &pforce), sums[i]);
+        EXPECT_EQ(pforce, forces[i]);
+    }
+}
+
+TEST_F(LineInterpolatorTest, WideRange) {
+    // Enough nodes that a quadratic node-node pass would be noticeably slow.
+    size_t N = 5000;
+    std::vector<double> Y(N);
+    std::mt19937_64 rng(N);
+    std::normal_distribution<> dist(0, 1000);
+    for (auto& y : Y) {
+        y = dist(rng);
+    }
+
+    qdtsne::internal::LineInterpolator<double> interp(N);
+    interp.set(Y.data());
+    interp.compute_node_potentials(1);
+
+    std::vector<double> sums(N), forces(N), ref_sums(N), ref_forces(N);
+    double max_sum = 0, max_force = 0;
+    for (size_t i = 0; i < N; ++i) {
+        sums[i] = interp.compute_non_edge_forces(i, theta, forces.data() + i);
+        ref_sums[i] = reference_non_edge_forces(i, Y, ref_forces[i]);
+        max_sum = std::max(max_sum, ref_sums[i]);
+        max_force = std::max(max_force, std::abs(ref_forces[i]));
+    }
+
+    for (size_t i = 0; i < N; ++i) {
+        EXPECT_LT(std::abs(sums[i] - ref_sums[i]), max_sum * 1e-3);
+        EXPECT_LT(std::abs(forces[i] - ref_forces[i]), max_force * 1e-3);
+    }
+}
+
+TEST_F(LineInterpolatorTest, CappedIntervals) {
+    size_t N = 1000;
+    std::vector<double> Y(N);
+    std::mt19937_64 rng(N);
+    std::normal_distribution<> dist(0, 20);
+    for (auto& y : Y) {
+        y = dist(rng);
+    }
+
+    std::vector<double> ref_sums(N), ref_forces(N);
+    auto check = [&](const qdtsne::internal::LineInterpolator<double>& interp, double used_theta, double tol) -> void {
+        double max_sum = 0, max_force = 0;
+        for (size_t i = 0; i < N; ++i) {
+            ref_sums[i] = reference_non_edge_forces(i, Y, ref_forces[i]);
+            max_sum = std::max(max_sum, ref_sums[i]);
+            max_force = std::max(max_force, std::abs(ref_forces[i]));
+        }
+        for (size_t i = 0; i < N; ++i) {
+            double force;
+            double sum = interp.compute_non_edge_forces(i, used_theta, &force);
+            EXPECT_LT(std::abs(sum - ref_sums[i]), max_sum * tol);
+            EXPECT_LT(std::abs(force - ref_forces[i]), max_force * tol);
+        }
+    };
+
+    // Too many intervals for the cap, so we fall back to a kd-tree whose error is controlled by theta:
+    // exact at zero, and growing roughly quadratically with theta otherwise.
+    qdtsne::internal::LineInterpolator<double> interp(N, 150);
+    interp.set(Y.data());
+    EXPECT_TRUE(interp.use_fallback());
+    interp.compute_node_potentials(1);
+    check(interp, 0, 1e-8);
+    check(interp, 0.1, 5e-3);
+
+    // Switching back to interpolation once the range is small enough.
+    for (auto& y : Y) {
+        y /= 10;
+    }
+    interp.set(Y.data());
+    EXPECT_FALSE(interp.use_fallback());
+    interp.compute_node_potentials(1);
+    check(interp, theta, 1e-3);
+
+    // A distant outlier does not increase the size of the FFT beyond the default cap,
+    // nor does it compromise the accuracy for the other points.
+    Y.back() = 1e12;
+    qdtsne::internal::LineInterpolator<double> ointerp(N);
+    ointerp.set(Y.data());
+    EXPECT_TRUE(ointerp.use_fallback());
+    ointerp.compute_node_potentials(1);
+    check(ointerp, 0, 1e-8);
+    check(ointerp, 0.1, 5e-3);
+
+    EXPECT_GT(ointerp.memory_usage(), 0);
+    ointerp.release();
+    EXPECT_EQ(ointerp.memory_usage(), 0);
+}
+
+TEST(LineInterpolator, Duplicates) {
+    std::vector<double> Y(10, 1.5);
+    qdtsne::internal::LineInterpolator<double> interp(Y.size());
+    interp.set(Y.data());
+    interp.compute_node_potentials(1);
+
+    for (size_t i = 0; i < Y.size(); ++i) {
+        double force;
+        EXPECT_FLOAT_EQ(interp.compute_non_edge_forces(i, 0.5, &force), 9);
+        EXPECT_NEAR(force, 0, 1e-8);
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    LineInterpolator,
+    LineInterpolatorTest,
+    ::testing::Combine(
+        ::testing::Values(10, 100, 1000), // number of observations
+        ::testing::Values(0.1, 1.0, 20.0) // spread of the points
+    )
+);
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+#include <array>
+
+#include "qdtsne/NegativeSampler.hpp"
+
+class NegativeSamplerTest : public ::testing::TestWithParam<int> {
+protected:
+    static constexpr int ndim = 2;
+
+    static double reference_non_edge_forces(size_t self, const std::vector<double>& Y, double* neg_f) {
+        double result_sum = 0;
+        std::fill_n(neg_f, ndim, 0);
+        size_t N = Y.size() / ndim;
+        const double* point = Y.data() + self * ndim;
+        for (size_t n = 0; n < N; ++n) {
+            if (n == self) {
+                continue;
+            }
+
+            const double* other = Y.data() + n * ndim;
+            double sqdist = 0;
+            for (int d = 0; d < ndim; ++d) {
+                sqdist += (point[d] - other[d]) * (point[d] - other[d]);
+            }
+
+            double q = 1.0 / (1.0 + sqdist);
+            result_sum += q;
+            for (int d = 0; d < ndim; ++d) {
+                neg_f[d] += q * q * (point[d] - other[d]);
+            }
+        }
+        return result_sum;
+    }
+};
+
+TEST_P(NegativeSamplerTest, Unbiased) {
+    size_t N = GetParam();
+    std::vector<double> Y(N * ndim);
+    std::mt19937_64 rng(N);
+    std::normal_distribution<> dist(0, 1);
+    for (auto& y : Y) {
+        y = dist(rng);
+    }
+
+    qdtsne::internal::NegativeSampler<ndim, double> sampler(N, 20, 42);
+    int niter = 500;
+    int top = std::min(static_cast<int>(N), 10);
+    for (int i = 0; i < top; ++i) {
+        double avg_sum = 0;
+        std::array<double, ndim> avg_neg_f{}, neg_f;
+        for (int it = 0; it < niter; ++it) {
+            sampler.set(Y.data(), it);
+            avg_sum += sampler.compute_non_edge_forces(i, neg_f.data());
+            for (int d = 0; d < ndim; ++d) {
+                avg_neg_f[d] += neg_f[d];
+            }
+        }
+
+        std::array<double, ndim> ref_neg_f;
+        double ref_sum = reference_non_edge_forces(i, Y, ref_neg_f.data());
+        EXPECT_LT(std::abs(avg_sum / niter - ref_sum), ref_sum * 0.05);
+        for (int d = 0; d < ndim; ++d) {
+            EXPECT_LT(std::abs(avg_neg_f[d] / niter - ref_neg_f[d]), ref_sum * 0.05);
+        }
+    }
+}
+
+TEST_P(NegativeSamplerTest, Reproducible) {
+    size_t N = GetParam();
+    std::vector<double> Y(N * ndim);
+    std::mt19937_64 rng(N);
+    std::normal_distribution<> dist(0, 1);
+    for (auto& y : Y) {
+        y = dist(rng);
+    }
+
+    // Same results regardless of the order of processing.
+    qdtsne::internal::NegativeSampler<ndim, double> sampler(N, 5, 42);
+    sampler.set(Y.data(), 10);
+    std::vector<double> forward(N * ndim), backward(N * ndim);
+    std::vector<double> forward_sum(N), backward_sum(N);
+    for (size_t i = 0; i < N; ++i) {
+        forward_sum[i] = sampler.compute_non_edge_forces(i, forward.data() + i * ndim);
+    }
+    for (size_t i = N; i > 0; --i) {
+        backward_sum[i - 1] = sampler.compute_non_edge_forces(i - 1, backward.data() + (i - 1) * ndim);
+    }
+    EXPECT_EQ(forward, backward);
+    EXPECT_EQ(forward_sum, backward_sum);
+
+    // Different results in a different iteration.
+    sampler.set(Y.data(), 11);
+    std::vector<double> other(N * ndim);
+    for (size_t i = 0; i < N; ++i) {
+        sampler.compute_non_edge_forces(i, other.data() + i * ndim);
+    }
+    EXPECT_NE(forward, other);
+}
+
+TEST(NegativeSampler, Trivial) {
+    std::vector<double> Y{ 1, 2 };
+    qdtsne::internal::NegativeSampler<2, double> sampler(1, 5, 42);
+    sampler.set(Y.data(), 0);
+    std::array<double, 2> neg_f{ 1, 1 };
+    EXPECT_EQ(sampler.compute_non_edge_forces(0, neg_f.data()), 0);
+    EXPECT_EQ(neg_f[0], 0);
+    EXPECT_EQ(neg_f[1], 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    NegativeSampler,
+    NegativeSamplerTest,
+    ::testing::Values(10, 100, 1000) // number of observations
+);
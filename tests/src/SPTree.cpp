@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include <random>
+#include <limits>
 #include <vector>
 
 #include "qdtsne/SPTree.hpp"
@@ -306,6 +307,112 @@ INSTANTIATE_TEST_SUITE_P(
     )
 );
 
+/******************************************
+ ******************************************
+ ******************************************/
+
+class SPTreeBucketTest : public SPTreeTest {}; // parameters are the number of observations, bucket size and duplicates.
+
+TEST_P(SPTreeBucketTest, CheckTree) {
+    auto param = GetParam();
+    size_t N = std::get<0>(param);
+    int bucket = std::get<1>(param);
+    size_t dup = std::get<2>(param);
+
+    std::vector<double> Y(N * ndim);
+    {
+        std::mt19937_64 rng(N * bucket);
+        std::normal_distribution<> dist(0, 1);
+        for (auto& y : Y) {
+            y = dist(rng);
+        }
+    }
+
+    if (dup) {
+        // Adding more duplicates than the bucket size.
+        auto copy = Y;
+        for (int b = 0; b < bucket; ++b) {
+            Y.insert(Y.end(), copy.begin(), copy.begin() + ndim * 10);
+        }
+        N += static_cast<size_t>(bucket) * 10;
+    }
+
+    qdtsne::internal::SPTree<2, double> ref(N, 20);
+    ref.set(Y.data());
+
+    for (int maxd : { 3, 20 }) {
+        qdtsne::internal::SPTree<2, double> tree(N, maxd, 0, bucket);
+        tree.set(Y.data());
+
+        // Each point is assigned to a leaf, and leaves only contain more points
+        // than the bucket size if they are at the maximum depth or are duplicates.
+        const auto& store = tree.get_store();
+        const auto& locations = tree.get_locations();
+        std::vector<size_t> counts(store.size());
+        for (size_t i = 0; i < N; ++i) {
+            const auto& leaf = store[locations[i]];
+            EXPECT_TRUE(leaf.is_leaf);
+            ++counts[locations[i]];
+        }
+
+        size_t num_leaves = 0, total = 0;
+        for (size_t s = 0; s < store.size(); ++s) {
+            const auto& node = store[s];
+            if (node.is_leaf) {
+                ++num_leaves;
+                total += node.number;
+                EXPECT_EQ(node.number, counts[s]);
+                if (maxd == 20 && !dup) {
+                    EXPECT_LE(node.number, static_cast<size_t>(bucket));
+                }
+            }
+        }
+        EXPECT_EQ(total, N);
+        EXPECT_LE(store.size(), ref.get_store().size());
+
+        // Exact with theta = 0, even when the depth is capped.
+        int top = std::min(static_cast<int>(N), 20); // computing just the top set for simplicity.
+        for (int i = 0; i < top; ++i) {
+            std::array<double, 2> neg_f, neg_f_ref;
+            double no_theta = tree.compute_non_edge_forces(i, 0, neg_f.data());
+            double expected = reference_non_edge_forces(Y.data() + i * ndim, Y.data(), N, neg_f_ref.data());
+            EXPECT_FLOAT_EQ(neg_f_ref[0], neg_f[0]);
+            EXPECT_FLOAT_EQ(neg_f_ref[1], neg_f[1]);
+            EXPECT_FLOAT_EQ(no_theta, expected);
+
+            // Close to the unbucketed tree with a non-zero theta.
+            std::array<double, 2> approx, approx_ref;
+            double approx_sum = tree.compute_non_edge_forces(i, 0.5, approx.data());
+            double approx_ref_sum = ref.compute_non_edge_forces(i, 0.5, approx_ref.data());
+            EXPECT_NEAR(approx_sum, approx_ref_sum, approx_ref_sum * 0.05);
+        }
+
+        // Leaf approximation uses exact interactions within each point's own leaf.
+        decltype(tree)::LeafApproxWorkspace workspace1, workspace3;
+        tree.compute_non_edge_forces_for_leaves(0.5, workspace1, 1);
+        tree.compute_non_edge_forces_for_leaves(0.5, workspace3, 3);
+        for (size_t n = 0; n < N; ++n) {
+            std::array<double, 2> serial, parallel;
+            auto serial_sum = tree.compute_non_edge_forces_from_leaves(n, serial.data(), workspace1);
+            auto parallel_sum = tree.compute_non_edge_forces_from_leaves(n, parallel.data(), workspace3);
+            EXPECT_EQ(serial, parallel);
+            EXPECT_EQ(serial_sum, parallel_sum);
+            EXPECT_TRUE(std::isfinite(serial[0]));
+            EXPECT_TRUE(std::isfinite(serial[1]));
+        }
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    SPTree,
+    SPTreeBucketTest,
+    ::testing::Combine(
+        ::testing::Values(10, 100, 1000), // number of observations
+        ::testing::Values(4, 16), // bucket size
+        ::testing::Values(false, true) // duplicates
+    )
+);
+
 /******************************************
  ******************************************
  ******************************************/
@@ -455,3 +562,152 @@ INSTANTIATE_TEST_SUITE_P(
         ::testing::Values(3, 7, 20) // max depth
     )
 );
+
+/******************************************
+ ******************************************
+ ******************************************/
+
+class SPTreeAutoDepthTest : public ::testing::Test {
+protected:
+    static constexpr int ndim = 2;
+
+    template<class Tree_>
+    static double mean_leaf_occupancy(const Tree_& tree) {
+        size_t num_leaves = 0, num_points = 0;
+        for (const auto& s : tree.get_store()) {
+            if (s.is_leaf) {
+                ++num_leaves;
+                num_points += s.number;
+            }
+        }
+        return static_cast<double>(num_points) / num_leaves;
+    }
+};
+
+TEST_F(SPTreeAutoDepthTest, Uniform) {
+    size_t N = 10000;
+    std::vector<double> Y(N * ndim);
+    std::mt19937_64 rng(N);
+    std::uniform_real_distribution<> dist(-1, 1);
+    for (auto& y : Y) {
+        y = dist(rng);
+    }
+
+    qdtsne::internal::SPTree<2, double> tree(N, 20, 10);
+    tree.set(Y.data());
+    EXPECT_EQ(tree.depth(), 5); // 4^5 leaves for 10000 points is closest to 10 points per leaf.
+    double occupancy = mean_leaf_occupancy(tree);
+    EXPECT_GT(occupancy, 5);
+    EXPECT_LT(occupancy, 20);
+
+    // Stays the same when re-set with the same points.
+    tree.set(Y.data());
+    EXPECT_EQ(tree.depth(), 5);
+
+    // Same as a tree with a fixed depth.
+    qdtsne::internal::SPTree<2, double> ref(N, tree.depth());
+    ref.set(Y.data());
+    EXPECT_EQ(ref.depth(), tree.depth());
+    EXPECT_EQ(ref.get_locations(), tree.get_locations());
+
+    // Capped by the maximum depth.
+    qdtsne::internal::SPTree<2, double> capped(N, 3, 10);
+    capped.set(Y.data());
+    EXPECT_EQ(capped.depth(), 3);
+    capped.set(Y.data());
+    EXPECT_EQ(capped.depth(), 3);
+
+    // Larger occupancies give shallower trees.
+    qdtsne::internal::SPTree<2, double> shallow(N, 20, 100);
+    shallow.set(Y.data());
+    shallow.set(Y.data());
+    EXPECT_LT(shallow.depth(), tree.depth());
+    EXPECT_GT(mean_leaf_occupancy(shallow), occupancy);
+
+    // Ignored if zero.
+    qdtsne::internal::SPTree<2, double> fixed(N, 12);
+    fixed.set(Y.data());
+    fixed.set(Y.data());
+    EXPECT_EQ(fixed.depth(), 12);
+}
+
+TEST_F(SPTreeAutoDepthTest, Clustered) {
+    size_t N = 10000;
+    std::vector<double> Y(N * ndim);
+    std::mt19937_64 rng(N);
+    std::normal_distribution<> dist(0, 0.1);
+    for (size_t i = 0; i < N; ++i) {
+        // Four small clusters at the corners of a large box.
+        Y[i * ndim] = dist(rng) + (i % 2 ? 50 : -50);
+        Y[i * ndim + 1] = dist(rng) + (i % 4 >= 2 ? 50 : -50);
+    }
+
+    // First guess assumes uniformity, so the leaves are too crowded.
+    qdtsne::internal::SPTree<2, double> tree(N, 20, 10);
+    tree.set(Y.data());
+    EXPECT_EQ(tree.depth(), 5);
+    EXPECT_GT(mean_leaf_occupancy(tree), 100);
+
+    // Subsequent calls go deeper to compensate for the empty space.
+    for (int it = 0; it < 3; ++it) {
+        tree.set(Y.data());
+    }
+    EXPECT_GT(tree.depth(), 5);
+    double occupancy = mean_leaf_occupancy(tree);
+    EXPECT_GT(occupancy, 5);
+    EXPECT_LT(occupancy, 20);
+
+    // Same depth if the points are duplicated, given the same cap.
+    std::vector<double> dup(Y.begin(), Y.end());
+    dup.insert(dup.end(), Y.begin(), Y.end());
+    qdtsne::internal::SPTree<2, double> duptree(N * 2, 20, 20);
+    for (int it = 0; it < 4; ++it) {
+        duptree.set(dup.data());
+    }
+    EXPECT_EQ(duptree.depth(), tree.depth());
+
+    // Re-setting with uniform coordinates brings the depth back.
+    std::uniform_real_distribution<> udist(-1, 1);
+    for (auto& y : Y) {
+        y = udist(rng);
+    }
+    tree.set(Y.data());
+    tree.set(Y.data());
+    EXPECT_EQ(tree.depth(), 5);
+}
+
+TEST_F(SPTreeAutoDepthTest, Unbounded) {
+    size_t N = 1000;
+    std::vector<double> Y(N * ndim);
+    std::mt19937_64 rng(N);
+    std::uniform_real_distribution<> dist(-1, 1);
+    for (auto& y : Y) {
+        y = dist(rng);
+    }
+
+    // No overflow or excessive allocation for an effectively unlimited maximum depth.
+    const int limit = std::numeric_limits<int>::max();
+    qdtsne::internal::SPTree<2, double> tree(N, limit, 10);
+    tree.set(Y.data());
+    tree.set(Y.data());
+    qdtsne::internal::SPTree<2, double> ref(N, 20, 10);
+    ref.set(Y.data());
+    ref.set(Y.data());
+    EXPECT_EQ(tree.depth(), ref.depth());
+
+    qdtsne::internal::SPTree<2, double> fixed(N, limit);
+    fixed.set(Y.data());
+    EXPECT_EQ(fixed.depth(), limit);
+
+    // Near-duplicates keep pushing the extrapolated depth deeper, but it
+    // should stop at a sensible limit.
+    for (size_t i = 0; i < N; ++i) {
+        Y[i * ndim] = 1 + std::numeric_limits<double>::epsilon() * (i % 2);
+        Y[i * ndim + 1] = -1;
+    }
+    for (int it = 0; it < 10; ++it) {
+        tree.set(Y.data());
+    }
+    EXPECT_LE(tree.depth(), std::numeric_limits<double>::digits);
+    EXPECT_EQ(tree.get_locations().size(), N);
+}
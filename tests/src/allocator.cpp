@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+#include <cstdint>
+
+#include "knncolle/knncolle.hpp"
+
+#include "qdtsne/qdtsne.hpp"
+
+TEST(HugePageAllocator, Small) {
+    std::vector<double, qdtsne::HugePageAllocator<double> > x(100);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(x.data()) % 64, 0);
+    for (size_t i = 0; i < x.size(); ++i) {
+        x[i] = i;
+    }
+    EXPECT_EQ(x.back(), 99);
+
+    x.resize(1000, 1);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(x.data()) % 64, 0);
+    EXPECT_EQ(x[99], 99);
+    EXPECT_EQ(x.back(), 1);
+}
+
+TEST(HugePageAllocator, Large) {
+    size_t n = 1000000; // just under 8 MiB, not a multiple of the huge page size.
+    std::vector<double, qdtsne::HugePageAllocator<double> > x(n);
+#ifdef __linux__
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(x.data()) % qdtsne::internal::huge_page_size, 0);
+#else
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(x.data()) % 64, 0);
+#endif
+
+    for (size_t i = 0; i < n; ++i) {
+        x[i] = i;
+    }
+    EXPECT_EQ(x.front(), 0);
+    EXPECT_EQ(x.back(), n - 1);
+
+    // Checking that we can reallocate across the threshold.
+    x.resize(n * 2, 1);
+    EXPECT_EQ(x[n - 1], n - 1);
+    x.resize(10);
+    x.shrink_to_fit();
+    EXPECT_EQ(x.back(), 9);
+}
+
+TEST(HugePageAllocator, Rebind) {
+    typedef std::allocator_traits<qdtsne::HugePageAllocator<double> >::rebind_alloc<float> Rebound;
+    std::vector<float, Rebound> x(10, 1);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(x.data()) % 64, 0);
+    EXPECT_EQ(x.back(), 1);
+
+    EXPECT_TRUE(qdtsne::HugePageAllocator<double>() == Rebound());
+    EXPECT_FALSE(qdtsne::HugePageAllocator<double>() != Rebound());
+}
+
+TEST(HugePageAllocator, Status) {
+    int ndim = 5, nobs = 500;
+    std::vector<double> X(ndim * nobs);
+    std::mt19937_64 rng(42);
+    std::normal_distribution<> dist(0, 1);
+    for (auto& y : X) {
+        y = dist(rng);
+    }
+
+    qdtsne::Options opt;
+    opt.perplexity = 10;
+    opt.max_iterations = 200;
+    auto index = knncolle::VptreeBuilder().build_unique(knncolle::SimpleMatrix(ndim, nobs, X.data()));
+
+    auto ref_status = qdtsne::initialize<2>(*index, opt);
+    auto ref = qdtsne::initialize_random<2>(nobs, 10);
+    ref_status.run(ref.data());
+
+    auto status = qdtsne::initialize<2, int, int, double, qdtsne::HugePageAllocator<double> >(*index, opt);
+    auto Y = qdtsne::initialize_random<2>(nobs, 10);
+    status.run(Y.data());
+    EXPECT_EQ(ref, Y);
+
+    // Same for the low-memory mode, which uses the rebound allocator for the gains.
+    opt.low_memory = true;
+    auto ref_low = qdtsne::initialize<2>(*index, opt);
+    auto refl = qdtsne::initialize_random<2>(nobs, 10);
+    ref_low.run(refl.data());
+
+    auto status_low = qdtsne::initialize<2, int, int, double, qdtsne::HugePageAllocator<double> >(*index, opt);
+    auto Yl = qdtsne::initialize_random<2>(nobs, 10);
+    status_low.run(Yl.data());
+    EXPECT_EQ(refl, Yl);
+}
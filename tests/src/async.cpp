@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+
+#ifdef CUSTOM_PARALLEL_TEST
+// must be before any qdtsne includes.
+#include "custom_parallel.h"
+#endif
+
+#include <random>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <functional>
+
+#include "knncolle/knncolle.hpp"
+
+#include "qdtsne/qdtsne.hpp"
+
+class AsyncTest : public ::testing::Test {
+protected:
+    static constexpr int nobs = 300;
+
+    static qdtsne::NeighborList<int, double> simulate() {
+        int ndim = 5;
+        std::vector<double> X(ndim * nobs);
+        std::mt19937_64 rng(nobs);
+        std::normal_distribution<> dist(0, 1);
+        for (auto& y : X) {
+            y = dist(rng);
+        }
+
+        auto index = knncolle::VptreeBuilder().build_unique(knncolle::SimpleMatrix(ndim, nobs, X.data()));
+        return knncolle::find_nearest_neighbors(*index, 30);
+    }
+};
+
+TEST_F(AsyncTest, Basic) {
+    auto neighbors = simulate();
+    qdtsne::Options opt;
+    opt.max_iterations = 200;
+    opt.num_threads = 2;
+
+    auto ref_status = qdtsne::initialize<2>(neighbors, opt);
+    auto ref = qdtsne::initialize_random<2>(nobs);
+    auto Y = ref;
+    ref_status.run(ref.data());
+
+    auto status = qdtsne::initialize<2>(neighbors, opt);
+    auto handle = qdtsne::run_async(status, Y.data(), 200);
+    EXPECT_TRUE(handle.wait());
+    EXPECT_TRUE(handle.done());
+    EXPECT_EQ(handle.iteration(), 200);
+    EXPECT_EQ(status.iteration(), 200);
+    EXPECT_EQ(Y, ref);
+
+    EXPECT_ANY_THROW(handle.wait());
+}
+
+TEST_F(AsyncTest, Cancel) {
+    auto neighbors = simulate();
+    qdtsne::Options opt;
+    opt.max_iterations = 500;
+
+    auto ref_status = qdtsne::initialize<2>(neighbors, opt);
+    auto ref = qdtsne::initialize_random<2>(nobs);
+    auto Y = ref;
+    ref_status.run(ref.data());
+
+    auto status = qdtsne::initialize<2>(neighbors, opt);
+    {
+        auto handle = qdtsne::run_async(status, Y.data(), 500);
+        while (handle.iteration() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        handle.cancel();
+        EXPECT_FALSE(handle.wait());
+        EXPECT_TRUE(handle.done());
+        EXPECT_GT(status.iteration(), 0);
+        EXPECT_LT(status.iteration(), 500);
+        EXPECT_EQ(handle.iteration(), status.iteration());
+    }
+
+    // Destroying the handle cancels the run and waits for it to stop.
+    {
+        auto handle = qdtsne::run_async(status, Y.data(), 500);
+    }
+    EXPECT_LT(status.iteration(), 500);
+
+    // Resuming gives the same results as an uninterrupted run.
+    auto handle = qdtsne::run_async(status, Y.data(), 500);
+    EXPECT_TRUE(handle.wait());
+    EXPECT_EQ(Y, ref);
+}
+
+TEST_F(AsyncTest, Executor) {
+    auto neighbors = simulate();
+    qdtsne::Options opt;
+    opt.max_iterations = 200;
+
+    auto ref_status = qdtsne::initialize<2>(neighbors, opt);
+    auto ref = qdtsne::initialize_random<2>(nobs);
+    ref_status.run(ref.data());
+
+    // Running the job on an existing thread.
+    {
+        auto status = qdtsne::initialize<2>(neighbors, opt);
+        auto Y = qdtsne::initialize_random<2>(nobs);
+        std::function<void()> job;
+        auto handle = qdtsne::run_async(status, Y.data(), 200, [&](std::function<void()> f) -> void { job = std::move(f); });
+        EXPECT_FALSE(handle.done());
+        EXPECT_EQ(handle.iteration(), 0);
+
+        std::thread worker(job);
+        EXPECT_TRUE(handle.wait());
+        worker.join();
+        EXPECT_EQ(handle.iteration(), 200);
+        EXPECT_EQ(Y, ref);
+    }
+
+    // Running the job inline.
+    {
+        auto status = qdtsne::initialize<2>(neighbors, opt);
+        auto Y = qdtsne::initialize_random<2>(nobs);
+        auto handle = qdtsne::run_async(status, Y.data(), 200, [](std::function<void()> f) -> void { f(); });
+        EXPECT_TRUE(handle.done());
+        EXPECT_TRUE(handle.wait());
+        EXPECT_EQ(Y, ref);
+    }
+
+    // Discarding the job without running it.
+    {
+        auto status = qdtsne::initialize<2>(neighbors, opt);
+        auto Y = qdtsne::initialize_random<2>(nobs);
+        auto original = Y;
+        auto handle = qdtsne::run_async(status, Y.data(), 200, [](std::function<void()>) -> void {});
+        EXPECT_TRUE(handle.done());
+        EXPECT_THROW(handle.wait(), std::runtime_error);
+        EXPECT_EQ(status.iteration(), 0);
+        EXPECT_EQ(Y, original);
+    }
+}
+
+TEST_F(AsyncTest, Moved) {
+    auto neighbors = simulate();
+    qdtsne::Options opt;
+    opt.max_iterations = 50;
+
+    auto status = qdtsne::initialize<2>(neighbors, opt);
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    auto original = qdtsne::run_async(status, Y.data(), 50);
+    std::vector<qdtsne::AsyncRun> handles;
+    handles.push_back(std::move(original));
+
+    EXPECT_TRUE(original.done());
+    original.cancel();
+    EXPECT_ANY_THROW(original.iteration());
+    EXPECT_ANY_THROW(original.wait());
+
+    EXPECT_TRUE(handles.front().wait());
+    EXPECT_EQ(handles.front().iteration(), 50);
+}
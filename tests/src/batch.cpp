@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#ifdef CUSTOM_PARALLEL_TEST
+// must be before any qdtsne includes.
+#include "custom_parallel.h"
+#endif
+
+#include <random>
+#include <vector>
+
+#include "knncolle/knncolle.hpp"
+
+#include "qdtsne/batch.hpp"
+
+class BatchTest : public ::testing::Test {
+protected:
+    static qdtsne::NeighborList<int, double> simulate(int nobs, int seed) {
+        int ndim = 5;
+        std::vector<double> X(ndim * nobs);
+        std::mt19937_64 rng(seed);
+        std::normal_distribution<> dist(0, 1);
+        for (auto& y : X) {
+            y = dist(rng);
+        }
+
+        auto index = knncolle::VptreeBuilder().build_unique(knncolle::SimpleMatrix(ndim, nobs, X.data()));
+        return knncolle::find_nearest_neighbors(*index, 30);
+    }
+};
+
+TEST_F(BatchTest, Basic) {
+    std::vector<int> sizes{ 50, 200, 100, 150, 80 };
+    std::vector<qdtsne::NeighborList<int, double> > neighbors;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        neighbors.push_back(simulate(sizes[i], i));
+    }
+
+    qdtsne::Options opt;
+    opt.max_iterations = 200;
+    opt.num_threads = 3;
+    auto statuses = qdtsne::initialize_batch<2>(neighbors, opt);
+    EXPECT_EQ(statuses.size(), sizes.size());
+
+    std::vector<std::vector<double> > embeddings;
+    std::vector<double*> ptrs;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        embeddings.push_back(qdtsne::initialize_random<2>(sizes[i], i));
+    }
+    for (auto& e : embeddings) {
+        ptrs.push_back(e.data());
+    }
+    auto original = embeddings;
+    qdtsne::run_batch(statuses, ptrs, 100, opt.num_threads);
+    qdtsne::run_batch(statuses, ptrs, opt.num_threads);
+
+    // Same results as running each dataset separately.
+    opt.num_threads = 1;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        EXPECT_EQ(statuses[i].num_observations(), sizes[i]);
+        EXPECT_EQ(statuses[i].iteration(), 200);
+
+        auto ref = qdtsne::initialize<2>(neighbors[i], opt);
+        auto copy = original[i];
+        ref.run(copy.data());
+        EXPECT_EQ(copy, embeddings[i]);
+    }
+
+    ptrs.pop_back();
+    EXPECT_ANY_THROW(qdtsne::run_batch(statuses, ptrs, opt.num_threads));
+}
+
+TEST_F(BatchTest, Empty) {
+    std::vector<qdtsne::NeighborList<int, double> > neighbors;
+    auto statuses = qdtsne::initialize_batch<2>(neighbors, qdtsne::Options());
+    EXPECT_TRUE(statuses.empty());
+    std::vector<double*> ptrs;
+    qdtsne::run_batch(statuses, ptrs, 2);
+}
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+class CliTest : public ::testing::Test {
+protected:
+    static constexpr int nobs = 100;
+    static constexpr int K = 10;
+
+    std::string indices_path, distances_path, output_path, log_path;
+    std::vector<int32_t> indices;
+    std::vector<double> distances;
+
+    void SetUp() {
+        // Unique names per test, as ctest may run them in parallel.
+        std::string prefix = ::testing::TempDir() + "qdtsne_cli_" + ::testing::UnitTest::GetInstance()->current_test_info()->name();
+        indices_path = prefix + "_indices.bin";
+        distances_path = prefix + "_distances.bin";
+        output_path = prefix + "_output.bin";
+        log_path = prefix + "_log.txt";
+
+        std::mt19937_64 rng(42);
+        std::uniform_int_distribution<int32_t> pick(0, nobs - 1);
+        std::uniform_real_distribution<double> dist(0.5, 1.5);
+        indices.reserve(nobs * K);
+        distances.reserve(nobs * K);
+        for (int i = 0; i < nobs; ++i) {
+            double last = 0;
+            for (int k = 0; k < K; ++k) {
+                int32_t candidate = pick(rng);
+                while (candidate == i) {
+                    candidate = pick(rng);
+                }
+                indices.push_back(candidate);
+                last += dist(rng);
+                distances.push_back(last);
+            }
+        }
+    }
+
+    void dump() const {
+        std::ofstream ihandle(indices_path, std::ios::binary);
+        ihandle.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(int32_t));
+        std::ofstream dhandle(distances_path, std::ios::binary);
+        dhandle.write(reinterpret_cast<const char*>(distances.data()), distances.size() * sizeof(double));
+    }
+
+    int run(const std::string& args) const {
+        std::string command = std::string("\"") + CLI_EXECUTABLE + "\" " + args + " 2>\"" + log_path + "\"";
+        return std::system(command.c_str());
+    }
+
+    std::string log() const {
+        std::ifstream handle(log_path);
+        return std::string(std::istreambuf_iterator<char>(handle), std::istreambuf_iterator<char>());
+    }
+
+    std::string knn_args() const {
+        return "--knn-indices \"" + indices_path + "\" --knn-distances \"" + distances_path + "\" --k " + std::to_string(K) +
+            " --output \"" + output_path + "\" --perplexity 3 --max-iterations 50";
+    }
+};
+
+TEST_F(CliTest, Basic) {
+    dump();
+    ASSERT_EQ(run(knn_args()), 0);
+
+    std::vector<double> embedding(nobs * 2);
+    std::ifstream handle(output_path, std::ios::binary);
+    handle.read(reinterpret_cast<char*>(embedding.data()), embedding.size() * sizeof(double));
+    ASSERT_TRUE(handle);
+    EXPECT_EQ(handle.peek(), std::ifstream::traits_type::eof());
+    for (auto x : embedding) {
+        EXPECT_TRUE(std::isfinite(x));
+    }
+}
+
+TEST_F(CliTest, InvalidArguments) {
+    dump();
+    EXPECT_NE(run(knn_args() + " --not-a-flag 1"), 0);
+    EXPECT_NE(log().find("unknown flag"), std::string::npos);
+    EXPECT_NE(run(knn_args() + " --max-iterations 10x"), 0);
+    EXPECT_NE(log().find("invalid value"), std::string::npos);
+    EXPECT_NE(run("--output \"" + output_path + "\""), 0);
+}
+
+TEST_F(CliTest, OutOfRangeIndices) {
+    indices[5] = nobs;
+    dump();
+    EXPECT_NE(run(knn_args()), 0);
+    EXPECT_NE(log().find("neighbor indices should lie in [0, num_points)"), std::string::npos);
+
+    indices[5] = -1;
+    dump();
+    EXPECT_NE(run(knn_args()), 0);
+    EXPECT_NE(log().find("neighbor indices should lie in [0, num_points)"), std::string::npos);
+}
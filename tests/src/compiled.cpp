@@ -0,0 +1,25 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "compiled_reference.h"
+
+// The precompiled library should give exactly the same results as the
+// header-only library, regardless of the instruction set chosen at runtime.
+TEST(CompiledLibrary, SameAsHeaderOnly) {
+    std::string path = ::testing::TempDir() + "qdtsne_compiled_reference.bin";
+    std::string command = std::string("\"") + COMPILED_REFERENCE_EXECUTABLE + "\" \"" + path + "\"";
+    ASSERT_EQ(std::system(command.c_str()), 0);
+
+    auto observed = compiled_reference_embeddings();
+    std::vector<double> expected(observed.size());
+    std::ifstream handle(path, std::ios::binary);
+    handle.read(reinterpret_cast<char*>(expected.data()), expected.size() * sizeof(double));
+    ASSERT_TRUE(handle);
+    EXPECT_EQ(handle.peek(), std::ifstream::traits_type::eof());
+
+    EXPECT_EQ(observed, expected);
+}
@@ -0,0 +1,18 @@
+#include <fstream>
+#include <iostream>
+
+#include "compiled_reference.h"
+
+// Header-only counterpart of the compiledtest, which writes the reference
+// embeddings to the file named by the first argument.
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::cerr << "usage: compiled_reference OUTPUT" << std::endl;
+        return 1;
+    }
+
+    auto output = compiled_reference_embeddings();
+    std::ofstream handle(argv[1], std::ios::binary);
+    handle.write(reinterpret_cast<const char*>(output.data()), output.size() * sizeof(double));
+    return handle ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+#ifndef COMPILED_REFERENCE_H
+#define COMPILED_REFERENCE_H
+
+#include <random>
+#include <vector>
+
+#include "knncolle/knncolle.hpp"
+#include "qdtsne/qdtsne.hpp"
+
+// Runs t-SNE for the precompiled instantiations with a variety of options,
+// and concatenates all of the resulting embeddings. This is compiled both
+// into the compiledtest (using the qdtsne_compiled library) and into a
+// header-only executable, so that we can check that the results are the same.
+struct CompiledReferenceNeighbors {
+    size_t num_points;
+    int num_neighbors;
+    std::vector<int> indices;
+    std::vector<double> distances;
+};
+
+template<int num_dim_, typename Float_>
+void append_compiled_reference(const CompiledReferenceNeighbors& nn, const qdtsne::Options& opt, std::vector<double>& output) {
+    std::vector<Float_> distances(nn.distances.begin(), nn.distances.end());
+    auto status = qdtsne::initialize<num_dim_>(nn.num_points, nn.num_neighbors, nn.indices.data(), distances.data(), opt);
+    auto Y = qdtsne::initialize_random<num_dim_, Float_>(nn.num_points, 42);
+    status.run(Y.data());
+    output.insert(output.end(), Y.begin(), Y.end());
+}
+
+inline std::vector<double> compiled_reference_embeddings() {
+    int ndim = 5, nobs = 500, K = 30;
+    std::vector<double> X(ndim * nobs);
+    std::mt19937_64 rng(42);
+    std::normal_distribution<> dist(0, 1);
+    for (auto& x : X) {
+        x = dist(rng);
+    }
+
+    auto index = knncolle::VptreeBuilder().build_unique(knncolle::SimpleMatrix(ndim, nobs, X.data()));
+    auto neighbors = knncolle::find_nearest_neighbors(*index, K);
+    CompiledReferenceNeighbors nn{ static_cast<size_t>(nobs), K, {}, {} };
+    for (const auto& current : neighbors) {
+        for (const auto& x : current) {
+            nn.indices.push_back(x.first);
+            nn.distances.push_back(x.second);
+        }
+    }
+
+    qdtsne::Options opt;
+    opt.perplexity = 10;
+    opt.max_iterations = 300;
+
+    std::vector<double> output;
+    append_compiled_reference<1, double>(nn, opt, output);
+    append_compiled_reference<2, double>(nn, opt, output);
+    append_compiled_reference<3, double>(nn, opt, output);
+    append_compiled_reference<2, float>(nn, opt, output);
+
+    // Also checking the overload that calibrates the probabilities in place.
+    {
+        auto status = qdtsne::initialize<2>(neighbors, opt);
+        auto Y = qdtsne::initialize_random<2>(nobs, 42);
+        status.run(Y.data());
+        output.insert(output.end(), Y.begin(), Y.end());
+    }
+
+    auto leaf_opt = opt;
+    leaf_opt.leaf_approximation = true;
+    leaf_opt.bucket_size = 8;
+    append_compiled_reference<2, double>(nn, leaf_opt, output);
+
+    auto kd_opt = opt;
+    kd_opt.kd_tree = true;
+    append_compiled_reference<2, double>(nn, kd_opt, output);
+
+    auto sampled_opt = opt;
+    sampled_opt.negative_samples = 20;
+    sampled_opt.edge_samples = 5;
+    append_compiled_reference<2, double>(nn, sampled_opt, output);
+
+    return output;
+}
+
+#endif
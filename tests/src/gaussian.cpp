@@ -154,3 +154,47 @@ TEST(GaussianTest, ConvergenceFailure) {
         }
     }
 }
+
+TEST(GaussianTest, DenseInvalidIndices) {
+    std::vector<int> indices { 1, 2, 0, 2, 0, 1 };
+    std::vector<double> distances { 1, 2, 1, 2, 1, 2 };
+    auto nn = qdtsne::internal::compute_gaussian_perplexity(3, 2, indices.data(), distances.data(), 1, 2, 1.0, 1);
+    EXPECT_EQ(nn.size(), 3);
+
+    for (int bad : { -1, 3 }) {
+        auto copy = indices;
+        copy[4] = bad;
+        try {
+            qdtsne::internal::compute_gaussian_perplexity(3, 2, copy.data(), distances.data(), 1, 2, 1.0, 1);
+            FAIL() << "expected an error";
+        } catch (std::exception& e) {
+            EXPECT_TRUE(std::string(e.what()).find("[0, num_points)") != std::string::npos) << e.what();
+        }
+    }
+
+    // Negative numbers of neighbors should not wrap around to a huge 'K'.
+    try {
+        qdtsne::internal::compute_gaussian_perplexity(3, -1, indices.data(), distances.data(), 1, 2, 1.0, 1);
+        FAIL() << "expected an error";
+    } catch (std::exception& e) {
+        EXPECT_TRUE(std::string(e.what()).find("non-negative") != std::string::npos) << e.what();
+    }
+}
+
+TEST(GaussianTest, DenseStrided) {
+    std::vector<int> indices { 1, 2, 0, 2, 0, 1 };
+    std::vector<double> distances { 1, 2, 1, 2, 1, 2 };
+    auto ref = qdtsne::internal::compute_gaussian_perplexity(3, 2, indices.data(), distances.data(), 1, 2, 1.0, 1);
+
+    // Padding after each observation's neighbors should never be read.
+    std::vector<int> pindices { 1, 2, -1, 0, 2, -1, 0, 1, -1 };
+    std::vector<double> pdistances { 1, 2, -1, 1, 2, -1, 1, 2, -1 };
+    auto padded = qdtsne::internal::compute_gaussian_perplexity(3, 2, pindices.data(), pdistances.data(), 1, 3, 1.0, 1);
+    EXPECT_EQ(ref, padded);
+
+    // Transposed, i.e., one row per observation in column-major order.
+    std::vector<int> tindices { 1, 0, 0, 2, 2, 1 };
+    std::vector<double> tdistances { 1, 1, 1, 2, 2, 2 };
+    auto transposed = qdtsne::internal::compute_gaussian_perplexity(3, 2, tindices.data(), tdistances.data(), 3, 1, 1.0, 1);
+    EXPECT_EQ(ref, transposed);
+}
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "knncolle/knncolle.hpp"
+
+#include "qdtsne/qdtsne.hpp"
+
+class MemoryTest : public ::testing::Test {
+protected:
+    static qdtsne::NeighborList<int, double> simulate(int nobs, int K) {
+        int ndim = 5;
+        std::vector<double> X(ndim * nobs);
+        std::mt19937_64 rng(nobs * K);
+        std::normal_distribution<> dist(0, 1);
+        for (auto& y : X) {
+            y = dist(rng);
+        }
+
+        auto index = knncolle::VptreeBuilder().build_unique(knncolle::SimpleMatrix(ndim, nobs, X.data()));
+        return knncolle::find_nearest_neighbors(*index, K);
+    }
+};
+
+TEST_F(MemoryTest, Estimate) {
+    qdtsne::Options opt;
+    auto ref = qdtsne::estimate_memory<2, int, double>(1000, 30, opt);
+    EXPECT_GT(ref.initialization.total(), 0);
+    EXPECT_GT(ref.iteration.total(), 0);
+    EXPECT_EQ(ref.peak(), std::max(ref.initialization.total(), ref.iteration.total()));
+    EXPECT_EQ(ref.iteration.buffers, 1000 * 2 * 4 * sizeof(double));
+    EXPECT_EQ(ref.iteration.workspace, 0);
+
+    // Scales with the number of observations and neighbors.
+    auto bigger = qdtsne::estimate_memory<2, int, double>(2000, 30, opt);
+    EXPECT_EQ(bigger.iteration.buffers, ref.iteration.buffers * 2);
+    EXPECT_EQ(bigger.iteration.neighbors, ref.iteration.neighbors * 2);
+    auto more = qdtsne::estimate_memory<2, int, double>(1000, 60, opt);
+    EXPECT_GT(more.iteration.neighbors, ref.iteration.neighbors);
+    EXPECT_EQ(more.iteration.buffers, ref.iteration.buffers);
+
+    // Options that require more workspace.
+    opt.num_threads = 2;
+    opt.leaf_approximation = true;
+    opt.publish_interval = 10;
+    auto extra = qdtsne::estimate_memory<2, int, double>(1000, 30, opt);
+    EXPECT_GT(extra.iteration.workspace, 0);
+    EXPECT_EQ(extra.iteration.buffers, ref.iteration.buffers);
+    EXPECT_EQ(extra.iteration.tree, ref.iteration.tree);
+
+    // No tree for 1-dimensional embeddings.
+    auto line = qdtsne::estimate_memory<1, int, double>(1000, 30, qdtsne::Options());
+    EXPECT_EQ(line.iteration.tree, 0);
+}
+
+TEST_F(MemoryTest, Status) {
+    int nobs = 500, K = 15;
+    qdtsne::Options opt;
+    opt.leaf_approximation = true;
+    opt.num_threads = 2;
+    opt.publish_interval = 5;
+
+    auto status = qdtsne::initialize<2>(simulate(nobs, K), opt);
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    status.run(Y.data(), 20);
+
+    auto used = status.memory_usage();
+    auto expected = qdtsne::estimate_memory<2, int, double>(nobs, K, opt);
+    EXPECT_EQ(used.buffers, expected.iteration.buffers);
+    EXPECT_GT(used.neighbors, 0);
+    EXPECT_GT(used.tree, 0);
+    EXPECT_GT(used.workspace, 0);
+
+    // Estimates should be in the right ballpark.
+    EXPECT_LT(used.total(), expected.iteration.total() * 1.5);
+    EXPECT_GT(used.total(), expected.iteration.total() * 0.5);
+}
+
+TEST_F(MemoryTest, NegativeSampling) {
+    int nobs = 500, K = 15;
+    qdtsne::Options opt;
+    opt.negative_samples = 5;
+
+    // No tree is needed with negative sampling, so none should be allocated.
+    auto expected = qdtsne::estimate_memory<2, int, double>(nobs, K, opt);
+    EXPECT_EQ(expected.iteration.tree, 0);
+
+    auto status = qdtsne::initialize<2>(simulate(nobs, K), opt);
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    status.run(Y.data(), 5);
+    EXPECT_EQ(status.memory_usage().tree, 0);
+}
@@ -0,0 +1,280 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <limits>
+#include <cstring>
+#include <array>
+
+#include "knncolle/knncolle.hpp"
+
+#include "qdtsne/neighbor_file.hpp"
+#include "qdtsne/initialize.hpp"
+
+class NeighborFileTest : public ::testing::TestWithParam<bool> {
+protected:
+    inline static int ndim = 5;
+    inline static int nobs = 500;
+    inline static int K = 15;
+    inline static std::vector<double> X;
+    inline static qdtsne::NeighborList<int, double> neighbors;
+
+    static void SetUpTestSuite() {
+        X.resize(ndim * nobs);
+        std::mt19937_64 rng(42);
+        std::normal_distribution<> dist(0, 1);
+        for (auto& y : X) {
+            y = dist(rng);
+        }
+
+        auto index = knncolle::VptreeBuilder().build_unique(knncolle::SimpleMatrix(ndim, nobs, X.data()));
+        neighbors = knncolle::find_nearest_neighbors(*index, K);
+    }
+};
+
+TEST_P(NeighborFileTest, RoundTrip) {
+    bool compress = GetParam();
+
+    for (uint32_t block_size : { 1, 7, 65536 }) {
+        std::stringstream buffer;
+        qdtsne::write_neighbors(buffer, neighbors, compress, block_size);
+
+        auto nn = qdtsne::read_neighbors<int, double>(buffer);
+        EXPECT_EQ(nn.num_points, nobs);
+        EXPECT_EQ(nn.num_neighbors, K);
+        for (int i = 0; i < nobs; ++i) {
+            for (int k = 0; k < K; ++k) {
+                size_t offset = static_cast<size_t>(i) * K + k;
+                EXPECT_EQ(nn.indices[offset], neighbors[i][k].first);
+                EXPECT_FLOAT_EQ(nn.distances[offset], neighbors[i][k].second);
+            }
+        }
+
+        // Works with other types.
+        buffer.clear();
+        buffer.seekg(0);
+        auto nnf = qdtsne::read_neighbors<size_t, float>(buffer);
+        EXPECT_EQ(std::vector<size_t>(nn.indices.begin(), nn.indices.end()), nnf.indices);
+        EXPECT_EQ(std::vector<float>(nn.distances.begin(), nn.distances.end()), nnf.distances);
+    }
+}
+
+TEST_P(NeighborFileTest, Streaming) {
+    bool compress = GetParam();
+    std::stringstream buffer;
+    qdtsne::write_neighbors(buffer, neighbors, compress, 64);
+
+    qdtsne::NeighborFileReader<int, double> reader(buffer);
+    EXPECT_EQ(reader.num_observations(), nobs);
+    EXPECT_EQ(reader.num_neighbors(), K);
+    EXPECT_EQ(reader.block_size(), 64);
+
+    std::vector<int> indices(K * reader.block_size());
+    std::vector<double> distances(indices.size());
+    size_t total = 0;
+    while (true) {
+        size_t n = reader.read_block(indices.data(), distances.data());
+        if (n == 0) {
+            break;
+        }
+        EXPECT_LE(n, 64);
+        for (size_t i = 0; i < n; ++i) {
+            EXPECT_EQ(indices[i * K], neighbors[total + i][0].first);
+        }
+        total += n;
+        EXPECT_EQ(reader.position(), total);
+    }
+    EXPECT_EQ(total, nobs);
+}
+
+TEST_P(NeighborFileTest, Initialize) {
+    bool compress = GetParam();
+    std::string path = ::testing::TempDir() + "/qdtsne_neighbors_" + std::to_string(compress) + ".bin";
+    qdtsne::write_neighbors(path, neighbors, compress);
+    auto nn = qdtsne::read_neighbors<int, double>(path);
+
+    qdtsne::Options opt;
+    opt.max_iterations = 100;
+    auto status = qdtsne::initialize<2>(nn.num_points, nn.num_neighbors, nn.indices.data(), nn.distances.data(), opt);
+    EXPECT_EQ(status.num_observations(), nobs);
+
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    status.run(Y.data());
+    for (auto y : Y) {
+        EXPECT_TRUE(std::isfinite(y));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    NeighborFile,
+    NeighborFileTest,
+    ::testing::Values(false, true)
+);
+
+TEST(NeighborFile, Compression) {
+    // Neighbors with nearby indices compress well.
+    int nobs = 1000, K = 10;
+    qdtsne::NeighborList<int, double> neighbors(nobs);
+    for (int i = 0; i < nobs; ++i) {
+        for (int k = 1; k <= K; ++k) {
+            neighbors[i].emplace_back((i + k) % nobs, k);
+        }
+    }
+
+    std::stringstream raw, compressed;
+    qdtsne::write_neighbors(raw, neighbors, false);
+    qdtsne::write_neighbors(compressed, neighbors, true);
+    EXPECT_LT(compressed.str().size(), raw.str().size());
+
+    auto nn = qdtsne::read_neighbors<int, double>(compressed);
+    EXPECT_EQ(nn.indices[0], 1);
+    EXPECT_EQ(nn.indices[static_cast<size_t>(nobs - 1) * K], 0);
+}
+
+TEST(NeighborFile, Errors) {
+    auto expect_error = [](auto fun, const std::string& msg) -> void {
+        try {
+            fun();
+            FAIL() << "expected an error";
+        } catch (std::exception& e) {
+            EXPECT_TRUE(std::string(e.what()).find(msg) != std::string::npos) << e.what();
+        }
+    };
+
+    expect_error([]() {
+        std::stringstream buffer("foobar");
+        qdtsne::read_neighbors<int, double>(buffer);
+    }, "not a neighbor file");
+
+    expect_error([]() {
+        qdtsne::NeighborList<int, double> neighbors(2);
+        neighbors[0].emplace_back(1, 0.5);
+        std::stringstream buffer;
+        qdtsne::write_neighbors(buffer, neighbors);
+    }, "same number of neighbors");
+
+    qdtsne::NeighborList<int, double> neighbors(2);
+    neighbors[0].emplace_back(1, 0.5);
+    neighbors[1].emplace_back(0, 0.5);
+    std::stringstream buffer;
+    qdtsne::write_neighbors(buffer, neighbors);
+    auto full = buffer.str();
+
+    expect_error([&]() {
+        std::stringstream truncated(full.substr(0, full.size() - 1));
+        qdtsne::read_neighbors<int, double>(truncated);
+    }, "unexpected end");
+
+    expect_error([&]() {
+        auto modified = full;
+        int32_t bad = 2;
+        std::memcpy(modified.data() + 32, &bad, sizeof(bad));
+        std::stringstream input(modified);
+        qdtsne::read_neighbors<int, double>(input);
+    }, "out-of-range");
+
+    // Header values are validated before any allocation.
+    auto modify_header = [&](size_t offset, auto value) -> std::string {
+        auto modified = full;
+        std::memcpy(modified.data() + offset, &value, sizeof(value));
+        return modified;
+    };
+
+    expect_error([&]() {
+        std::stringstream input(modify_header(12, static_cast<uint32_t>(2)));
+        qdtsne::read_neighbors<int, double>(input);
+    }, "unknown flags");
+
+    expect_error([&]() {
+        std::stringstream input(modify_header(12, static_cast<uint32_t>(0x80000001)));
+        qdtsne::read_neighbors<int, double>(input);
+    }, "unknown flags");
+
+    expect_error([&]() {
+        std::stringstream input(modify_header(16, static_cast<uint64_t>(1) << 40));
+        qdtsne::read_neighbors<int, double>(input);
+    }, "32-bit");
+
+    expect_error([&]() {
+        std::stringstream input(modify_header(24, std::numeric_limits<uint32_t>::max()));
+        qdtsne::read_neighbors<int, double>(input);
+    }, "less than the number of observations");
+
+    expect_error([&]() {
+        std::stringstream input(modify_header(24, static_cast<uint32_t>(2)));
+        qdtsne::read_neighbors<int, double>(input);
+    }, "less than the number of observations");
+
+    expect_error([&]() {
+        // Plausible header, but the file is far too small.
+        std::stringstream input(modify_header(16, static_cast<uint64_t>(1000000)));
+        qdtsne::read_neighbors<int, double>(input);
+    }, "unexpected end");
+
+    std::stringstream cbuffer;
+    qdtsne::write_neighbors(cbuffer, neighbors, true);
+    expect_error([&]() {
+        auto modified = cbuffer.str();
+        auto nbytes = std::numeric_limits<uint64_t>::max();
+        std::memcpy(modified.data() + 32, &nbytes, sizeof(nbytes));
+        std::stringstream input(modified);
+        qdtsne::read_neighbors<int, double>(input);
+    }, "invalid compressed indices");
+
+    // Crafting compressed blocks for two observations with one neighbor each.
+    auto make_compressed = [&](const std::vector<unsigned char>& bytes) -> std::string {
+        auto modified = cbuffer.str().substr(0, 32);
+        uint64_t nbytes = bytes.size();
+        modified.append(reinterpret_cast<const char*>(&nbytes), sizeof(nbytes));
+        modified.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        std::array<float, 2> distances{ 0.5, 0.5 };
+        modified.append(reinterpret_cast<const char*>(distances.data()), sizeof(distances));
+        return modified;
+    };
+
+    {
+        std::stringstream input(make_compressed({ 0x02, 0x01 }));
+        auto nn = qdtsne::read_neighbors<int, double>(input);
+        EXPECT_EQ(nn.indices, std::vector<int>({ 1, 0 }));
+    }
+
+    expect_error([&]() {
+        // Largest positive difference that can be encoded.
+        std::stringstream input(make_compressed({ 0xfe, 0xff, 0xff, 0xff, 0x0f, 0x01 }));
+        qdtsne::read_neighbors<int, double>(input);
+    }, "out-of-range");
+
+    expect_error([&]() {
+        std::stringstream input(make_compressed({ 0x02, 0x03 }));
+        qdtsne::read_neighbors<int, double>(input);
+    }, "out-of-range");
+
+    expect_error([&]() {
+        // Too many bytes for a 32-bit difference.
+        std::stringstream input(make_compressed({ 0x82, 0x80, 0x80, 0x80, 0x80, 0x00, 0x01 }));
+        qdtsne::read_neighbors<int, double>(input);
+    }, "invalid compressed indices");
+
+    expect_error([&]() {
+        // Value does not fit into 32 bits, even though it only uses 5 bytes.
+        std::stringstream input(make_compressed({ 0xff, 0xff, 0xff, 0xff, 0x1f, 0x01 }));
+        qdtsne::read_neighbors<int, double>(input);
+    }, "invalid compressed indices");
+
+    // Number of observations should fit into the requested index type.
+    qdtsne::NeighborList<int, double> many(300);
+    for (int i = 0; i < 300; ++i) {
+        many[i].emplace_back((i + 1) % 300, 1);
+    }
+    std::stringstream mbuffer;
+    qdtsne::write_neighbors(mbuffer, many);
+    expect_error([&]() {
+        std::stringstream input(mbuffer.str());
+        qdtsne::read_neighbors<uint8_t, double>(input);
+    }, "index type");
+    std::stringstream input(mbuffer.str());
+    auto nn = qdtsne::read_neighbors<uint16_t, double>(input);
+    EXPECT_EQ(nn.indices.back(), 0);
+}
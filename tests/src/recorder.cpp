@@ -0,0 +1,188 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <limits>
+
+#include "knncolle/knncolle.hpp"
+
+#include "qdtsne/initialize.hpp"
+#include "qdtsne/recorder.hpp"
+
+TEST(Recorder, HalfPrecision) {
+    EXPECT_EQ(qdtsne::internal::float_to_half(0), 0);
+    EXPECT_EQ(qdtsne::internal::float_to_half(1), 0x3c00);
+    EXPECT_EQ(qdtsne::internal::float_to_half(-2), 0xc000);
+    EXPECT_EQ(qdtsne::internal::float_to_half(65504), 0x7bff);
+    EXPECT_EQ(qdtsne::internal::float_to_half(1e6), 0x7c00);
+    EXPECT_EQ(qdtsne::internal::float_to_half(std::ldexp(1.0f, -24)), 1); // smallest subnormal.
+    EXPECT_EQ(qdtsne::internal::float_to_half(1e-10), 0);
+    EXPECT_EQ(qdtsne::internal::float_to_half(1 + std::ldexp(1.0f, -11)), 0x3c00); // ties to even.
+    EXPECT_EQ(qdtsne::internal::float_to_half(1 + 3 * std::ldexp(1.0f, -11)), 0x3c02);
+
+    // All finite half-precision values survive a round trip.
+    for (uint32_t h = 0; h < 0x10000; ++h) {
+        if ((h & 0x7c00) == 0x7c00) {
+            continue;
+        }
+        float f = qdtsne::internal::half_to_float(h);
+        EXPECT_EQ(qdtsne::internal::float_to_half(f), h);
+    }
+    EXPECT_TRUE(std::isinf(qdtsne::internal::half_to_float(0x7c00)));
+    EXPECT_TRUE(std::isnan(qdtsne::internal::half_to_float(qdtsne::internal::float_to_half(std::numeric_limits<float>::quiet_NaN()))));
+}
+
+class RecorderTest : public ::testing::Test {
+protected:
+    inline static int ndim = 5;
+    inline static int nobs = 200;
+    inline static std::vector<double> X;
+
+    static void SetUpTestSuite() {
+        X.resize(ndim * nobs);
+        std::mt19937_64 rng(42);
+        std::normal_distribution<> dist(0, 1);
+        for (auto& y : X) {
+            y = dist(rng);
+        }
+    }
+
+    static auto create() {
+        qdtsne::Options opt;
+        opt.perplexity = 10;
+        opt.max_iterations = 100;
+        return qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    }
+
+    static double max_error(const std::vector<qdtsne::TrajectorySnapshot<double> >& observed, const std::vector<std::vector<double> >& expected) {
+        double error = 0;
+        for (size_t s = 0; s < expected.size(); ++s) {
+            for (size_t i = 0; i < expected[s].size(); ++i) {
+                error = std::max(error, std::abs(observed[s].coordinates[i] - expected[s][i]));
+            }
+        }
+        return error;
+    }
+};
+
+TEST_F(RecorderTest, Basic) {
+    auto status = create();
+    auto recorder = std::make_shared<qdtsne::TrajectoryRecorder<double> >(nobs * 2, 10);
+    status.set_recorder(recorder, 10);
+
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    auto init = Y;
+    status.run(Y.data(), 55);
+    status.run(Y.data());
+    EXPECT_EQ(recorder->num_snapshots(), 10);
+
+    auto traj = qdtsne::decode_trajectory<double>(recorder->buffer().data(), recorder->buffer().size());
+    ASSERT_EQ(traj.size(), 10);
+
+    // Same as running to each iteration and taking a copy.
+    auto ref = create();
+    auto copy = init;
+    for (int s = 0; s < 10; ++s) {
+        ref.run(copy.data(), (s + 1) * 10);
+        EXPECT_EQ(traj[s].iteration, (s + 1) * 10);
+        EXPECT_EQ(traj[s].coordinates, copy);
+    }
+    EXPECT_EQ(traj.back().coordinates, Y);
+
+    // Removing the recorder.
+    status.set_recorder(nullptr, 0);
+    status.run(Y.data(), 120);
+    EXPECT_EQ(recorder->num_snapshots(), 10);
+}
+
+TEST_F(RecorderTest, Encoding) {
+    std::vector<std::vector<double> > expected;
+    {
+        auto status = create();
+        auto Y = qdtsne::initialize_random<2>(nobs);
+        for (int s = 1; s <= 20; ++s) {
+            status.run(Y.data(), s * 5);
+            expected.push_back(Y);
+        }
+    }
+
+    auto record = [&](qdtsne::TrajectoryRecorderOptions ropt) -> std::vector<qdtsne::TrajectorySnapshot<double> > {
+        std::stringstream buffer;
+        auto recorder = std::make_shared<qdtsne::TrajectoryRecorder<double> >(buffer, nobs * 2, ropt);
+        auto status = create();
+        status.set_recorder(recorder, 5);
+        auto Y = qdtsne::initialize_random<2>(nobs);
+        status.run(Y.data());
+        return qdtsne::decode_trajectory<double>(buffer);
+    };
+
+    auto full = record(qdtsne::TrajectoryRecorderOptions());
+    EXPECT_EQ(max_error(full, expected), 0);
+
+    qdtsne::TrajectoryRecorderOptions ropt;
+    ropt.delta = true;
+    auto delta = record(ropt);
+    EXPECT_LT(max_error(delta, expected), 1e-10);
+
+    ropt.half_precision = true;
+    auto half_delta = record(ropt);
+    ropt.delta = false;
+    auto half = record(ropt);
+
+    double half_error = max_error(half, expected);
+    double half_delta_error = max_error(half_delta, expected);
+    EXPECT_GT(half_error, 0);
+    EXPECT_LT(half_error, 0.05);
+    EXPECT_LT(half_delta_error, 0.05);
+}
+
+TEST_F(RecorderTest, Errors) {
+    auto status = create();
+    auto recorder = std::make_shared<qdtsne::TrajectoryRecorder<double> >(nobs * 2, 10);
+    EXPECT_ANY_THROW(status.set_recorder(recorder, 0));
+
+    // Different number of values.
+    auto wrong = std::make_shared<qdtsne::TrajectoryRecorder<double> >(nobs, 10);
+    status.set_recorder(wrong, 1);
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    EXPECT_ANY_THROW(status.run(Y.data(), 1));
+
+    // Different type.
+    const auto& buffer = recorder->buffer();
+    EXPECT_ANY_THROW(qdtsne::decode_trajectory<float>(buffer.data(), buffer.size()));
+    EXPECT_ANY_THROW(qdtsne::decode_trajectory<double>(buffer.data(), 5));
+
+    // Unknown flags.
+    auto copy = buffer;
+    copy[12] |= 4;
+    try {
+        qdtsne::decode_trajectory<double>(copy.data(), copy.size());
+        FAIL() << "expected an error";
+    } catch (std::exception& e) {
+        EXPECT_TRUE(std::string(e.what()).find("unknown flags") != std::string::npos) << e.what();
+    }
+}
+
+TEST(Recorder, DeltaOverflow) {
+    qdtsne::TrajectoryRecorderOptions ropt;
+    ropt.half_precision = true;
+    ropt.delta = true;
+    qdtsne::TrajectoryRecorder<double> recorder(2, 3, ropt);
+
+    // Jumps beyond the half-precision range are clamped rather than stored as infinity,
+    // and the remainder is recovered by the next snapshot.
+    std::vector<double> Y { 0, 0 };
+    recorder.record(0, Y.data(), Y.size());
+    Y = std::vector<double>{ 100000, -100000 };
+    recorder.record(1, Y.data(), Y.size());
+    recorder.record(2, Y.data(), Y.size());
+
+    const auto& buffer = recorder.buffer();
+    auto decoded = qdtsne::decode_trajectory<double>(buffer.data(), buffer.size());
+    ASSERT_EQ(decoded.size(), 3);
+    EXPECT_EQ(decoded[1].coordinates, std::vector<double>({ 65504, -65504 }));
+    EXPECT_EQ(decoded[2].coordinates, Y);
+}
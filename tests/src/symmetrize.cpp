@@ -101,6 +101,46 @@ TEST_P(SymmetrizeTest, Combining) {
     EXPECT_EQ(probs.size(), found.size());
 }
 
+TEST(Symmetrize, Pruning) {
+    qdtsne::NeighborList<int, double> stored(4);
+    stored[0] = { { 1, 0.5 }, { 2, 0.45 }, { 3, 0.05 } };
+    stored[1] = { { 0, 0.9 }, { 2, 0.08 }, { 3, 0.02 } };
+    stored[2] = { { 3, 0.4 }, { 1, 0.35 }, { 0, 0.25 } };
+    stored[3] = {};
+
+    auto copy = stored;
+    EXPECT_EQ(qdtsne::internal::prune_matrix(copy, 0.0, 1), 0);
+    EXPECT_EQ(copy, stored);
+
+    EXPECT_EQ(qdtsne::internal::prune_matrix(stored, 0.2, 1), 3);
+    EXPECT_EQ(qdtsne::internal::count_edges(stored), 6);
+
+    ASSERT_EQ(stored[0].size(), 2);
+    EXPECT_EQ(stored[0][0].first, 1);
+    EXPECT_FLOAT_EQ(stored[0][0].second, 0.5 / 0.95);
+    EXPECT_EQ(stored[0][1].first, 2);
+    EXPECT_FLOAT_EQ(stored[0][1].second, 0.45 / 0.95);
+
+    ASSERT_EQ(stored[1].size(), 1);
+    EXPECT_EQ(stored[1][0].first, 0);
+    EXPECT_FLOAT_EQ(stored[1][0].second, 1);
+
+    EXPECT_EQ(stored[2].size(), 3);
+    EXPECT_TRUE(stored[3].empty());
+
+    // Pruned rows release their excess memory.
+    EXPECT_EQ(stored[0].capacity(), stored[0].size());
+    EXPECT_EQ(stored[1].capacity(), stored[1].size());
+
+    // Same results in parallel.
+    auto pcopy = copy;
+    EXPECT_EQ(qdtsne::internal::prune_matrix(pcopy, 0.2, 3), 3);
+    EXPECT_EQ(pcopy, stored);
+
+    EXPECT_ANY_THROW(qdtsne::internal::prune_matrix(copy, 1.0, 1));
+    EXPECT_ANY_THROW(qdtsne::internal::prune_matrix(copy, -0.1, 1));
+}
+
 INSTANTIATE_TEST_SUITE_P(
     Symmetrize,
     SymmetrizeTest,
@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <iomanip>
+
+#include "knncolle/knncolle.hpp"
+
+#include "qdtsne/qdtsne.hpp"
+
+static size_t count_occurrences(const std::string& haystack, const std::string& needle) {
+    size_t count = 0;
+    for (size_t pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1)) {
+        ++count;
+    }
+    return count;
+}
+
+TEST(Trace, Basic) {
+    int ndim = 5, nobs = 200;
+    std::vector<double> X(ndim * nobs);
+    std::mt19937_64 rng(42);
+    std::normal_distribution<> dist(0, 1);
+    for (auto& y : X) {
+        y = dist(rng);
+    }
+
+    qdtsne::Options opt;
+    opt.num_threads = 2;
+    opt.leaf_approximation = true;
+    opt.max_depth = 5;
+    auto status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+
+    qdtsne::clear_trace();
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    status.run(Y.data(), 10);
+
+    std::stringstream buffer;
+    qdtsne::dump_trace(buffer);
+    auto out = buffer.str();
+
+    EXPECT_EQ(out.rfind("{\"traceEvents\":[", 0), 0);
+    EXPECT_EQ(count_occurrences(out, "\"name\":\"iteration\""), 10);
+    EXPECT_EQ(count_occurrences(out, "\"name\":\"tree build\""), 10);
+    EXPECT_EQ(count_occurrences(out, "\"name\":\"leaf pass\""), 20);
+    EXPECT_EQ(count_occurrences(out, "\"name\":\"traversal\""), 20);
+    EXPECT_EQ(count_occurrences(out, "\"name\":\"update\""), 10); // only parallelized with NUMA awareness.
+    EXPECT_GE(count_occurrences(out, "\"name\":\"edge forces\""), 10);
+    EXPECT_GE(count_occurrences(out, "\"name\":\"worker\""), 20);
+    EXPECT_EQ(count_occurrences(out, "\"ph\":\"X\""), count_occurrences(out, "\"name\":"));
+
+    // Parallelized phases are recorded by the workers, not the joining thread.
+    qdtsne::internal::trace_log().visit([&](const qdtsne::internal::TraceEvent& e) -> void {
+        std::string name = e.name;
+        if (name == "leaf pass" || name == "traversal") {
+            EXPECT_GT(e.thread, 0);
+        }
+    });
+
+    qdtsne::clear_trace();
+    std::stringstream empty;
+    qdtsne::dump_trace(empty);
+    EXPECT_EQ(count_occurrences(empty.str(), "\"name\":"), 0);
+}
+
+TEST(Trace, Summary) {
+    qdtsne::clear_trace();
+    {
+        QDTSNE_TRACE_SCOPE("foo");
+        QDTSNE_TRACE_SCOPE("bar");
+    }
+    {
+        QDTSNE_TRACE_SCOPE("foo");
+    }
+
+    std::stringstream buffer;
+    qdtsne::dump_trace_summary(buffer);
+    std::string line;
+    std::getline(buffer, line);
+    EXPECT_EQ(line, "phase\tcount\ttime_ms\tinstructions\tcache_misses\tbranch_misses");
+    std::getline(buffer, line);
+    EXPECT_EQ(line.rfind("bar\t1\t", 0), 0);
+    std::getline(buffer, line);
+    EXPECT_EQ(line.rfind("foo\t2\t", 0), 0);
+
+#ifdef QDTSNE_PERF_COUNTERS
+    // Counters are only reported if they could be opened on this machine.
+    bool available = qdtsne::internal::perf_counters().available();
+    EXPECT_EQ(line.find("NA") == std::string::npos, available);
+
+    std::stringstream json;
+    qdtsne::dump_trace(json);
+    EXPECT_EQ(json.str().find("\"instructions\":") != std::string::npos, available);
+#else
+    EXPECT_NE(line.find("NA"), std::string::npos);
+#endif
+}
+
+TEST(Trace, Workers) {
+    qdtsne::clear_trace();
+    {
+        QDTSNE_TRACE_SCOPE("outside");
+    }
+    qdtsne::parallelize(3, 3, [&](int, int, int) -> void {
+        QDTSNE_TRACE_SCOPE("inside");
+
+        // Single-worker sections stay on the enclosing timeline.
+        qdtsne::parallelize(1, 1, [&](int, int, int) -> void {
+            QDTSNE_TRACE_SCOPE("nested");
+        });
+    });
+
+    std::vector<int> inside, nested;
+    qdtsne::internal::trace_log().visit([&](const qdtsne::internal::TraceEvent& e) -> void {
+        std::string name = e.name;
+        if (name == "outside") {
+            EXPECT_EQ(e.thread, 0);
+        } else if (name == "inside") {
+            inside.push_back(e.thread);
+        } else if (name == "nested") {
+            nested.push_back(e.thread);
+        }
+    });
+
+    std::sort(inside.begin(), inside.end());
+    EXPECT_EQ(inside, std::vector<int>({ 1, 2, 3 }));
+    std::sort(nested.begin(), nested.end());
+    EXPECT_EQ(nested, inside);
+
+    // Timestamps are printed in fixed notation without affecting the stream.
+    std::stringstream buffer;
+    buffer << std::setprecision(2);
+    qdtsne::dump_trace(buffer);
+    auto out = buffer.str();
+    auto ts = out.find("\"ts\":");
+    ASSERT_NE(ts, std::string::npos);
+    auto dur = out.find(",\"dur\":", ts);
+    std::string value = out.substr(ts + 5, dur - ts - 5);
+    EXPECT_EQ(value.find('e'), std::string::npos);
+    EXPECT_EQ(value.size() - value.find('.'), 4u) << value;
+    EXPECT_EQ(buffer.precision(), 2);
+    EXPECT_FALSE(buffer.flags() & std::ios::fixed);
+}
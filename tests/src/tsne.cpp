@@ -10,6 +10,10 @@
 #include <map>
 #include <algorithm>
 #include <cmath>
+#include <numeric>
+#include <thread>
+#include <string>
+#include <stdexcept>
 
 #include "knncolle/knncolle.hpp"
 
@@ -139,6 +143,36 @@ TEST_P(TsneTester, StopStart) {
     EXPECT_EQ(copy, Y);
 }
 
+TEST_P(TsneTester, Callback) {
+    int K = GetParam();
+
+    qdtsne::Options opt;
+    opt.perplexity = K / 3.0;
+    auto status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    auto copy = Y;
+    status.run(Y.data());
+
+    auto restatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    std::vector<int> progress;
+    bool completed = restatus.run(copy.data(), 1000, [&](int iter) -> bool {
+        progress.push_back(iter);
+        return iter < 300;
+    });
+
+    EXPECT_FALSE(completed);
+    EXPECT_EQ(restatus.iteration(), 300);
+    EXPECT_EQ(progress.size(), 300);
+    EXPECT_EQ(progress.front(), 1);
+    EXPECT_EQ(progress.back(), 300);
+
+    // Resuming gives the same results.
+    completed = restatus.run(copy.data(), 1000, [&](int) -> bool { return true; });
+    EXPECT_TRUE(completed);
+    EXPECT_EQ(copy, Y);
+}
+
 TEST_P(TsneTester, AltStart) {
     int K = GetParam();
 
@@ -172,6 +206,49 @@ TEST_P(TsneTester, AltStart) {
     EXPECT_EQ(copy, Y);
 }
 
+TEST_P(TsneTester, DenseStart) {
+    int K = GetParam();
+
+    auto index = knncolle::VptreeBuilder<>().build_unique(knncolle::SimpleMatrix(ndim, nobs, X.data()));
+    auto neighbors = knncolle::find_nearest_neighbors(*index, K);
+    std::vector<int> indices;
+    std::vector<double> distances;
+    for (const auto& current : neighbors) {
+        for (const auto& x : current) {
+            indices.push_back(x.first);
+            distances.push_back(x.second);
+        }
+    }
+
+    qdtsne::Options options;
+    auto status = qdtsne::initialize<2>(nobs, K, indices.data(), distances.data(), options);
+    auto ref_status = qdtsne::initialize<2>(std::move(neighbors), options);
+    EXPECT_EQ(status.get_neighbors(), ref_status.get_neighbors());
+
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    auto copy = Y;
+    status.run(Y.data());
+    ref_status.run(copy.data());
+    EXPECT_EQ(copy, Y);
+
+    // Same results in parallel.
+    options.num_threads = 3;
+    auto pstatus = qdtsne::initialize<2>(nobs, K, indices.data(), distances.data(), options);
+    EXPECT_EQ(status.get_neighbors(), pstatus.get_neighbors());
+
+    // Same results with strided inputs, here with one column per neighbor.
+    std::vector<int> tindices(indices.size());
+    std::vector<double> tdistances(distances.size());
+    for (int i = 0; i < nobs; ++i) {
+        for (int k = 0; k < K; ++k) {
+            tindices[k * nobs + i] = indices[i * K + k];
+            tdistances[k * nobs + i] = distances[i * K + k];
+        }
+    }
+    auto tstatus = qdtsne::initialize<2>(nobs, K, tindices.data(), tdistances.data(), nobs, 1, options);
+    EXPECT_EQ(status.get_neighbors(), tstatus.get_neighbors());
+}
+
 TEST_P(TsneTester, LeafApproximation) {
     int K = GetParam();
 
@@ -207,6 +284,618 @@ TEST_P(TsneTester, LeafApproximation) {
     EXPECT_EQ(copy, Y);
 }
 
+TEST_P(TsneTester, OneDimensional) {
+    int K = GetParam();
+
+    qdtsne::Options opt;
+    opt.perplexity = K / 3.0;
+    auto status = qdtsne::initialize<1>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+
+    auto Y = qdtsne::initialize_random<1>(nobs);
+    auto old = Y;
+
+    status.run(Y.data());
+    EXPECT_NE(old, Y); // there was some effect...
+    EXPECT_EQ(status.iteration(), 1000);
+
+    double total = std::accumulate(Y.begin(), Y.end(), 0.0);
+    EXPECT_TRUE(std::abs(total/nobs) < 1e-10);
+
+    // Same results when run in parallel.
+    opt.num_threads = 3;
+    auto pstatus = qdtsne::initialize<1>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+
+    auto copy = old;
+    pstatus.run(copy.data());
+    EXPECT_EQ(copy, Y);
+}
+
+TEST_P(TsneTester, OneDimensionalOutlier) {
+    int K = GetParam();
+
+    qdtsne::Options opt;
+    opt.perplexity = K / 3.0;
+    opt.max_iterations = 20;
+    auto status = qdtsne::initialize<1>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+
+    // The outlier stretches the range beyond the interpolation cap, so the repulsive forces use the kd-tree fallback.
+    auto Y = qdtsne::initialize_random<1>(nobs);
+    Y.back() = 1e6;
+    auto old = Y;
+
+    status.run(Y.data());
+    EXPECT_NE(old, Y);
+    for (auto y : Y) {
+        EXPECT_TRUE(std::isfinite(y));
+    }
+
+    // Same results when run in parallel.
+    opt.num_threads = 3;
+    auto pstatus = qdtsne::initialize<1>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto copy = old;
+    pstatus.run(copy.data());
+    EXPECT_EQ(copy, Y);
+}
+
+TEST_P(TsneTester, NegativeSampling) {
+    int K = GetParam();
+
+    qdtsne::Options opt;
+    opt.perplexity = K / 3.0;
+    opt.negative_samples = 10;
+    auto status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    auto old = Y;
+
+    status.run(Y.data());
+    EXPECT_NE(old, Y); // there was some effect...
+    EXPECT_EQ(status.iteration(), 1000);
+
+    for (auto y : Y) {
+        EXPECT_TRUE(std::isfinite(y));
+    }
+
+    // Same results when run in parallel.
+    opt.num_threads = 3;
+    auto pstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+
+    auto copy = old;
+    pstatus.run(copy.data());
+    EXPECT_EQ(copy, Y);
+
+    // Different results with a different seed.
+    opt.seed = 100;
+    auto sstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    copy = old;
+    sstatus.run(copy.data());
+    EXPECT_NE(copy, Y);
+}
+
+TEST_P(TsneTester, LowMemory) {
+    int K = GetParam();
+
+    qdtsne::Options opt;
+    opt.perplexity = K / 3.0;
+    auto status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    auto old = Y;
+    status.run(Y.data(), 10);
+
+    opt.low_memory = true;
+    auto lstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto copy = old;
+    lstatus.run(copy.data(), 10);
+
+    // Gains are stored in single precision, so the results are only similar;
+    // we only check the early iterations as small differences are amplified later.
+    for (int i = 0; i < nobs * 2; ++i) {
+        EXPECT_NEAR(copy[i], Y[i], 1e-3);
+    }
+
+    lstatus.run(copy.data());
+    EXPECT_EQ(lstatus.iteration(), 1000);
+
+    // Same results when stopped and started, even though the tree is released in between.
+    opt.num_threads = 3;
+    auto restatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto recopy = old;
+    restatus.run(recopy.data(), 500);
+    restatus.run(recopy.data(), 1000);
+    EXPECT_EQ(recopy, copy);
+
+    // Only the persistent buffers remain between runs.
+    auto used = restatus.memory_usage();
+    EXPECT_EQ(used.tree, 0);
+    EXPECT_EQ(used.workspace, 0);
+    EXPECT_EQ(used.buffers, nobs * 2 * (sizeof(double) + sizeof(float)));
+}
+
+TEST_P(TsneTester, NumaAware) {
+    int K = GetParam();
+
+    qdtsne::Options opt;
+    opt.perplexity = K / 3.0;
+    auto status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    auto old = Y;
+    status.run(Y.data());
+
+    // Partitioning and thread placement shouldn't affect the results.
+    opt.num_threads = 3;
+    opt.numa_aware = true;
+    auto nstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto copy = old;
+    nstatus.run(copy.data());
+    EXPECT_EQ(copy, Y);
+
+    opt.pin_threads = true;
+    auto pstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    copy = old;
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    cpu_set_t before, after;
+    ASSERT_EQ(pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &before), 0);
+#endif
+    pstatus.run(copy.data());
+    EXPECT_EQ(copy, Y);
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    // The calling thread keeps its original affinity, even if it was used as a worker.
+    ASSERT_EQ(pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &after), 0);
+    EXPECT_TRUE(CPU_EQUAL(&before, &after));
+
+#ifndef CUSTOM_PARALLEL_TEST
+    // Same for exceptions thrown while the calling thread is pinned. (The
+    // custom parallelization backend doesn't propagate exceptions.)
+    {
+        auto sopt = opt;
+        sopt.num_threads = 1;
+        auto sstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), sopt);
+        EXPECT_THROW(sstatus.test_parallelize_pinned(nobs, [&](int, int, int) -> void {
+            cpu_set_t pinned;
+            ASSERT_EQ(pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &pinned), 0);
+            EXPECT_EQ(CPU_COUNT(&pinned), 1);
+            EXPECT_EQ(qdtsne::internal::thread_pin_state().worker, 0);
+            throw std::runtime_error("oops");
+        }), std::runtime_error);
+        ASSERT_EQ(pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &after), 0);
+        EXPECT_TRUE(CPU_EQUAL(&before, &after));
+        EXPECT_EQ(qdtsne::internal::thread_pin_state().worker, -1); // in case there's only one CPU.
+    }
+#endif
+#endif
+
+    // Pinning also works without the NUMA-aware mode.
+    opt.numa_aware = false;
+    opt.leaf_approximation = true;
+    opt.max_depth = 7;
+    auto lstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto lcopy = old;
+    lstatus.run(lcopy.data());
+
+    opt.numa_aware = true;
+    opt.pin_threads = false;
+    opt.num_threads = 2;
+    auto lnstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    copy = old;
+    lnstatus.run(copy.data());
+    EXPECT_EQ(copy, lcopy);
+}
+
+TEST_P(TsneTester, Pruning) {
+    int K = GetParam();
+
+    qdtsne::Options opt;
+    opt.perplexity = K / 3.0;
+    auto status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    EXPECT_EQ(status.num_pruned_edges(), 0);
+    size_t full = status.num_edges();
+    EXPECT_GE(full, static_cast<size_t>(nobs * K));
+
+    opt.prune_threshold = 0.1;
+    auto pstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    EXPECT_GT(pstatus.num_pruned_edges(), 0);
+    EXPECT_LT(pstatus.num_edges(), full);
+    EXPECT_GE(pstatus.num_edges(), static_cast<size_t>(nobs * K) - pstatus.num_pruned_edges()); // symmetrization only adds edges.
+
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    pstatus.run(Y.data());
+    for (auto y : Y) {
+        EXPECT_TRUE(std::isfinite(y));
+    }
+
+    // Same pruning for the precomputed overloads.
+    auto index = knncolle::VptreeBuilder().build_unique(knncolle::SimpleMatrix(ndim, nobs, X.data()));
+    auto neighbors = knncolle::find_nearest_neighbors(*index, K);
+    opt.infer_perplexity = false;
+    auto nstatus = qdtsne::initialize<2>(neighbors, opt);
+    EXPECT_EQ(nstatus.num_pruned_edges(), pstatus.num_pruned_edges());
+    EXPECT_EQ(nstatus.num_edges(), pstatus.num_edges());
+
+    // Invalid thresholds are caught up front by all overloads.
+    opt.prune_threshold = 1;
+    EXPECT_ANY_THROW(qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt));
+    EXPECT_ANY_THROW(qdtsne::initialize<2>(*index, opt));
+    EXPECT_ANY_THROW(qdtsne::initialize<2>(neighbors, opt));
+
+    // Checking that the threshold is validated before the neighbors are, i.e., before any calibration.
+    std::string msg;
+    try {
+        qdtsne::initialize<2>(static_cast<size_t>(10), -1, static_cast<const int*>(NULL), static_cast<const double*>(NULL), opt);
+    } catch (std::exception& e) {
+        msg = e.what();
+    }
+    EXPECT_TRUE(msg.find("pruning threshold") != std::string::npos);
+}
+
+TEST_P(TsneTester, EdgeSampling) {
+    int K = GetParam();
+
+    qdtsne::Options opt;
+    opt.perplexity = K / 3.0;
+    auto status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    auto old = Y;
+    status.run(Y.data());
+
+    // No effect if every point has fewer edges than the number of samples.
+    opt.edge_samples = nobs;
+    auto fstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto copy = old;
+    fstatus.run(copy.data());
+    EXPECT_EQ(copy, Y);
+
+    opt.edge_samples = 5;
+    auto sstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto sampled = old;
+    sstatus.run(sampled.data());
+    EXPECT_NE(sampled, Y);
+    for (auto y : sampled) {
+        EXPECT_TRUE(std::isfinite(y));
+    }
+    EXPECT_GT(sstatus.memory_usage().neighbors, status.memory_usage().neighbors);
+
+    // Results are independent of the number of threads.
+    opt.num_threads = 3;
+    auto pstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    copy = old;
+    pstatus.run(copy.data());
+    EXPECT_EQ(copy, sampled);
+}
+
+TEST_P(TsneTester, EarlyTheta) {
+    int K = GetParam();
+
+    qdtsne::Options opt;
+    opt.perplexity = K / 3.0;
+    auto status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    auto old = Y;
+    status.run(Y.data());
+
+    // No effect if it's not larger than the usual theta.
+    opt.early_theta = opt.theta;
+    auto same_status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto copy = old;
+    same_status.run(copy.data());
+    EXPECT_EQ(copy, Y);
+
+    // Looser approximation gives different results in the early iterations.
+    auto rstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto ref = old;
+    rstatus.run(ref.data(), opt.stop_lying_iter);
+
+    opt.early_theta = 3;
+    auto estatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto early = old;
+    estatus.run(early.data(), opt.stop_lying_iter);
+    EXPECT_NE(early, ref);
+    for (auto y : early) {
+        EXPECT_TRUE(std::isfinite(y));
+    }
+
+    // No effect without an early exaggeration phase.
+    opt.early_theta = 0;
+    opt.stop_lying_iter = 0;
+    opt.exaggeration_factor = 1;
+    auto nstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto ncopy = old;
+    nstatus.run(ncopy.data(), 50);
+
+    opt.early_theta = 3;
+    auto n2status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto n2copy = old;
+    n2status.run(n2copy.data(), 50);
+    EXPECT_EQ(ncopy, n2copy);
+
+    // Same for the leaf approximation.
+    opt.stop_lying_iter = 250;
+    opt.exaggeration_factor = 12;
+    opt.leaf_approximation = true;
+    opt.max_depth = 7;
+    opt.early_theta = 0;
+    auto lstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto lcopy = old;
+    lstatus.run(lcopy.data(), 100);
+
+    opt.early_theta = 3;
+    auto lestatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto lecopy = old;
+    lestatus.run(lecopy.data(), 100);
+    EXPECT_NE(lcopy, lecopy);
+}
+
+TEST_P(TsneTester, AutoDepth) {
+    int K = GetParam();
+
+    qdtsne::Options opt;
+    opt.perplexity = K / 3.0;
+    opt.leaf_approximation = true;
+    opt.target_leaf_occupancy = 4;
+    auto status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    auto old = Y;
+    status.run(Y.data());
+    for (auto y : Y) {
+        EXPECT_TRUE(std::isfinite(y));
+    }
+
+    // Different from the default fixed depth, which has one point per leaf.
+    opt.target_leaf_occupancy = 0;
+    auto fstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto fixed = old;
+    fstatus.run(fixed.data(), 10);
+
+    opt.target_leaf_occupancy = 4;
+    auto astatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto automatic = old;
+    astatus.run(automatic.data(), 10);
+    EXPECT_NE(fixed, automatic);
+
+    // Same results when run in parallel.
+    opt.num_threads = 3;
+    auto pstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto copy = old;
+    pstatus.run(copy.data());
+    EXPECT_EQ(copy, Y);
+}
+
+TEST_P(TsneTester, Buckets) {
+    int K = GetParam();
+
+    qdtsne::Options opt;
+    opt.perplexity = K / 3.0;
+    opt.bucket_size = 8;
+    auto status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    auto old = Y;
+    status.run(Y.data());
+    for (auto y : Y) {
+        EXPECT_TRUE(std::isfinite(y));
+    }
+
+    // Same results when run in parallel.
+    opt.num_threads = 3;
+    auto pstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto copy = old;
+    pstatus.run(copy.data());
+    EXPECT_EQ(copy, Y);
+
+    // Same as the unbucketed results (up to numerical precision) after a few
+    // iterations, when both trees are exact.
+    opt.num_threads = 1;
+    opt.theta = 0;
+    auto bstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto bucketed = old;
+    bstatus.run(bucketed.data(), 5);
+
+    opt.bucket_size = 1;
+    auto rstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto ref = old;
+    rstatus.run(ref.data(), 5);
+    for (size_t i = 0; i < ref.size(); ++i) {
+        EXPECT_NEAR(ref[i], bucketed[i], 1e-8);
+    }
+
+    // Works with the other tree options.
+    opt.theta = 1;
+    opt.bucket_size = 8;
+    opt.leaf_approximation = true;
+    opt.target_leaf_occupancy = 16;
+    opt.num_threads = 1;
+    auto lstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto lcopy = old;
+    lstatus.run(lcopy.data(), 100);
+
+    opt.num_threads = 3;
+    auto lpstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto lpcopy = old;
+    lpstatus.run(lpcopy.data(), 100);
+    EXPECT_EQ(lcopy, lpcopy);
+}
+
+TEST_P(TsneTester, KdTree) {
+    int K = GetParam();
+
+    qdtsne::Options opt;
+    opt.perplexity = K / 3.0;
+    opt.kd_tree = true;
+    auto status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    auto old = Y;
+    status.run(Y.data());
+    for (auto y : Y) {
+        EXPECT_TRUE(std::isfinite(y));
+    }
+
+    // Same results when run in parallel.
+    opt.num_threads = 3;
+    auto pstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto copy = old;
+    pstatus.run(copy.data());
+    EXPECT_EQ(copy, Y);
+
+    // Same as the quadtree (up to numerical precision) after a few iterations,
+    // when both trees are exact.
+    opt.num_threads = 1;
+    opt.theta = 0;
+    auto kstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto kd = old;
+    kstatus.run(kd.data(), 5);
+
+    opt.kd_tree = false;
+    auto qstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto quad = old;
+    qstatus.run(quad.data(), 5);
+    for (size_t i = 0; i < quad.size(); ++i) {
+        EXPECT_NEAR(quad[i], kd[i], 1e-8);
+    }
+
+    // Works with buckets and the leaf approximation.
+    opt.theta = 1;
+    opt.kd_tree = true;
+    opt.bucket_size = 8;
+    opt.leaf_approximation = true;
+    auto lstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto lcopy = old;
+    lstatus.run(lcopy.data(), 100);
+    for (auto y : lcopy) {
+        EXPECT_TRUE(std::isfinite(y));
+    }
+
+    opt.num_threads = 3;
+    auto lpstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    auto lpcopy = old;
+    lpstatus.run(lpcopy.data(), 100);
+    EXPECT_EQ(lcopy, lpcopy);
+
+    // Memory usage is consistent with the estimate.
+    auto used = lpstatus.memory_usage();
+    auto expected = qdtsne::estimate_memory<2, int, double>(nobs, K, opt);
+    EXPECT_GT(used.tree, 0);
+    EXPECT_LT(used.tree, expected.iteration.tree * 1.5);
+}
+
+TEST_P(TsneTester, Publish) {
+    int K = GetParam();
+
+    qdtsne::Options opt;
+    opt.perplexity = K / 3.0;
+    opt.publish_interval = 100;
+    auto status = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    EXPECT_FALSE(status.published());
+
+    auto Y = qdtsne::initialize_random<2>(nobs);
+    auto copy = Y;
+
+    status.run(Y.data(), 250);
+    auto pub = status.published();
+    EXPECT_EQ(pub->iteration, 250);
+    EXPECT_EQ(pub->coordinates, Y);
+
+    // Concurrent reads while running.
+    std::thread runner([&]() -> void { status.run(Y.data()); });
+    int last = 250;
+    std::shared_ptr<const qdtsne::Status<2, int, double>::Published> held;
+    std::vector<double> held_coordinates;
+    while (last < 1000) {
+        auto current = status.published();
+        EXPECT_GE(current->iteration, last);
+        EXPECT_EQ(current->coordinates.size(), Y.size());
+        last = current->iteration;
+
+        // A copy held by a reader is never modified by later publications.
+        if (!held && last > 250 && last < 1000) {
+            held = current;
+            held_coordinates = current->coordinates;
+        }
+        current.reset();
+    }
+    runner.join();
+    if (held) {
+        EXPECT_EQ(held->coordinates, held_coordinates);
+        EXPECT_NE(held, status.published());
+    }
+
+    // Holding onto a copy doesn't affect it.
+    EXPECT_EQ(pub->iteration, 250);
+    EXPECT_NE(pub, status.published());
+    EXPECT_EQ(status.published()->iteration, 1000);
+    EXPECT_EQ(status.published()->coordinates, Y);
+
+    // Copies are recycled once no reader holds them.
+    {
+        opt.publish_interval = 1;
+        auto rstatus = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+        auto rY = qdtsne::initialize_random<2>(nobs);
+        std::vector<const void*> addresses;
+        for (int i = 1; i <= 3; ++i) {
+            rstatus.run(rY.data(), i);
+            addresses.push_back(rstatus.published().get());
+        }
+        EXPECT_NE(addresses[0], addresses[1]);
+        EXPECT_EQ(addresses[0], addresses[2]);
+
+        auto held = rstatus.published();
+        held_coordinates = held->coordinates;
+        for (int i = 4; i <= 6; ++i) {
+            rstatus.run(rY.data(), i);
+            EXPECT_NE(rstatus.published(), held);
+        }
+        EXPECT_EQ(held->iteration, 3);
+        EXPECT_EQ(held->coordinates, held_coordinates);
+    }
+
+    // Publishing has no effect on the results.
+    opt.publish_interval = 0;
+    auto ref = qdtsne::initialize<2>(ndim, nobs, X.data(), knncolle::VptreeBuilder(), opt);
+    ref.run(copy.data());
+    EXPECT_EQ(copy, Y);
+    EXPECT_FALSE(ref.published());
+}
+
+TEST(TsneOverlap, SameAsSerial) {
+    // The parallel tree build overlaps with the edge forces in the other
+    // workers, see Status::set_repulsion_and_edge_forces(). This should not
+    // affect the results for any combination of tree options, including when
+    // there are more workers than points (i.e., some edge workers are idle).
+    int ndim = 5;
+    for (int nobs : { 20, 100 }) {
+        std::vector<double> data(ndim * nobs);
+        std::mt19937_64 rng(nobs);
+        std::normal_distribution<> dist(0, 1);
+        for (auto& y : data) {
+            y = dist(rng);
+        }
+        auto init = qdtsne::initialize_random<2>(nobs);
+
+        for (int combo = 0; combo < 16; ++combo) {
+            qdtsne::Options opt;
+            opt.perplexity = 5;
+            opt.max_iterations = 20;
+            opt.leaf_approximation = (combo & 1);
+            opt.bucket_size = (combo & 2 ? 4 : 1);
+            opt.kd_tree = (combo & 4);
+            opt.numa_aware = (combo & 8);
+
+            opt.num_threads = 1;
+            auto ref_status = qdtsne::initialize<2>(ndim, nobs, data.data(), knncolle::VptreeBuilder(), opt);
+            auto ref = init;
+            ref_status.run(ref.data());
+
+            for (int nthreads : { 2, 7, 32 }) {
+                opt.num_threads = nthreads;
+                auto status = qdtsne::initialize<2>(ndim, nobs, data.data(), knncolle::VptreeBuilder(), opt);
+                auto Y = init;
+                status.run(Y.data());
+                EXPECT_EQ(Y, ref) << "nobs = " << nobs << ", combo = " << combo << ", threads = " << nthreads;
+            }
+        }
+    }
+}
+
 INSTANTIATE_TEST_SUITE_P(
     TsneTests,
     TsneTester,
@@ -39,3 +39,42 @@ INSTANTIATE_TEST_SUITE_P(
         ::testing::Values(42, 100, 0) // various seeds
     )
 );
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+#include <thread>
+
+static std::vector<int> current_cpus() {
+    cpu_set_t mask;
+    EXPECT_EQ(pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask), 0);
+    std::vector<int> output;
+    for (int c = 0; c < CPU_SETSIZE; ++c) {
+        if (CPU_ISSET(c, &mask)) {
+            output.push_back(c);
+        }
+    }
+    return output;
+}
+
+TEST(ThreadPinning, Affinity) {
+    auto original = current_cpus();
+    ASSERT_FALSE(original.empty());
+
+    // Using a separate thread so that the test runner's affinity is never touched.
+    std::thread runner([&]() -> void {
+        qdtsne::internal::pin_thread(1);
+        EXPECT_EQ(current_cpus(), std::vector<int>{ original[1 % original.size()] });
+
+        // Indices are relative to the original mask, not the pinned one.
+        qdtsne::internal::pin_thread(0);
+        EXPECT_EQ(current_cpus(), std::vector<int>{ original[0] });
+        qdtsne::internal::pin_thread(original.size() + 1);
+        EXPECT_EQ(current_cpus(), std::vector<int>{ original[1 % original.size()] });
+
+        qdtsne::internal::unpin_thread();
+        EXPECT_EQ(current_cpus(), original);
+    });
+    runner.join();
+
+    EXPECT_EQ(current_cpus(), original);
+}
+#endif